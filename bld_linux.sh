@@ -7,10 +7,10 @@ gcc -Wno-format-truncation -g -o temp msend.c -l rt
 if [ $? -ne 0 ]; then exit 1; fi
 mv temp Linux64/msend
 
-gcc -Wno-format-truncation -g -o temp mdump.c -l rt
+gcc -Wno-format-truncation -g -o temp mdump.c -l rt -l pthread
 if [ $? -ne 0 ]; then exit 1; fi
 mv temp Linux64/mdump
 
-gcc -Wno-format-truncation -g -o temp mpong.c -l rt -l m
+gcc -Wno-format-truncation -g -o temp mpong.c -l rt -l m -l pthread
 if [ $? -ne 0 ]; then exit 1; fi
 mv temp Linux64/mpong
@@ -10,8 +10,8 @@ fi
 gcc -Wall -g -o msnd msnd.c -l rt
 if [ $? -ne 0 ]; then exit 1; fi
 
-gcc -Wall -g -o mrcv mrcv.c -l rt
+gcc -Wall -g -o mrcv mrcv.c -l rt -l m -l pthread
 if [ $? -ne 0 ]; then exit 1; fi
 
-gcc -Wall -g -o mforwarder mforwarder.c -l rt -l onload_ext
+gcc -Wall -g -o mforwarder mforwarder.c -l rt -l m -l pthread -l onload_ext
 if [ $? -ne 0 ]; then exit 1; fi
@@ -1,12 +1,14 @@
 /* mforwarder.c */
 
-#define _GNU_SOURCE  /* Needed for recvmmsg */
+#define _GNU_SOURCE  /* Needed for recvmmsg, sendmmsg, pthread_setaffinity_np */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
 #include <netinet/in.h>
 #include <sys/uio.h>
 #include <sys/socket.h>
@@ -17,13 +19,33 @@
 #include <signal.h>
 #include <onload/extensions.h>
 
+#include "../mtime.h"
+#include "../mwire.h"
+#include "../mhist.h"
+
 #define MAX_UDP_PAYLOAD 1472
+#define STAMP_LEN 8  /* -S: residence time appended to the payload */
+#define BUF_SIZE (MAX_UDP_PAYLOAD + STAMP_LEN)
+#define MAX_SND_BATCH 64  /* pipeline send thread: datagrams per sendmmsg() */
+#define MAX_ROUTES 256
+#define MAX_ROUTE_OUTPUTS 16
+/* Room for SO_TIMESTAMPNS and IP_PKTINFO control messages. */
+#define CTL_BUF_SIZE (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(struct in_pktinfo)))
 
 /* program options */
+int o_snd_cpu;
+int o_batch_fwd;
+char *o_select;
+int o_kernel_ts;
 int o_linger_ms;
 int o_multi_rcv;
 int o_num_msgs_expected;
+int o_pipe_size;
+char *o_impair;
+char *o_route_file;
 int o_rcvbuf_size;
+int o_stamp;
+char *o_timer;
 int o_v_bitmask;
 int o_wait_ms;
 
@@ -39,20 +61,102 @@ char *bind_if;
 /* Globals. */
 int snd_sockfd;
 int quit;
-int state;
-int num_msgs;
-int num_warmups;
-int num_quits;
-int num_ooo;
+int state;  /* STATE_MEASURING once any route has data */
 uint8_t *sqn_cnt;
-uint32_t prev_sqn;
-struct timespec start_ts;
-struct timespec stop_ts;
-struct timespec last_pkt_ts;
+uint64_t last_pkt_ns;
 int max_dgrams_in_loop;
+/* Forwarding selection (-f). */
+#define SELECT_ALT 0  /* every other data message (the original rule) */
+#define SELECT_ALL 1
+#define SELECT_NTH 2  /* every Nth datagram */
+#define SELECT_TYPE 3  /* mwire type matches */
+#define SELECT_SEQ 4  /* sequence number in [lo, hi] */
+int select_mode;
+uint64_t select_n, select_lo, select_hi;
+uint64_t select_cnt;
+uint64_t num_forwarded;
+uint64_t num_rcv_syscalls;
+uint64_t num_snd_syscalls;
+/* Residence time: ingress (receive) to egress (send call returned). */
+mhist_t residence_hist;
+uint64_t num_no_kernel_ts;
 /* For send sock. */
 struct in_addr iface_in;
-struct sockaddr_in snd_group_sin;
+
+/* Routing table: each input (group or local address, and port) forwards
+ * to one or more outputs.  Without -R there is one route, from the
+ * positional group to the next group on the same port.  Each input is a
+ * separate feed, so the message size and the warmup/sequence/quit state
+ * are kept per route. */
+typedef struct route_s {
+  struct sockaddr_in in_sin;
+  int num_outs;
+  struct sockaddr_in outs[MAX_ROUTE_OUTPUTS];
+  uint64_t num_in;  /* receive thread */
+  uint64_t num_fwd;  /* receive thread: selected for forwarding */
+  uint64_t num_out;  /* sending thread: datagrams sent, all outputs */
+  /* Receive thread: the feed's measurement. */
+  int state;
+  int msg_len;
+  int num_msgs;
+  int num_warmups;
+  int num_quits;
+  int num_ooo;
+  uint64_t prev_sqn;
+  uint64_t start_ns;
+  uint64_t stop_ns;
+} route_t;
+
+route_t routes[MAX_ROUTES];
+int num_routes;
+route_t **route_hash;  /* open addressing on (address, port) */
+unsigned int route_hash_mask;
+uint64_t num_no_route;
+
+/* One receive socket per input port.  If only one route uses the port,
+ * the socket is bound to its address and needs no lookup; otherwise it
+ * is bound to INADDR_ANY and IP_PKTINFO gives the destination group. */
+typedef struct in_sock_s {
+  int fd;
+  unsigned short port;  /* network order */
+  route_t *route;  /* NULL if shared */
+} in_sock_t;
+
+in_sock_t in_socks[MAX_ROUTES];
+int num_in_socks;
+
+/* Pipeline (-p): the receive thread hands filled buffers to the send thread
+ * through pipe_fwd and gets them back through pipe_free, so payloads are
+ * never copied.  Both are single-producer/single-consumer rings of buffer
+ * pointers with free-running head and tail counters. */
+typedef struct fwd_buf_s {
+  char data[BUF_SIZE];
+  int len;
+  uint64_t rcv_ns;  /* ingress time */
+  route_t *route;
+} fwd_buf_t;
+
+typedef struct spsc_ring_s {
+  fwd_buf_t **slots;
+  unsigned long long mask;
+  unsigned long long head;  /* written by producer */
+  char pad1[64];  /* keep head and tail on separate cache lines */
+  unsigned long long tail;  /* written by consumer */
+  char pad2[64];
+  unsigned long long high_water;  /* maintained by producer */
+} spsc_ring_t;
+
+spsc_ring_t pipe_fwd;  /* receive thread -> send thread */
+spsc_ring_t pipe_free;  /* send thread -> receive thread */
+fwd_buf_t **pipe_held;  /* buffers the receive thread has posted to recvmmsg */
+pthread_t snd_thread_id;
+int pipe_quit;
+uint64_t num_pool_waits;  /* receive thread found the pool empty */
+uint64_t num_rcvd;  /* receive stage, every datagram */
+uint64_t rcv_first_ns, rcv_last_ns;
+uint64_t num_snt;  /* send stage */
+uint64_t num_sendmmsg;
+uint64_t snd_first_ns, snd_last_ns;
 
 
 #define CHKERR(chkerr_s_) do { \
@@ -63,15 +167,8 @@ struct sockaddr_in snd_group_sin;
   } \
 } while (0)
 
-#define DIFF_TS(diff_ts_result_ns_, diff_ts_end_ns_, diff_ts_start_ns_) do { \
-  (diff_ts_result_ns_) = (((uint64_t)diff_ts_end_ns_.tv_sec \
-                           - (uint64_t)diff_ts_start_ns_.tv_sec) * 1000000000ull \
-                          + (uint64_t)diff_ts_end_ns_.tv_nsec) \
-                         - (uint64_t)diff_ts_start_ns_.tv_nsec; \
-} while (0)  /* DIFF_TS */
-
 
-char usage_str[] = "[-h] [-l linger_ms] [-m multi_rcv] [-n num_msgs_expected] [-r rcvbuf_size] [-v v_bitmask] [-w wait_ms] group port interface";
+char usage_str[] = "[-a snd_cpu] [-b] [-f select] [-h] [-I impair_spec] [-k] [-l linger_ms] [-m multi_rcv] [-n num_msgs_expected] [-p pipe_size] [-r rcvbuf_size] [-R route_file] [-S] [-T timer] [-v v_bitmask] [-w wait_ms] [group port] interface";
 void usage(char *msg)
 {
   fprintf(stderr, "\n%s\n\n", msg);
@@ -85,17 +182,38 @@ void help()
 {
   fprintf(stderr, "Usage: mdump %s\n", usage_str);
   fprintf(stderr, "Where:\n"
+          "  -a snd_cpu : with -p, pin the send thread to this CPU [not pinned]\n"
+          "  -b : batch forwarding: one sendmmsg() per recvmmsg() batch, sending\n"
+          "       straight from the receive buffers (needs -m)\n"
+          "  -f select : datagrams to forward: alt (every other), all, nth:N,\n"
+          "              type:T (data, warmup, end or number), seq:LO-HI [alt]\n"
           "  -h : help\n"
+          "  -I impair_spec : impair forwarded datagrams; comma-separated list of\n"
+          "                  loss=PCT, ge=P:R[:BAD[:GOOD]] (Gilbert-Elliott burst loss,\n"
+          "                  percentages), dup=PCT, reorder=PCT[:DEPTH] (held 1..DEPTH\n"
+          "                  datagrams, max 63) [3], delay=US, jitter=US (+/-, at most\n"
+          "                  delay), seed=N [1], pool=N (buffers) [65536]\n"
+          "  -k : ingress time from kernel receive timestamps (SO_TIMESTAMPNS)\n"
+          "       instead of the receive clock\n"
           "  -l linger_ms : time to delay before exiting\n"
           "  -m multi_rcv : use recvmmsg()\n"
-          "  -n num_msgs_expected : messages sent by msnd\n"
+          "  -n num_msgs_expected : messages sent by msnd (on each route)\n"
+          "  -p pipe_size : forward from a separate send thread (sendmmsg), through\n"
+          "                 rings of pipe_size buffers (power of 2; needs -m) [0]\n"
           "  -r rcvbuf_size : size (bytes) of UDP receive buffer (SO_RCVBUF)\n"
           "                   (use 0 for system default buff size)\n"
+          "  -R route_file : routing table, one route per line:\n"
+          "                  in_addr:port out_addr:port [out_addr:port ...]\n"
+          "                  (addresses multicast or unicast; '#' starts a comment)\n"
+          "  -S : append the time spent in the forwarder before the send call\n"
+          "       (8 bytes, ns, network order) to each forwarded payload\n"
+          "  -T timer : clock for rates: mono, raw, tsc, tscp [mono]\n"
           "  -v v_bitmask : verbosity (1=per msg, 2=sqn issues)\n"
           "  -w wait_ms : timeout for epoll_wait\n"
           "\n"
-          "  group : multicast address to receive (required)\n"
-          "  port : destination port (required)\n"
+          "  group : multicast address to receive, forwarded to the next group\n"
+          "          (required without -R)\n"
+          "  port : destination port (required without -R)\n"
           "  interface : IP addr of local interface (for multi-homed hosts) [INADDR_ANY]\n"
   );
 }  /* help */
@@ -106,26 +224,98 @@ void handle_signal(int signal) {
 }  /* handle_signal */
 
 
+/* Parse the -f selection spec.  Returns 0 on success, -1 if malformed. */
+int select_parse(char *spec)
+{
+  char *arg = strchr(spec, ':');
+  char *end;
+  int t;
+
+  if (strcmp(spec, "alt") == 0) {
+    select_mode = SELECT_ALT;
+    return 0;
+  }
+  if (strcmp(spec, "all") == 0) {
+    select_mode = SELECT_ALL;
+    return 0;
+  }
+  if (arg == NULL) {
+    return -1;
+  }
+  arg++;
+  if (strncmp(spec, "nth:", 4) == 0) {
+    select_mode = SELECT_NTH;
+    select_n = strtoull(arg, &end, 10);
+    return (select_n > 0 && *end == '\0') ? 0 : -1;
+  }
+  if (strncmp(spec, "type:", 5) == 0) {
+    select_mode = SELECT_TYPE;
+    for (t = 0; t < 256; t++) {
+      if (strcmp(arg, mwire_type_name(t)) == 0) {
+        select_n = t;
+        return 0;
+      }
+    }
+    select_n = strtoull(arg, &end, 10);
+    return (*arg != '\0' && *end == '\0' && select_n < 256) ? 0 : -1;
+  }
+  if (strncmp(spec, "seq:", 4) == 0) {
+    select_mode = SELECT_SEQ;
+    select_lo = strtoull(arg, &end, 10);
+    if (*end != '-') {
+      return -1;
+    }
+    select_hi = strtoull(end + 1, &end, 10);
+    return (*end == '\0' && select_lo <= select_hi) ? 0 : -1;
+  }
+  return -1;
+}  /* select_parse */
+
+
 void get_parms(int argc, char **argv)
 {
   int opt;
   int num_parms;
 
   /* default values for options */
+  o_snd_cpu = -1;
+  o_batch_fwd = 0;
+  o_select = "alt";
+  o_kernel_ts = 0;
   o_linger_ms = 100;
   o_multi_rcv = 0;
   o_num_msgs_expected = 0;
+  o_pipe_size = 0;
   o_rcvbuf_size = 0x800000;  /* 8MB */
+  o_route_file = NULL;
+  o_impair = NULL;
+  o_stamp = 0;
+  o_timer = NULL;
   o_v_bitmask = 0;
 
   /* default values for optional positional params */
   bind_if = NULL;
 
-  while ((opt = getopt(argc, argv, "hl:m:n:r:v:w:")) != EOF) {
+  while ((opt = getopt(argc, argv, "a:bf:hI:kl:m:n:p:r:R:ST:v:w:")) != EOF) {
     switch (opt) {
+    case 'a':
+      o_snd_cpu = atoi(optarg);
+      break;
+    case 'b':
+      o_batch_fwd = 1;
+      break;
+    case 'f':
+      o_select = optarg;
+      break;
     case 'h':
       help();  exit(0);
       break;
+    case 'I':
+      o_impair = optarg;
+      break;
+    case 'k':
+      o_kernel_ts = 1;
+      break;
     case 'l':
       o_linger_ms = atoi(optarg);
       break;
@@ -135,9 +325,21 @@ void get_parms(int argc, char **argv)
     case 'n':
       o_num_msgs_expected = atoi(optarg);
       break;
+    case 'p':
+      o_pipe_size = atoi(optarg);
+      break;
     case 'r':
       o_rcvbuf_size = atoi(optarg);
       break;
+    case 'R':
+      o_route_file = optarg;
+      break;
+    case 'S':
+      o_stamp = 1;
+      break;
+    case 'T':
+      o_timer = optarg;
+      break;
     case 'v':
       o_v_bitmask = atoi(optarg);
       break;
@@ -151,87 +353,1038 @@ void get_parms(int argc, char **argv)
     }  /* switch */
   }  /* while opt */
 
+  if (o_pipe_size < 0 || (o_pipe_size & (o_pipe_size - 1)) != 0) {
+    usage("pipe_size must be a power of 2");
+  }
+  if (o_pipe_size > 0 && (o_multi_rcv == 0 || o_pipe_size < 2 * o_multi_rcv)) {
+    usage("-p needs -m, and pipe_size must be at least twice multi_rcv");
+  }
+
+  if (o_batch_fwd && (o_multi_rcv == 0 || o_pipe_size > 0)) {
+    usage("-b needs -m, and cannot be combined with -p");
+  }
+  if (o_impair != NULL && o_pipe_size > 0) {
+    usage("-I cannot be combined with -p");
+  }
+  if (select_parse(o_select) != 0) {
+    usage("bad -f select");
+  }
+
   num_parms = argc - optind;
 
   /* handle positional parameters */
-  if (num_parms == 3) {
+  if (o_route_file != NULL && num_parms == 1) {
+    bind_if  = argv[optind];
+  } else if (o_route_file == NULL && num_parms == 3) {
     groupaddr = inet_addr(argv[optind]);
     groupport = (unsigned short)atoi(argv[optind+1]);
     bind_if  = argv[optind+2];
   } else {
-    usage("need 3 positional parameters");
+    usage("need 3 positional parameters (1 with -R)");
     exit(1);
   }
 }  /* get_parms */
 
 
-void process_datagram(uint32_t *buffer, int len)
+/* Update the route's statistics for a datagram.  Returns 1 if it should
+ * be forwarded. */
+int process_datagram(route_t *route, char *buffer, int len)
 {
-  if (o_v_bitmask & 1) {
-    printf("Process datagram, size=%d, type=%d sqn=%10u\n",
-           (int)len, buffer[0], buffer[1]);
+  mwire_hdr_t hdr;
+  int forward;
+
+  if (route->msg_len == 0) {
+    route->msg_len = len;
+  }
+  else if (len != route->msg_len) {
+    fprintf(stderr, "ERROR, cur_size=%d, msg_len=%d (route %d)\n", len, route->msg_len, (int)(route - routes));
+    exit(1);
+  }
+  if (mwire_decode(buffer, len, &hdr) != 0) {
+    printf("Unexpected message (no header), quitting\n");
+    quit = 1;
+    return 0;
   }
 
-  if (num_msgs & 1) {
-    CHKERR(sendto(snd_sockfd, buffer, len, 0, (struct sockaddr *)&snd_group_sin, sizeof(snd_group_sin)));
+  switch (select_mode) {
+  case SELECT_ALT:  forward = (route->num_msgs & 1);  break;
+  case SELECT_ALL:  forward = 1;  break;
+  case SELECT_NTH:  forward = (++select_cnt == select_n);  if (forward) { select_cnt = 0; }  break;
+  case SELECT_TYPE: forward = (hdr.type == select_n);  break;
+  case SELECT_SEQ:  forward = (hdr.seq >= select_lo && hdr.seq <= select_hi);  break;
+  default:          forward = 0;  break;
+  }
+
+  if (o_v_bitmask & 1) {
+    printf("Process datagram, size=%d, type=%d sqn=%10llu\n",
+           (int)len, hdr.type, (unsigned long long)hdr.seq);
   }
 
-  if (buffer[0] == 0) {
-    num_msgs = 0;
-    num_warmups++;
-    if (state == STATE_INIT) {
-      start_ts = last_pkt_ts;
+  if (hdr.type == MWIRE_TYPE_WARMUP) {
+    route->num_msgs = 0;
+    route->num_warmups++;
+    if (route->state == STATE_INIT) {
+      route->start_ns = last_pkt_ns;
     }
   }
-  else if (buffer[0] == 1) {
-    uint32_t sqn = buffer[1];
-    if (o_v_bitmask & 2) {
+  else if (hdr.type == MWIRE_TYPE_DATA) {
+    uint64_t sqn = hdr.seq;
+    if ((o_v_bitmask & 2) && route == &routes[0] && sqn < (uint64_t)o_num_msgs_expected) {
       sqn_cnt[sqn]++;
     }
-    if (sqn != prev_sqn + 1) {
-      num_ooo++;
+    if (sqn != route->prev_sqn + 1) {
+      route->num_ooo++;
     }
-    prev_sqn = sqn;
-    num_msgs++;
+    route->prev_sqn = sqn;
+    route->num_msgs++;
+    route->state = STATE_MEASURING;
     state = STATE_MEASURING;
   }
-  else if (buffer[0] == 2) {
-    if (state == STATE_MEASURING) {
-      stop_ts = last_pkt_ts;
-      state = STATE_QUITTING;
+  else if (hdr.type == MWIRE_TYPE_END) {
+    if (route->state == STATE_MEASURING) {
+      route->stop_ns = last_pkt_ns;
+      route->state = STATE_QUITTING;
     }
-    num_quits++;
+    route->num_quits++;
   }
   else {
-    printf("Unexpected message: 0x%02x, quitting\n", buffer[0]);
+    printf("Unexpected message type: %d, quitting\n", hdr.type);
     quit = 1;
   }
+
+  return forward;
 }  /* process_datagram */
 
 
-int main(int argc, char **argv)
+/* Parse "a.b.c.d:port".  Returns 0 on success, -1 if malformed. */
+int route_parse_addr(char *str, struct sockaddr_in *sin)
+{
+  char *colon = strrchr(str, ':');
+  char *end;
+  long port;
+
+  if (colon == NULL) {
+    return -1;
+  }
+  *colon = '\0';
+  memset((char *)sin, 0, sizeof(*sin));
+  sin->sin_family = AF_INET;
+  if (inet_pton(AF_INET, str, &sin->sin_addr) != 1) {
+    return -1;
+  }
+  port = strtol(colon + 1, &end, 10);
+  if (*end != '\0' || port <= 0 || port > 65535) {
+    return -1;
+  }
+  sin->sin_port = htons((unsigned short)port);
+  return 0;
+}  /* route_parse_addr */
+
+
+unsigned int route_hash_index(uint32_t addr, unsigned short port)
+{
+  uint32_t h = (addr ^ ((uint32_t)port << 16)) * 2654435761u;  /* Knuth multiplicative */
+  return (h >> 8) & route_hash_mask;
+}  /* route_hash_index */
+
+route_t *route_lookup(uint32_t addr, unsigned short port)
 {
-  uint32_t *buff;
+  unsigned int i = route_hash_index(addr, port);
+
+  while (route_hash[i] != NULL) {
+    if (route_hash[i]->in_sin.sin_addr.s_addr == addr && route_hash[i]->in_sin.sin_port == port) {
+      return route_hash[i];
+    }
+    i = (i + 1) & route_hash_mask;
+  }
+  return NULL;
+}  /* route_lookup */
+
+
+/* Read the -R file into routes[] (or make the single default route) and
+ * build the lookup table. */
+void route_load()
+{
+  char line[1024];
+  int line_num = 0;
+  unsigned int size;
+  FILE *fp;
   int i;
-  int opt;
+
+  num_routes = 0;
+  if (o_route_file == NULL) {
+    route_t *route = &routes[num_routes++];
+    memset((char *)route, 0, sizeof(*route));
+    route->in_sin.sin_family = AF_INET;
+    route->in_sin.sin_addr.s_addr = groupaddr;
+    route->in_sin.sin_port = htons(groupport);
+    route->outs[0] = route->in_sin;
+    route->outs[0].sin_addr.s_addr = htonl(ntohl(groupaddr) + 1);  /* next group */
+    route->num_outs = 1;
+  }
+  else {
+    fp = fopen(o_route_file, "r");
+    if (fp == NULL) {
+      fprintf(stderr, "Error, %s:%d, ", __FILE__, __LINE__);  perror(o_route_file);
+      exit(1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+      char *comment = strchr(line, '#');
+      char *tok;
+      route_t *route;
+
+      line_num++;
+      if (comment != NULL) {
+        *comment = '\0';
+      }
+      tok = strtok(line, " \t\r\n");
+      if (tok == NULL) {
+        continue;  /* blank */
+      }
+      if (num_routes == MAX_ROUTES) {
+        fprintf(stderr, "Error, %s line %d: more than %d routes\n", o_route_file, line_num, MAX_ROUTES);
+        exit(1);
+      }
+      route = &routes[num_routes++];
+      memset((char *)route, 0, sizeof(*route));
+      if (route_parse_addr(tok, &route->in_sin) != 0) {
+        fprintf(stderr, "Error, %s line %d: bad input address\n", o_route_file, line_num);
+        exit(1);
+      }
+      while ((tok = strtok(NULL, " \t\r\n")) != NULL) {
+        if (route->num_outs == MAX_ROUTE_OUTPUTS) {
+          fprintf(stderr, "Error, %s line %d: more than %d outputs\n", o_route_file, line_num, MAX_ROUTE_OUTPUTS);
+          exit(1);
+        }
+        if (route_parse_addr(tok, &route->outs[route->num_outs]) != 0) {
+          fprintf(stderr, "Error, %s line %d: bad output address\n", o_route_file, line_num);
+          exit(1);
+        }
+        route->num_outs++;
+      }
+      if (route->num_outs == 0) {
+        fprintf(stderr, "Error, %s line %d: no outputs\n", o_route_file, line_num);
+        exit(1);
+      }
+    }
+    fclose(fp);
+    if (num_routes == 0) {
+      fprintf(stderr, "Error, %s: no routes\n", o_route_file);
+      exit(1);
+    }
+  }
+
+  /* Keep the table at most half full. */
+  for (size = 4; size < 2 * (unsigned int)num_routes; size *= 2) {
+  }
+  route_hash = (route_t **)calloc(size, sizeof(*route_hash));
+  if (route_hash == NULL) { fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1); }
+  route_hash_mask = size - 1;
+  for (i = 0; i < num_routes; i++) {
+    unsigned int h;
+    if (route_lookup(routes[i].in_sin.sin_addr.s_addr, routes[i].in_sin.sin_port) != NULL) {
+      fprintf(stderr, "Error, route %d: duplicate input %s:%d\n", i,
+              inet_ntoa(routes[i].in_sin.sin_addr), ntohs(routes[i].in_sin.sin_port));
+      exit(1);
+    }
+    h = route_hash_index(routes[i].in_sin.sin_addr.s_addr, routes[i].in_sin.sin_port);
+    while (route_hash[h] != NULL) {
+      h = (h + 1) & route_hash_mask;
+    }
+    route_hash[h] = &routes[i];
+  }
+}  /* route_load */
+
+
+/* Open a receive socket per input port, join the input groups, and
+ * register the sockets with epoll (data.u32 is the in_socks index). */
+void in_socks_open(int epollfd)
+{
+  struct epoll_event ev;
+  struct sockaddr_in name;
+  struct ip_mreq imr;
   socklen_t opt_sz;
-  struct epoll_event ev, events[100];
+  int cur_size;
   int flags;
-  int rcv_sockfd;
+  int opt;
+  int i, s;
+
+  num_in_socks = 0;
+  for (i = 0; i < num_routes; i++) {
+    for (s = 0; s < num_in_socks; s++) {
+      if (in_socks[s].port == routes[i].in_sin.sin_port) {
+        break;
+      }
+    }
+    if (s == num_in_socks) {
+      in_socks[s].fd = -1;
+      in_socks[s].port = routes[i].in_sin.sin_port;
+      in_socks[s].route = &routes[i];
+      num_in_socks++;
+    } else {
+      in_socks[s].route = NULL;  /* shared port */
+    }
+  }
+
+  for (s = 0; s < num_in_socks; s++) {
+    in_sock_t *sock = &in_socks[s];
+
+    CHKERR(sock->fd = socket(PF_INET,SOCK_DGRAM,0));
+
+    /* Make non-blocking. */
+    CHKERR(flags = fcntl(sock->fd, F_GETFL, 0));
+    flags = (flags | O_NONBLOCK);
+    CHKERR(fcntl(sock->fd, F_SETFL, flags));
+
+    CHKERR(setsockopt(sock->fd,SOL_SOCKET,SO_RCVBUF,(const char *)&o_rcvbuf_size, sizeof(o_rcvbuf_size)));
+
+    opt_sz = (socklen_t)sizeof(cur_size);
+    CHKERR(getsockopt(sock->fd,SOL_SOCKET,SO_RCVBUF,(char *)&cur_size, (socklen_t *)&opt_sz));
+    if (cur_size < o_rcvbuf_size) {
+      printf("WARNING: tried to set SO_RCVBUF to %d, only got %d\n", o_rcvbuf_size, cur_size); fflush(stdout);
+    }
+
+    opt = 1;
+    CHKERR(setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)));
+
+    memset((char *)&name,0,sizeof(name));
+    name.sin_family = AF_INET;
+    name.sin_addr.s_addr = (sock->route != NULL) ? sock->route->in_sin.sin_addr.s_addr : htonl(INADDR_ANY);
+    name.sin_port = sock->port;
+    CHKERR(bind(sock->fd,(struct sockaddr *)&name,sizeof(name)));
+
+    if (o_kernel_ts) {
+      opt = 1;
+      CHKERR(setsockopt(sock->fd, SOL_SOCKET, SO_TIMESTAMPNS, (char *)&opt, sizeof(opt)));
+    }
+    if (sock->route == NULL) {
+      opt = 1;
+      CHKERR(setsockopt(sock->fd, IPPROTO_IP, IP_PKTINFO, (char *)&opt, sizeof(opt)));
+      /* Only the groups joined on this socket, not every group on the host. */
+      opt = 0;
+      CHKERR(setsockopt(sock->fd, IPPROTO_IP, IP_MULTICAST_ALL, (char *)&opt, sizeof(opt)));
+    }
+
+    /* Register with epoll. */
+    ev.events = EPOLLIN;
+    ev.data.u32 = s;
+    CHKERR(epoll_ctl(epollfd, EPOLL_CTL_ADD, sock->fd, &ev));
+  }
+
+  for (i = 0; i < num_routes; i++) {
+    if (IN_MULTICAST(ntohl(routes[i].in_sin.sin_addr.s_addr))) {
+      for (s = 0; in_socks[s].port != routes[i].in_sin.sin_port; s++) {
+      }
+      memset((char *)&imr,0,sizeof(imr));
+      imr.imr_multiaddr.s_addr = routes[i].in_sin.sin_addr.s_addr;
+      imr.imr_interface.s_addr = inet_addr(bind_if);
+      CHKERR(setsockopt(in_socks[s].fd,IPPROTO_IP,IP_ADD_MEMBERSHIP, (char *)&imr,sizeof(struct ip_mreq)));
+    }
+  }
+}  /* in_socks_open */
+
+
+/* Route for a datagram received on 'sock', or NULL if none matches. */
+route_t *route_of_msg(in_sock_t *sock, struct msghdr *hdr)
+{
+  struct cmsghdr *cmsg;
+
+  if (sock->route != NULL) {
+    return sock->route;
+  }
+  for (cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+    if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+      struct in_pktinfo pktinfo;
+      memcpy(&pktinfo, CMSG_DATA(cmsg), sizeof(pktinfo));
+      return route_lookup(pktinfo.ipi_addr.s_addr, sock->port);
+    }
+  }
+  return NULL;
+}  /* route_of_msg */
+
+
+/* Fill one sendmmsg() entry per output of 'route', all sending 'iov'.
+ * Returns the number of entries. */
+int route_fill_msgs(route_t *route, struct iovec *iov, struct mmsghdr *msgs)
+{
+  int j;
+
+  for (j = 0; j < route->num_outs; j++) {
+    msgs[j].msg_hdr.msg_name = &route->outs[j];
+    msgs[j].msg_hdr.msg_namelen = sizeof(route->outs[j]);
+    msgs[j].msg_hdr.msg_iov = iov;
+    msgs[j].msg_hdr.msg_iovlen = 1;
+    msgs[j].msg_hdr.msg_control = NULL;
+    msgs[j].msg_hdr.msg_controllen = 0;
+    msgs[j].msg_hdr.msg_flags = 0;
+  }
+  route->num_out += route->num_outs;
+  return route->num_outs;
+}  /* route_fill_msgs */
+
+/* Forward one datagram with a sendto() per output. */
+void route_sendto(route_t *route, char *buf, int len)
+{
+  int j;
+
+  for (j = 0; j < route->num_outs; j++) {
+    CHKERR(sendto(snd_sockfd, buf, len, 0, (struct sockaddr *)&route->outs[j], sizeof(route->outs[j])));
+  }
+  route->num_out += route->num_outs;
+  num_snd_syscalls += route->num_outs;
+}  /* route_sendto */
+
+
+/* Clock for residence times.  Kernel receive timestamps (-k) are
+ * CLOCK_REALTIME, so egress must be too; otherwise use the -T clock. */
+uint64_t fwd_now_ns(void)
+{
+  if (o_kernel_ts) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+  }
+  return mtime_ns();
+}  /* fwd_now_ns */
+
+/* Ingress time of a received message: its SO_TIMESTAMPNS control
+ * message, or 'rcv_ns' (taken when the receive call returned). */
+uint64_t fwd_ingress_ns(struct msghdr *hdr, uint64_t rcv_ns)
+{
+  struct cmsghdr *cmsg;
+
+  if (o_kernel_ts) {
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+        struct timespec ts;
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+      }
+    }
+    num_no_kernel_ts++;
+  }
+  return rcv_ns;
+}  /* fwd_ingress_ns */
+
+uint64_t fwd_elapsed_ns(uint64_t from_ns, uint64_t to_ns)
+{
+  return (to_ns > from_ns) ? to_ns - from_ns : 0;
+}  /* fwd_elapsed_ns */
+
+/* -S: append the residence time so far.  'buf' has room for STAMP_LEN
+ * bytes past any received datagram.  Returns the new length. */
+int fwd_stamp(char *buf, int len, uint64_t ingress_ns, uint64_t now_ns)
+{
+  uint64_t u64 = mwire_hton64(fwd_elapsed_ns(ingress_ns, now_ns));
+
+  memcpy(&buf[len], &u64, STAMP_LEN);
+  return len + STAMP_LEN;
+}  /* fwd_stamp */
+
+
+void spsc_init(spsc_ring_t *ring, int size)
+{
+  memset((char *)ring, 0, sizeof(*ring));
+  ring->slots = (fwd_buf_t **)malloc(size * sizeof(*ring->slots));
+  if (ring->slots == NULL) { fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1); }
+  ring->mask = size - 1;
+}  /* spsc_init */
+
+/* Producer side.  Never fails here: each ring has a slot for every buffer. */
+void spsc_put(spsc_ring_t *ring, fwd_buf_t *buf)
+{
+  unsigned long long occupancy = ring->head + 1 - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+  if (occupancy > ring->high_water) {
+    ring->high_water = occupancy;
+  }
+  ring->slots[ring->head & ring->mask] = buf;
+  __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}  /* spsc_put */
+
+/* Consumer side.  Takes up to 'max_bufs' buffers; returns how many. */
+int spsc_get(spsc_ring_t *ring, fwd_buf_t **bufs, int max_bufs)
+{
+  unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  int n = 0;
+
+  while (n < max_bufs && ring->tail + n != head) {
+    bufs[n] = ring->slots[(ring->tail + n) & ring->mask];
+    n++;
+  }
+  if (n > 0) {
+    __atomic_store_n(&ring->tail, ring->tail + n, __ATOMIC_RELEASE);
+  }
+  return n;
+}  /* spsc_get */
+
+
+/* Send thread: drain pipe_fwd with sendmmsg() and return the buffers. */
+struct mmsghdr snd_thread_msgs[MAX_SND_BATCH * MAX_ROUTE_OUTPUTS];
+void *snd_thread(void *arg)
+{
+  fwd_buf_t *bufs[MAX_SND_BATCH];
+  struct mmsghdr *msgs = snd_thread_msgs;
+  struct iovec iovecs[MAX_SND_BATCH];
+  uint64_t now_ns = 0;
+  int i;
+
+  if (o_snd_cpu >= 0) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(o_snd_cpu, &cpuset);
+    errno = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (errno != 0) {
+      CHKERR(-1);
+    }
+  }
+
+  while (1) {
+    int n_bufs, n_msgs, n_sent;
+    int quitting = __atomic_load_n(&pipe_quit, __ATOMIC_ACQUIRE);
+
+    n_bufs = spsc_get(&pipe_fwd, bufs, MAX_SND_BATCH);
+    if (n_bufs == 0) {
+      if (quitting) {
+        break;  /* receive thread is done and the ring is drained */
+      }
+      continue;  /* busy-wait */
+    }
+
+    if (o_stamp) {
+      now_ns = fwd_now_ns();
+    }
+    n_msgs = 0;
+    for (i = 0; i < n_bufs; i++) {
+      iovecs[i].iov_base = bufs[i]->data;  /* point at the receive buffer */
+      iovecs[i].iov_len = bufs[i]->len;
+      if (o_stamp) {
+        iovecs[i].iov_len = fwd_stamp(bufs[i]->data, bufs[i]->len, bufs[i]->rcv_ns, now_ns);
+      }
+      n_msgs += route_fill_msgs(bufs[i]->route, &iovecs[i], &msgs[n_msgs]);
+    }
+    n_sent = 0;
+    while (n_sent < n_msgs) {
+      int rtn;
+      CHKERR(rtn = sendmmsg(snd_sockfd, &msgs[n_sent], n_msgs - n_sent, 0));
+      num_sendmmsg++;
+      n_sent += rtn;
+    }
+    now_ns = fwd_now_ns();
+    for (i = 0; i < n_bufs; i++) {
+      mhist_record(&residence_hist, fwd_elapsed_ns(bufs[i]->rcv_ns, now_ns));
+    }
+    snd_last_ns = mtime_ns();
+    if (num_snt == 0) {
+      snd_first_ns = snd_last_ns;
+    }
+    num_snt += n_bufs;
+
+    for (i = 0; i < n_bufs; i++) {
+      spsc_put(&pipe_free, bufs[i]);
+    }
+  }
+
+  return NULL;
+}  /* snd_thread */
+
+
+void pipe_init()
+{
+  fwd_buf_t *pool;
+  int i;
+
+  spsc_init(&pipe_fwd, o_pipe_size);
+  spsc_init(&pipe_free, o_pipe_size);
+  pool = (fwd_buf_t *)malloc(o_pipe_size * sizeof(*pool));
+  pipe_held = (fwd_buf_t **)calloc(o_multi_rcv, sizeof(*pipe_held));
+  if (pool == NULL || pipe_held == NULL) { fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1); }
+  for (i = 0; i < o_pipe_size; i++) {
+    spsc_put(&pipe_free, &pool[i]);
+  }
+  pipe_free.high_water = 0;
+  pipe_quit = 0;
+
+  errno = pthread_create(&snd_thread_id, NULL, snd_thread, NULL);
+  if (errno != 0) {
+    CHKERR(-1);
+  }
+}  /* pipe_init */
+
+
+/* Point every recvmmsg() iovec at a pool buffer, replacing those handed to
+ * the send thread.  Waits if the pool is empty. */
+void pipe_fill(struct iovec *iovecs)
+{
+  int i;
+
+  for (i = 0; i < o_multi_rcv; i++) {
+    if (pipe_held[i] == NULL) {
+      if (spsc_get(&pipe_free, &pipe_held[i], 1) == 0) {
+        num_pool_waits++;
+        while (spsc_get(&pipe_free, &pipe_held[i], 1) == 0 && !quit) {
+        }
+        if (quit) {
+          return;
+        }
+      }
+      iovecs[i].iov_base = pipe_held[i]->data;
+    }
+  }
+}  /* pipe_fill */
+
+
+/* Batch forwarding (-b): send 'n_fwd' datagrams whose iovecs point into
+ * the recvmmsg() buffers, as 'n_msgs' sendmmsg() entries (one per route
+ * output).  'ingress_ns' holds their ingress times. */
+void fwd_batch_send(struct mmsghdr *snd_msgs, int n_msgs, struct iovec *snd_iovecs,
+                    uint64_t *ingress_ns, int n_fwd)
+{
+  uint64_t now_ns;
+  int n_sent = 0;
+  int i;
+
+  if (o_stamp) {
+    now_ns = fwd_now_ns();
+    for (i = 0; i < n_fwd; i++) {
+      snd_iovecs[i].iov_len = fwd_stamp((char *)snd_iovecs[i].iov_base, snd_iovecs[i].iov_len, ingress_ns[i], now_ns);
+    }
+  }
+  while (n_sent < n_msgs) {
+    int rtn;
+    CHKERR(rtn = sendmmsg(snd_sockfd, &snd_msgs[n_sent], n_msgs - n_sent, 0));
+    num_snd_syscalls++;
+    n_sent += rtn;
+  }
+  now_ns = fwd_now_ns();
+  for (i = 0; i < n_fwd; i++) {
+    mhist_record(&residence_hist, fwd_elapsed_ns(ingress_ns[i], now_ns));
+  }
+  num_forwarded += n_fwd;
+}  /* fwd_batch_send */
+
+
+/* Impairment stage (-I): loss, duplication, bounded reordering and
+ * delay/jitter, in that order.  Every decision comes from a seeded PRNG
+ * in packet order, all drawn when the datagram arrives (even if the pool
+ * is then full), so a run is repeatable; only the release times depend
+ * on the clock.  Impaired datagrams are copied into a pool, since they
+ * outlive the receive buffers.  Delayed ones wait in a timing wheel of
+ * IMP_TICK_NS slots, long enough for delay + jitter. */
+#define IMP_TICK_NS 10000  /* 10 us */
+#define IMP_MAX_REORDER 63
+#define IMP_BATCH 64  /* datagrams per sendmmsg() */
+#define IMP_IDLE_NS 1000000  /* release reorder-held datagrams after 1 ms idle */
+
+typedef struct imp_pkt_s {
+  struct imp_pkt_s *next;
+  route_t *route;
+  uint64_t rcv_ns;
+  uint64_t delay_ns;  /* delay + jitter, drawn on arrival */
+  int len;
+  char data[BUF_SIZE];
+} imp_pkt_t;
+
+typedef struct imp_list_s {
+  imp_pkt_t *head;
+  imp_pkt_t *tail;
+} imp_list_t;
+
+/* Settings. */
+uint64_t imp_seed;
+uint64_t imp_loss_thresh;  /* probabilities scaled to 2^64 */
+int imp_ge;  /* Gilbert-Elliott burst loss */
+uint64_t imp_ge_p_thresh, imp_ge_r_thresh, imp_ge_bad_thresh, imp_ge_good_thresh;
+uint64_t imp_dup_thresh;
+uint64_t imp_reorder_thresh;
+int imp_reorder_depth;
+uint64_t imp_delay_ns;
+uint64_t imp_jitter_ns;
+int imp_pool_size;
+
+/* State. */
+uint64_t imp_rand_state;
+int imp_ge_bad;
+imp_pkt_t *imp_free;
+uint64_t imp_pkt_cnt;  /* arrivals at the reorder stage */
+imp_list_t imp_reorder[IMP_MAX_REORDER + 1];  /* by release packet count */
+int imp_num_reorder_held;
+imp_list_t *imp_wheel;
+unsigned int imp_wheel_mask;
+uint64_t imp_wheel_tick;  /* slots before this have been released */
+int imp_num_delayed_held;
+imp_list_t imp_ready;
+
+/* Statistics. */
+uint64_t imp_num_in, imp_num_lost_random, imp_num_lost_burst, imp_num_dups,
+         imp_num_reordered, imp_num_delayed, imp_num_pool_drops, imp_num_out;
+
+struct mmsghdr imp_msgs[IMP_BATCH * MAX_ROUTE_OUTPUTS];
+struct iovec imp_iovecs[IMP_BATCH];
+imp_pkt_t *imp_batch[IMP_BATCH];
+
+
+/* xorshift64* */
+uint64_t imp_rand()
+{
+  imp_rand_state ^= imp_rand_state >> 12;
+  imp_rand_state ^= imp_rand_state << 25;
+  imp_rand_state ^= imp_rand_state >> 27;
+  return imp_rand_state * 2685821657736338717ull;
+}  /* imp_rand */
+
+/* Percentage (0-100) as a threshold for imp_rand(). */
+uint64_t imp_pct_thresh(double pct)
+{
+  if (pct >= 100.0) {
+    return UINT64_MAX;
+  }
+  return (uint64_t)(pct / 100.0 * 18446744073709551616.0);
+}  /* imp_pct_thresh */
+
+int imp_chance(uint64_t thresh)
+{
+  return (thresh > 0 && imp_rand() < thresh);
+}  /* imp_chance */
+
+
+/* Parse the -I spec, a comma-separated list of:
+ *   loss=PCT  ge=P:R[:BAD[:GOOD]]  dup=PCT  reorder=PCT[:DEPTH]
+ *   delay=US  jitter=US  seed=N  pool=N
+ * Returns 0 on success, -1 if malformed. */
+int imp_parse(char *spec)
+{
+  char *copy = strdup(spec);
+  char *item;
+
+  imp_seed = 1;
+  imp_reorder_depth = 3;
+  imp_pool_size = 65536;
+  for (item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+    char *val = strchr(item, '=');
+    double a, b, c = 100.0, d = 0.0;
+    if (val == NULL) {
+      break;
+    }
+    *val++ = '\0';
+    if (strcmp(item, "loss") == 0 && sscanf(val, "%lf", &a) == 1 && a >= 0) {
+      imp_loss_thresh = imp_pct_thresh(a);
+    }
+    else if (strcmp(item, "ge") == 0 && sscanf(val, "%lf:%lf:%lf:%lf", &a, &b, &c, &d) >= 2
+             && a >= 0 && b >= 0 && c >= 0 && d >= 0) {
+      imp_ge = 1;
+      imp_ge_p_thresh = imp_pct_thresh(a);
+      imp_ge_r_thresh = imp_pct_thresh(b);
+      imp_ge_bad_thresh = imp_pct_thresh(c);
+      imp_ge_good_thresh = imp_pct_thresh(d);
+    }
+    else if (strcmp(item, "dup") == 0 && sscanf(val, "%lf", &a) == 1 && a >= 0) {
+      imp_dup_thresh = imp_pct_thresh(a);
+    }
+    else if (strcmp(item, "reorder") == 0 && sscanf(val, "%lf:%d", &a, &imp_reorder_depth) >= 1 && a >= 0) {
+      imp_reorder_thresh = imp_pct_thresh(a);
+      if (imp_reorder_depth < 1 || imp_reorder_depth > IMP_MAX_REORDER) {
+        break;
+      }
+    }
+    else if (strcmp(item, "delay") == 0 && sscanf(val, "%lf", &a) == 1 && a >= 0) {
+      imp_delay_ns = (uint64_t)(a * 1000.0);
+    }
+    else if (strcmp(item, "jitter") == 0 && sscanf(val, "%lf", &a) == 1 && a >= 0) {
+      imp_jitter_ns = (uint64_t)(a * 1000.0);
+    }
+    else if (strcmp(item, "seed") == 0 && sscanf(val, "%llu", (unsigned long long *)&imp_seed) == 1) {
+    }
+    else if (strcmp(item, "pool") == 0 && sscanf(val, "%d", &imp_pool_size) == 1 && imp_pool_size > 0) {
+    }
+    else {
+      break;
+    }
+  }
+  free(copy);
+  if (item != NULL) {
+    return -1;  /* stopped at a bad item */
+  }
+  if (imp_jitter_ns > imp_delay_ns) {
+    return -1;  /* jitter is +/- around the delay */
+  }
+  return 0;
+}  /* imp_parse */
+
+
+void imp_init()
+{
+  imp_pkt_t *pool;
+  uint64_t max_ticks = (imp_delay_ns + imp_jitter_ns) / IMP_TICK_NS + 2;
+  unsigned int slots;
+  int i;
+
+  imp_rand_state = imp_seed * 0x9e3779b97f4a7c15ull + 1;  /* never 0 */
+
+  pool = (imp_pkt_t *)malloc(imp_pool_size * sizeof(*pool));
+  for (slots = 2; slots < max_ticks; slots *= 2) {
+  }
+  imp_wheel = (imp_list_t *)calloc(slots, sizeof(*imp_wheel));
+  if (pool == NULL || imp_wheel == NULL) { fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1); }
+  imp_wheel_mask = slots - 1;
+  imp_wheel_tick = mtime_ns() / IMP_TICK_NS;
+
+  imp_free = NULL;
+  for (i = imp_pool_size - 1; i >= 0; i--) {
+    pool[i].next = imp_free;
+    imp_free = &pool[i];
+  }
+}  /* imp_init */
+
+
+void imp_list_append(imp_list_t *list, imp_pkt_t *pkt)
+{
+  pkt->next = NULL;
+  if (list->head == NULL) {
+    list->head = pkt;
+  } else {
+    list->tail->next = pkt;
+  }
+  list->tail = pkt;
+}  /* imp_list_append */
+
+/* Move all of 'src' to the end of 'dst'. */
+void imp_list_splice(imp_list_t *dst, imp_list_t *src)
+{
+  if (src->head == NULL) {
+    return;
+  }
+  if (dst->head == NULL) {
+    dst->head = src->head;
+  } else {
+    dst->tail->next = src->head;
+  }
+  dst->tail = src->tail;
+  src->head = NULL;
+  src->tail = NULL;
+}  /* imp_list_splice */
+
+
+/* Move timing wheel slots that are due to the ready list. */
+void imp_advance(uint64_t now_ns)
+{
+  uint64_t now_tick = now_ns / IMP_TICK_NS;
+
+  while (imp_wheel_tick <= now_tick) {
+    imp_list_t *slot = &imp_wheel[imp_wheel_tick & imp_wheel_mask];
+    imp_pkt_t *pkt;
+    for (pkt = slot->head; pkt != NULL; pkt = pkt->next) {
+      imp_num_delayed_held--;
+    }
+    imp_list_splice(&imp_ready, slot);
+    imp_wheel_tick++;
+    if (imp_num_delayed_held == 0) {
+      imp_wheel_tick = now_tick + 1;  /* nothing left to release */
+    }
+  }
+}  /* imp_advance */
+
+/* Delay stage: schedule 'pkt' on the timing wheel, or make it ready. */
+void imp_delay(imp_pkt_t *pkt, uint64_t now_ns)
+{
+  uint64_t delay_ns = pkt->delay_ns;
+  uint64_t tick;
+
+  if (imp_num_delayed_held == 0) {
+    imp_wheel_tick = now_ns / IMP_TICK_NS;  /* may be stale after idle */
+  }
+  tick = (now_ns + delay_ns) / IMP_TICK_NS;
+  if (tick > imp_wheel_tick + imp_wheel_mask) {
+    imp_advance(now_ns);  /* the wheel lags; catch up so 'tick' does not wrap */
+  }
+  if (delay_ns == 0 || tick < imp_wheel_tick) {
+    imp_list_append(&imp_ready, pkt);
+  } else {
+    imp_list_append(&imp_wheel[tick & imp_wheel_mask], pkt);
+    imp_num_delayed_held++;
+    imp_num_delayed++;
+  }
+}  /* imp_delay */
+
+/* Reorder stage: hold 'pkt' for 'hold' (1 to imp_reorder_depth) later
+ * packets, or pass it on if 0, followed by any held packets due now. */
+void imp_reorder_stage(imp_pkt_t *pkt, uint64_t hold, uint64_t now_ns)
+{
+  imp_list_t *due;
+
+  imp_pkt_cnt++;
+  if (hold > 0) {
+    imp_list_append(&imp_reorder[(imp_pkt_cnt + hold) & IMP_MAX_REORDER], pkt);
+    imp_num_reorder_held++;
+    imp_num_reordered++;
+  } else {
+    imp_delay(pkt, now_ns);
+  }
+  due = &imp_reorder[imp_pkt_cnt & IMP_MAX_REORDER];
+  while (due->head != NULL) {
+    imp_pkt_t *held = due->head;
+    due->head = held->next;
+    imp_num_reorder_held--;
+    imp_delay(held, now_ns);
+  }
+}  /* imp_reorder_stage */
+
+/* Release everything held for reordering (input went idle). */
+void imp_reorder_flush(uint64_t now_ns)
+{
+  int i;
+
+  for (i = 1; i <= IMP_MAX_REORDER && imp_num_reorder_held > 0; i++) {
+    imp_list_t *due = &imp_reorder[(imp_pkt_cnt + i) & IMP_MAX_REORDER];
+    while (due->head != NULL) {
+      imp_pkt_t *held = due->head;
+      due->head = held->next;
+      imp_num_reorder_held--;
+      imp_delay(held, now_ns);
+    }
+  }
+}  /* imp_reorder_flush */
+
+
+/* Input of the stage: a datagram selected for forwarding on 'route'. */
+void imp_input(route_t *route, char *buf, int len, uint64_t ingress_ns, uint64_t now_ns)
+{
+  int copies = 1;
+
+  imp_num_in++;
+  if (imp_chance(imp_loss_thresh)) {
+    imp_num_lost_random++;
+    return;
+  }
+  if (imp_ge) {
+    /* Move between the good and bad states, then lose with that state's rate. */
+    if (imp_ge_bad) {
+      imp_ge_bad = !imp_chance(imp_ge_r_thresh);
+    } else {
+      imp_ge_bad = imp_chance(imp_ge_p_thresh);
+    }
+    if (imp_chance(imp_ge_bad ? imp_ge_bad_thresh : imp_ge_good_thresh)) {
+      imp_num_lost_burst++;
+      return;
+    }
+  }
+  if (imp_chance(imp_dup_thresh)) {
+    copies = 2;
+    imp_num_dups++;
+  }
+  while (copies-- > 0) {
+    imp_pkt_t *pkt;
+    uint64_t hold = 0;
+    uint64_t delay_ns = imp_delay_ns;
+    if (imp_chance(imp_reorder_thresh)) {
+      hold = 1 + imp_rand() % imp_reorder_depth;
+    }
+    if (imp_jitter_ns > 0) {
+      delay_ns = delay_ns - imp_jitter_ns + imp_rand() % (2 * imp_jitter_ns + 1);
+    }
+    pkt = imp_free;
+    if (pkt == NULL) {
+      imp_num_pool_drops++;
+      continue;
+    }
+    imp_free = pkt->next;
+    memcpy(pkt->data, buf, len);
+    pkt->len = len;
+    pkt->route = route;
+    pkt->rcv_ns = ingress_ns;
+    pkt->delay_ns = delay_ns;
+    imp_reorder_stage(pkt, hold, now_ns);
+  }
+}  /* imp_input */
+
+
+/* Release everything on the timing wheel (at exit). */
+void imp_drain()
+{
+  unsigned int i;
+
+  imp_reorder_flush(mtime_ns());
+  for (i = 0; i <= imp_wheel_mask; i++) {
+    imp_list_splice(&imp_ready, &imp_wheel[(imp_wheel_tick + i) & imp_wheel_mask]);
+  }
+  imp_num_delayed_held = 0;
+}  /* imp_drain */
+
+
+/* Send the ready list, IMP_BATCH datagrams per sendmmsg(). */
+void imp_send_ready()
+{
+  uint64_t now_ns = 0;
+  int i;
+
+  while (imp_ready.head != NULL) {
+    int n_pkts = 0, n_msgs = 0, n_sent = 0;
+
+    if (o_stamp) {
+      now_ns = fwd_now_ns();
+    }
+    while (n_pkts < IMP_BATCH && imp_ready.head != NULL) {
+      imp_pkt_t *pkt = imp_ready.head;
+      imp_ready.head = pkt->next;
+      imp_iovecs[n_pkts].iov_base = pkt->data;
+      imp_iovecs[n_pkts].iov_len = pkt->len;
+      if (o_stamp) {
+        imp_iovecs[n_pkts].iov_len = fwd_stamp(pkt->data, pkt->len, pkt->rcv_ns, now_ns);
+      }
+      n_msgs += route_fill_msgs(pkt->route, &imp_iovecs[n_pkts], &imp_msgs[n_msgs]);
+      imp_batch[n_pkts++] = pkt;
+    }
+    while (n_sent < n_msgs) {
+      int rtn;
+      CHKERR(rtn = sendmmsg(snd_sockfd, &imp_msgs[n_sent], n_msgs - n_sent, 0));
+      num_snd_syscalls++;
+      n_sent += rtn;
+    }
+    now_ns = fwd_now_ns();
+    for (i = 0; i < n_pkts; i++) {
+      mhist_record(&residence_hist, fwd_elapsed_ns(imp_batch[i]->rcv_ns, now_ns));
+      imp_batch[i]->next = imp_free;
+      imp_free = imp_batch[i];
+    }
+    num_forwarded += n_pkts;
+    imp_num_out += n_pkts;
+  }
+  imp_ready.tail = NULL;
+}  /* imp_send_ready */
+
+
+double rate_per_sec(uint64_t count, uint64_t ns)
+{
+  return (ns > 0) ? (double)count * 1000000000.0 / (double)ns : 0.0;
+}  /* rate_per_sec */
+
+
+int main(int argc, char **argv)
+{
+  char *buff;
+  int i;
+  int opt;
+  struct epoll_event events[100];
   int epollfd;
-  socklen_t fromlen = sizeof(struct sockaddr_in);
   int cur_size;
-  struct sockaddr_in name;
-  struct sockaddr_in src;
-  struct ip_mreq imr;
+  int n_slots;
   struct sockaddr_in *client_addrs;
   struct mmsghdr *msgs;
   struct iovec *iovecs;
-  int msg_len = 0;
+  struct mmsghdr *snd_msgs;
+  struct iovec *snd_iovecs;
+  uint64_t *snd_ingress_ns;
+  char (*ctl_bufs)[CTL_BUF_SIZE];
+  uint64_t rcv_ns;
+  uint64_t imp_now_ns = 0;
+  char hist_desc[256];
   uint64_t linger_ns;
   uint64_t tot_bits;
   uint64_t tot_ns;
+  uint64_t start_ns = 0, stop_ns = 0;
+  int num_msgs = 0, num_warmups = 0, num_quits = 0, num_ooo = 0, num_lost = 0;
   double msgs_per_sec, bits_per_sec;
+  char timer_desc[80];
 
   quit = 0;
   state = STATE_INIT;
@@ -239,6 +1392,15 @@ int main(int argc, char **argv)
   signal(SIGTERM, handle_signal);
 
   get_parms(argc, argv);
+  if (o_impair != NULL && imp_parse(o_impair) != 0) {
+    usage("bad -I impair_spec");
+  }
+
+  if (mtime_init(o_timer) != 0) {
+    exit(1);
+  }
+
+  route_load();
 
   sqn_cnt = (uint8_t *)malloc(o_num_msgs_expected);
   if (sqn_cnt == NULL) { fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1); }
@@ -246,15 +1408,24 @@ int main(int argc, char **argv)
     sqn_cnt[i] = 0;
   }
 
-  client_addrs = (struct sockaddr_in *)malloc(o_multi_rcv * sizeof(*client_addrs));
-  msgs = (struct mmsghdr *)malloc(o_multi_rcv * sizeof(*msgs));
-  iovecs = (struct iovec *)malloc(o_multi_rcv * sizeof(*iovecs));
-  buff = (uint32_t *)malloc(o_multi_rcv * MAX_UDP_PAYLOAD);
-  if (buff == NULL) { fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1); }
+  /* Single receive (no -m) uses recvmsg() with the first slot. */
+  n_slots = (o_multi_rcv > 0) ? o_multi_rcv : 1;
+  client_addrs = (struct sockaddr_in *)malloc(n_slots * sizeof(*client_addrs));
+  msgs = (struct mmsghdr *)malloc(n_slots * sizeof(*msgs));
+  iovecs = (struct iovec *)malloc(n_slots * sizeof(*iovecs));
+  ctl_bufs = malloc(n_slots * sizeof(*ctl_bufs));
+  buff = (char *)malloc(n_slots * BUF_SIZE);
+  snd_msgs = (struct mmsghdr *)calloc(n_slots * MAX_ROUTE_OUTPUTS, sizeof(*snd_msgs));
+  snd_iovecs = (struct iovec *)calloc(n_slots, sizeof(*snd_iovecs));
+  snd_ingress_ns = (uint64_t *)calloc(n_slots, sizeof(*snd_ingress_ns));
+  if (client_addrs == NULL || msgs == NULL || iovecs == NULL || ctl_bufs == NULL || buff == NULL
+      || snd_msgs == NULL || snd_iovecs == NULL || snd_ingress_ns == NULL) {
+    fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1);
+  }
 
-  for (i = 0; i < o_multi_rcv; i++) {
+  for (i = 0; i < n_slots; i++) {
     memset(&client_addrs[i], 0, sizeof(client_addrs[i]));
-    iovecs[i].iov_base = &buff[i * (MAX_UDP_PAYLOAD/sizeof(uint32_t))];
+    iovecs[i].iov_base = &buff[i * BUF_SIZE];
     iovecs[i].iov_len = MAX_UDP_PAYLOAD;
 
     msgs[i].msg_len = 0;
@@ -269,44 +1440,11 @@ int main(int argc, char **argv)
 
   CHKERR(epollfd = epoll_create1(0));
 
-  /* Receive socket. */
+  /* Receive sockets. */
 
   CHKERR(onload_set_stackname(ONLOAD_THIS_THREAD, ONLOAD_SCOPE_THREAD, "rcv"));
 
-  CHKERR(rcv_sockfd = socket(PF_INET,SOCK_DGRAM,0));
-
-  /* Make non-blocking. */
-  CHKERR(flags = fcntl(rcv_sockfd, F_GETFL, 0));
-  flags = (flags | O_NONBLOCK);
-  CHKERR(fcntl(rcv_sockfd, F_SETFL, flags));
-
-  CHKERR(setsockopt(rcv_sockfd,SOL_SOCKET,SO_RCVBUF,(const char *)&o_rcvbuf_size, sizeof(o_rcvbuf_size)));
-
-  opt_sz = (socklen_t)sizeof(cur_size);
-  CHKERR(getsockopt(rcv_sockfd,SOL_SOCKET,SO_RCVBUF,(char *)&cur_size, (socklen_t *)&opt_sz));
-  if (cur_size < o_rcvbuf_size) {
-    printf("WARNING: tried to set SO_RCVBUF to %d, only got %d\n", o_rcvbuf_size, cur_size); fflush(stdout);
-  }
-
-  memset((char *)&imr,0,sizeof(imr));
-  imr.imr_multiaddr.s_addr = groupaddr;
-  imr.imr_interface.s_addr = inet_addr(bind_if);
-
-  opt = 1;
-  CHKERR(setsockopt(rcv_sockfd, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)));
-
-  memset((char *)&name,0,sizeof(name));
-  name.sin_family = AF_INET;
-  name.sin_addr.s_addr = groupaddr;
-  name.sin_port = htons(groupport);
-  CHKERR(bind(rcv_sockfd,(struct sockaddr *)&name,sizeof(name)));
-
-  CHKERR(setsockopt(rcv_sockfd,IPPROTO_IP,IP_ADD_MEMBERSHIP, (char *)&imr,sizeof(struct ip_mreq)));
-
-  /* Register rcv_sockfd with epoll. */
-  ev.events = EPOLLIN;
-  ev.data.fd = rcv_sockfd;
-  CHKERR(epoll_ctl(epollfd, EPOLL_CTL_ADD, rcv_sockfd, &ev));
+  in_socks_open(epollfd);
 
   /* Send socket. */
 
@@ -321,100 +1459,187 @@ int main(int argc, char **argv)
   iface_in.s_addr = inet_addr(bind_if);
   CHKERR(setsockopt(snd_sockfd, IPPROTO_IP, IP_MULTICAST_IF, (const char*)&iface_in, sizeof(iface_in)));
 
-  memset((char *)&snd_group_sin, 0, sizeof(snd_group_sin));
-  snd_group_sin.sin_family = AF_INET;
-  snd_group_sin.sin_addr.s_addr = groupaddr + 1;
-  snd_group_sin.sin_port = htons(groupport);
+  if (o_pipe_size > 0) {
+    pipe_init();
+  }
+  if (o_impair != NULL) {
+    imp_init();
+  }
 
   /* Main receive loop. */
 
-  num_warmups = 0;
-  num_quits = 0;
-  num_ooo = 0;
-  prev_sqn = (uint32_t)-1;
+  for (i = 0; i < num_routes; i++) {
+    routes[i].state = STATE_INIT;
+    routes[i].prev_sqn = (uint64_t)-1;
+  }
   max_dgrams_in_loop = 1;
+  mhist_init(&residence_hist);
   linger_ns = (uint64_t)o_linger_ms * 1000000;
 
   while (!quit) {
     int nfds, ev;
 
-    CHKERR(nfds = epoll_wait(epollfd, events, 100, o_wait_ms));  /* No wait. */
+    /* Poll while the impairment delay line holds datagrams. */
+    CHKERR(nfds = epoll_wait(epollfd, events, 100, (imp_num_delayed_held > 0) ? 0 : o_wait_ms));
 
     if (nfds == 0) {
+      if (imp_num_reorder_held > 0 && mtime_ns() - last_pkt_ns > IMP_IDLE_NS) {
+        imp_reorder_flush(mtime_ns());  /* input went idle */
+      }
       if (state != STATE_INIT) {
         /* Nothing received (timeout). If it's been a while, quit. */
-        struct timespec timeout_ts;
-        int64_t ns_since_last_pkt;
-        clock_gettime(CLOCK_MONOTONIC, &timeout_ts);
-        DIFF_TS(ns_since_last_pkt, timeout_ts, last_pkt_ts);
+        uint64_t ns_since_last_pkt = mtime_ns() - last_pkt_ns;
         if (ns_since_last_pkt > linger_ns) {
           quit = 1;
         }
       }
     } else {  /* nfds > 0 */
-      clock_gettime(CLOCK_MONOTONIC, &last_pkt_ts);
+      last_pkt_ns = mtime_ns();
     }
 
     for (ev = 0; ev < nfds; ++ev) {
+      in_sock_t *sock = &in_socks[events[ev].data.u32];
+
       if (events[ev].events & EPOLLIN) {
+        int n_dgrams;
+        int n_fwd = 0;
+        int n_msgs = 0;
+
+        if (o_kernel_ts || sock->route == NULL) {
+          for (i = 0; i < n_slots; i++) {
+            msgs[i].msg_hdr.msg_control = ctl_bufs[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(ctl_bufs[i]);
+          }
+        }
 
         if (o_multi_rcv == 0) {  /* Single receive. */
-          CHKERR(cur_size = recvfrom(events[ev].data.fd, buff, MAX_UDP_PAYLOAD, 0, (struct sockaddr *)&src, &fromlen));
-          if (msg_len == 0) {
-            msg_len = cur_size;
-          }
-          else if (cur_size != msg_len) {
-            fprintf(stderr, "ERROR, cur_size=%d, msg_len=%d\n", cur_size, msg_len);
-            exit(1);
-          }
-          process_datagram(buff, cur_size);
+          CHKERR(cur_size = recvmsg(sock->fd, &msgs[0].msg_hdr, 0));
+          msgs[0].msg_len = cur_size;
+          n_dgrams = 1;
         }  /* single read */
 
         else {  /* multi-receive */
-          int n_dgrams;
-          CHKERR(n_dgrams = recvmmsg(events[ev].data.fd, msgs, o_multi_rcv, 0, NULL));
-          if (n_dgrams == 0) { printf("recvmmsg(%d) returned 0\n", events[ev].data.fd); }
+          if (o_pipe_size > 0) {
+            pipe_fill(iovecs);
+            if (quit) {
+              break;
+            }
+          }
+          CHKERR(n_dgrams = recvmmsg(sock->fd, msgs, o_multi_rcv, 0, NULL));
+          if (n_dgrams == 0) { printf("recvmmsg(%d) returned 0\n", sock->fd); }
           if (n_dgrams > max_dgrams_in_loop) {
             max_dgrams_in_loop = n_dgrams;
           }
+        }  /* multi-read */
+        num_rcv_syscalls++;
+        rcv_ns = fwd_now_ns();
+        if (o_impair != NULL) {
+          imp_now_ns = o_kernel_ts ? mtime_ns() : rcv_ns;  /* the wheel runs on the -T clock */
+        }
+        if (n_dgrams > 0) {
+          rcv_last_ns = last_pkt_ns;
+          if (num_rcvd == 0) {
+            rcv_first_ns = last_pkt_ns;
+          }
+          num_rcvd += n_dgrams;
+        }
 
-          uint32_t *b = buff;
-          for (i = 0; i < n_dgrams; ++i) {
-            cur_size = msgs[i].msg_len;
-            if (msg_len == 0) {
-              msg_len = cur_size;
-            }
-            else if (cur_size != msg_len) {
-              fprintf(stderr, "ERROR, cur_size=%d, msg_len=%d\n", cur_size, msg_len);
-              exit(1);
+        for (i = 0; i < n_dgrams; ++i) {
+          char *b = (char *)iovecs[i].iov_base;
+          route_t *route = route_of_msg(sock, &msgs[i].msg_hdr);
+          if (route == NULL) {
+            num_no_route++;
+            continue;
+          }
+          route->num_in++;
+          cur_size = msgs[i].msg_len;
+          if (process_datagram(route, b, cur_size)) {
+            uint64_t ingress_ns = fwd_ingress_ns(&msgs[i].msg_hdr, rcv_ns);
+            route->num_fwd++;
+            if (o_impair != NULL) {
+              imp_input(route, b, cur_size, ingress_ns, imp_now_ns);
+            } else if (o_pipe_size > 0) {
+              /* Hand the buffer itself to the send thread. */
+              pipe_held[i]->len = cur_size;
+              pipe_held[i]->rcv_ns = ingress_ns;
+              pipe_held[i]->route = route;
+              spsc_put(&pipe_fwd, pipe_held[i]);
+              pipe_held[i] = NULL;
+            } else if (o_batch_fwd) {
+              snd_iovecs[n_fwd].iov_base = b;  /* no copy */
+              snd_iovecs[n_fwd].iov_len = cur_size;
+              snd_ingress_ns[n_fwd] = ingress_ns;
+              n_msgs += route_fill_msgs(route, &snd_iovecs[n_fwd], &snd_msgs[n_msgs]);
+              n_fwd++;
+            } else {
+              if (o_stamp) {
+                cur_size = fwd_stamp(b, cur_size, ingress_ns, fwd_now_ns());
+              }
+              route_sendto(route, b, cur_size);
+              mhist_record(&residence_hist, fwd_elapsed_ns(ingress_ns, fwd_now_ns()));
+              num_forwarded++;
             }
-            process_datagram(b, cur_size);
-
-            b += (MAX_UDP_PAYLOAD/sizeof(uint32_t));  /* Step to the next buffer. */
-          }  /* for i */
-        }  /* multi-read */
+          }
+        }  /* for i */
+        if (n_fwd > 0) {
+          fwd_batch_send(snd_msgs, n_msgs, snd_iovecs, snd_ingress_ns, n_fwd);
+        }
       }  /* if EPOLLIN */
       else {
-        printf("Warning, events[%d].events = 0x%x, .data.fd=%d\n",
-            ev, events[ev].events, events[ev].data.fd);
+        printf("Warning, events[%d].events = 0x%x, fd=%d\n",
+            ev, events[ev].events, sock->fd);
       }
     }
+
+    if (o_impair != NULL) {
+      imp_advance(mtime_ns());
+      imp_send_ready();
+    }
   }  /* while !quit */
 
-  if (state == STATE_MEASURING) {
-    stop_ts = last_pkt_ts;
+  if (o_impair != NULL) {
+    imp_drain();
+    imp_send_ready();
+  }
+  if (o_pipe_size > 0) {
+    __atomic_store_n(&pipe_quit, 1, __ATOMIC_RELEASE);
+    pthread_join(snd_thread_id, NULL);
+    num_forwarded = num_snt;
+    num_snd_syscalls = num_sendmmsg;
   }
 
-  DIFF_TS(tot_ns, stop_ts, start_ts);
+  /* Sum the feeds; the rate covers the earliest start to the latest stop.
+   * -n is the number of messages expected on each route. */
+  tot_bits = 0;
+  for (i = 0; i < num_routes; i++) {
+    route_t *route = &routes[i];
+    if (route->state == STATE_MEASURING) {
+      route->stop_ns = last_pkt_ns;
+    }
+    if (route->num_warmups > 0 || route->num_msgs > 0) {
+      if (start_ns == 0 || route->start_ns < start_ns) {
+        start_ns = route->start_ns;
+      }
+      if (route->stop_ns > stop_ns) {
+        stop_ns = route->stop_ns;
+      }
+    }
+    num_msgs += route->num_msgs;
+    num_warmups += route->num_warmups;
+    num_quits += route->num_quits;
+    num_ooo += route->num_ooo;
+    num_lost += o_num_msgs_expected - route->num_msgs;
+    tot_bits += (uint64_t)route->num_msgs * (uint64_t)8 * (
+        (uint64_t)route->msg_len  /* UDP payload */
+        + (uint64_t)8  /* UDP header */
+        + (uint64_t)20  /* IP header */
+        + (uint64_t)14  /* Ethernet header */
+        + (uint64_t)4   /* Ethernet FSC */
+        + (uint64_t)12  /* Interframe gap (96 bits) */
+    );
+  }
 
-  tot_bits = (uint64_t)num_msgs * (uint64_t)8 * (
-      (uint64_t)msg_len  /* UDP payload */
-      + (uint64_t)8  /* UDP header */
-      + (uint64_t)20  /* IP header */
-      + (uint64_t)14  /* Ethernet header */
-      + (uint64_t)4   /* Ethernet FSC */
-      + (uint64_t)12  /* Interframe gap (96 bits) */
-  );
+  tot_ns = stop_ns - start_ns;
 
   msgs_per_sec = (double)num_msgs;
   msgs_per_sec /= (double)tot_ns;
@@ -436,14 +1661,62 @@ int main(int argc, char **argv)
   }
 
   printf("\n");
-  printf("o_linger_ms=%d, o_multi_rcv=%d, o_num_msgs_expected=%d, o_rcvbuf_size=%d, o_v_bitmask=%d\n",
-          o_linger_ms, o_multi_rcv, o_num_msgs_expected, o_rcvbuf_size, o_v_bitmask);
+  printf("o_linger_ms=%d, o_multi_rcv=%d, o_num_msgs_expected=%d, o_pipe_size=%d, o_rcvbuf_size=%d, o_v_bitmask=%d\n",
+          o_linger_ms, o_multi_rcv, o_num_msgs_expected, o_pipe_size, o_rcvbuf_size, o_v_bitmask);
+  printf("Timer: %s\n", mtime_describe(timer_desc, sizeof(timer_desc)));
+  if (o_pipe_size > 0) {
+    printf("Receive stage: %llu dgrams at %.0f dgrams/sec, %llu pool-empty waits\n",
+           (unsigned long long)num_rcvd, rate_per_sec(num_rcvd, rcv_last_ns - rcv_first_ns),
+           (unsigned long long)num_pool_waits);
+    printf("Send stage: %llu dgrams at %.0f dgrams/sec, %llu sendmmsg (%.1f per call)\n",
+           (unsigned long long)num_snt, rate_per_sec(num_snt, snd_last_ns - snd_first_ns),
+           (unsigned long long)num_sendmmsg,
+           (num_sendmmsg > 0) ? (double)num_snt / (double)num_sendmmsg : 0.0);
+    printf("Ring high-water: forward %llu of %d, free %llu of %d\n",
+           pipe_fwd.high_water, o_pipe_size, pipe_free.high_water, o_pipe_size);
+  }
+  printf("Forwarded %llu dgrams (-f %s) with %llu receive + %llu send syscalls (%.3f per forwarded dgram)\n",
+         (unsigned long long)num_forwarded, o_select,
+         (unsigned long long)num_rcv_syscalls, (unsigned long long)num_snd_syscalls,
+         (num_forwarded > 0) ? (double)(num_rcv_syscalls + num_snd_syscalls) / (double)num_forwarded : 0.0);
+  printf("Residence time (%s to send return): %s\n",
+         o_kernel_ts ? "kernel receive timestamp" : "receive return",
+         mhist_describe(&residence_hist, hist_desc, sizeof(hist_desc)));
+  if (num_no_kernel_ts > 0) {
+    printf("WARNING: %llu forwarded dgrams had no kernel timestamp\n", (unsigned long long)num_no_kernel_ts);
+  }
+  if (o_impair != NULL) {
+    printf("Impairment (%s): %llu in, %llu lost (%llu random, %llu burst), %llu duplicated, %llu reordered, %llu delayed, %llu pool-full drops, %llu out\n",
+           o_impair, (unsigned long long)imp_num_in,
+           (unsigned long long)(imp_num_lost_random + imp_num_lost_burst),
+           (unsigned long long)imp_num_lost_random, (unsigned long long)imp_num_lost_burst,
+           (unsigned long long)imp_num_dups, (unsigned long long)imp_num_reordered,
+           (unsigned long long)imp_num_delayed, (unsigned long long)imp_num_pool_drops,
+           (unsigned long long)imp_num_out);
+  }
+  for (i = 0; i < num_routes; i++) {
+    route_t *route = &routes[i];
+    int j;
+    printf("Route %d: %s:%d ->", i, inet_ntoa(route->in_sin.sin_addr), ntohs(route->in_sin.sin_port));
+    for (j = 0; j < route->num_outs; j++) {
+      printf(" %s:%d", inet_ntoa(route->outs[j].sin_addr), ntohs(route->outs[j].sin_port));
+    }
+    printf(", %llu in, %llu forwarded, %llu sent, %d msgs, %d warmups, %d quits, %d ooo, %d loss\n",
+           (unsigned long long)route->num_in, (unsigned long long)route->num_fwd,
+           (unsigned long long)route->num_out, route->num_msgs, route->num_warmups, route->num_quits,
+           route->num_ooo, o_num_msgs_expected - route->num_msgs);
+  }
+  if (num_no_route > 0) {
+    printf("%llu dgrams matched no route\n", (unsigned long long)num_no_route);
+  }
   printf("%d dgrams at %.0f dgrams/sec (%.0f bits/sec), %d max dgrams in loop, %d warmups, %d quits, %d ooo, %d loss (%.2f%%)\n",
          num_msgs, msgs_per_sec, bits_per_sec, max_dgrams_in_loop, num_warmups, num_quits, num_ooo,
-         o_num_msgs_expected - (int)num_msgs,
-         ((double)o_num_msgs_expected - (double)num_msgs) * 100.0 / (double)o_num_msgs_expected);
+         num_lost,
+         (o_num_msgs_expected > 0) ? (double)num_lost * 100.0 / ((double)o_num_msgs_expected * num_routes) : 0.0);
 
-  close(rcv_sockfd);
+  for (i = 0; i < num_in_socks; i++) {
+    close(in_socks[i].fd);
+  }
   close(epollfd);
   free(buff);
 
@@ -1,12 +1,14 @@
 /* mrcv.c */
 
-#define _GNU_SOURCE  /* Needed for recvmmsg */
+#define _GNU_SOURCE  /* Needed for recvmmsg, RUSAGE_THREAD, pthread_setaffinity_np */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
 #include <netinet/in.h>
 #include <sys/uio.h>
 #include <sys/socket.h>
@@ -15,14 +17,35 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/resource.h>
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
+
+#include "../mtime.h"
+#include "../mhist.h"
+#include "../mwire.h"
+#include "../mseq.h"
+#include "../mdrops.h"
+#include "muring.h"
 
 #define MAX_UDP_PAYLOAD 1472
+#define WIRE_OVERHEAD 58  /* UDP 8 + IP 20 + Ethernet 14 + FCS 4 + interframe gap 12 */
+#define CTL_SIZE CMSG_SPACE(sizeof(uint32_t))  /* room for SO_RXQ_OVFL */
+#define URING_ENTRIES 64
+#define URING_BGID 1  /* provided buffer group */
+#define MAX_THREADS 64
 
 /* program options */
+int o_first_cpu;
+char *o_steer;
+int o_interval_ms;
 int o_linger_ms;
 int o_multi_rcv;
 int o_num_msgs_expected;
 int o_rcvbuf_size;
+int o_num_threads;
+char *o_timer;
+int o_uring_bufs;
 int o_v_bitmask;
 int o_wait_ms;
 
@@ -35,19 +58,58 @@ char *bind_if;
 #define STATE_MEASURING 1
 #define STATE_QUITTING 2
 
+/* Counters a receiver publishes for the interval reporter (-i), with
+ * relaxed atomic stores after each batch; only the receiver writes them. */
+typedef struct rcv_pub_s {
+  uint64_t num_dgrams;
+  uint64_t num_bytes;
+  uint64_t num_gaps;
+  uint64_t num_late;
+  uint64_t num_dups;
+  uint64_t num_sock_drops;
+} rcv_pub_t;
+
+/* Per-receiver state: one per thread (just one without -t). */
+typedef struct rcv_s {
+  int index;
+  int cpu;  /* -1 = not pinned */
+  pthread_t thread_id;
+  int sockfd;
+  char *buff;
+  int quit;  /* this receiver has lingered out */
+  int state;
+  uint64_t num_msgs;
+  int num_warmups;
+  int num_quits;
+  mseq_t seq;  /* gaps, late, dups, loss */
+  mhist_t latency_hist;  /* one-way, from the header's send timestamp */
+  int num_negative_latency;
+  uint64_t start_ns;
+  uint64_t stop_ns;
+  uint64_t last_pkt_ns;
+  int max_dgrams_in_loop;
+  int msg_len;
+  uint64_t num_dgrams;  /* all datagrams, including warmups and quits */
+  uint64_t num_syscalls;  /* epoll: epoll_wait + receives; io_uring: io_uring_enter */
+  uint64_t num_cqes;  /* io_uring: datagram completions (not ENOBUFS or final) */
+  uint64_t num_busy_enters;  /* io_uring: enters that reaped a datagram */
+  int num_rearms;
+  int num_enobufs;
+  uint64_t user_ns;
+  uint64_t sys_ns;
+  uint64_t num_bytes;
+  uint32_t sock_drops;  /* socket drops since open (SO_RXQ_OVFL, or SO_MEMINFO with -U) */
+  rcv_pub_t pub;
+} rcv_t;
+
 /* Globals. */
 int quit;
-int state;
-int num_msgs;
-int num_warmups;
-int num_quits;
-int num_ooo;
-uint8_t *sqn_cnt;
-uint32_t prev_sqn;
-struct timespec start_ts;
-struct timespec stop_ts;
-struct timespec last_pkt_ts;
-int max_dgrams_in_loop;
+int num_rcvs;
+rcv_t *rcvs;
+int num_rcvs_done;
+int seq_stride;  /* each receiver sees every seq_stride'th sequence number; 0 = can't track */
+pthread_t reporter_thread_id;
+mdrops_t drops_start;  /* host counters before receiving */
 
 
 #define CHKERR(chkerr_s_) do { \
@@ -58,15 +120,8 @@ int max_dgrams_in_loop;
   } \
 } while (0)
 
-#define DIFF_TS(diff_ts_result_ns_, diff_ts_end_ns_, diff_ts_start_ns_) do { \
-  (diff_ts_result_ns_) = (((uint64_t)diff_ts_end_ns_.tv_sec \
-                           - (uint64_t)diff_ts_start_ns_.tv_sec) * 1000000000ull \
-                          + (uint64_t)diff_ts_end_ns_.tv_nsec) \
-                         - (uint64_t)diff_ts_start_ns_.tv_nsec; \
-} while (0)  /* DIFF_TS */
 
-
-char usage_str[] = "[-h] [-l linger_ms] [-m multi_rcv] [-n num_msgs_expected] [-r rcvbuf_size] [-v v_bitmask] [-w wait_ms] group port interface";
+char usage_str[] = "[-a first_cpu] [-B steer] [-h] [-i interval_ms] [-l linger_ms] [-m multi_rcv] [-n num_msgs_expected] [-r rcvbuf_size] [-t num_threads] [-T timer] [-U uring_bufs] [-v v_bitmask] [-w wait_ms] group port interface";
 void usage(char *msg)
 {
   fprintf(stderr, "\n%s\n\n", msg);
@@ -80,16 +135,29 @@ void help()
 {
   fprintf(stderr, "Usage: mdump %s\n", usage_str);
   fprintf(stderr, "Where:\n"
+          "  -a first_cpu : with -t, pin thread i to CPU first_cpu+i (wrapping) [0]\n"
+          "  -B steer : with -t, steer datagrams to threads with a reuseport\n"
+          "             CBPF program: seq (sequence number), cpu (receiving CPU)\n"
+          "             [kernel's flow hash]\n"
           "  -h : help\n"
+          "  -i interval_ms : print rates and sequence counts every interval_ms\n"
+          "                   from a reporter thread [0 = only at exit]\n"
           "  -l linger_ms : time to delay before exiting\n"
           "  -m multi_rcv : use recvmmsg()\n"
           "  -n num_msgs_expected : messages sent by msnd\n"
           "  -r rcvbuf_size : size (bytes) of UDP receive buffer (SO_RCVBUF)\n"
           "                   (use 0 for system default buff size)\n"
-          "  -v v_bitmask : verbosity (1=per msg, 2=sqn issues)\n"
-          "  -w wait_ms : timeout for epoll_wait\n"
+          "  -t num_threads : receive on num_threads threads, each with its own\n"
+          "                   SO_REUSEPORT socket [0 = single-threaded]\n"
+          "  -T timer : clock for rates: mono, raw, tsc, tscp [mono]\n"
+          "  -U uring_bufs : use io_uring multishot receive with uring_bufs\n"
+          "                  provided buffers (power of 2) instead of epoll\n"
+          "  -v v_bitmask : verbosity (1=per msg, 2=gaps, late and duplicate msgs)\n"
+          "  -w wait_ms : timeout for epoll_wait (or io_uring_enter);\n"
+          "               0 busy-polls, so most calls return nothing\n"
           "\n"
-          "  group : multicast address to receive (required)\n"
+          "  group : multicast address to receive, or a local unicast address\n"
+          "          (required; use unicast with -t, see notes.txt)\n"
           "  port : destination port (required)\n"
           "  interface : IP addr of local interface (for multi-homed hosts) [INADDR_ANY]\n"
   );
@@ -107,20 +175,35 @@ void get_parms(int argc, char **argv)
   int num_parms;
 
   /* default values for options */
+  o_first_cpu = 0;
+  o_steer = NULL;
+  o_interval_ms = 0;
   o_linger_ms = 100;
   o_multi_rcv = 0;
   o_num_msgs_expected = 0;
   o_rcvbuf_size = 0x800000;  /* 8MB */
+  o_num_threads = 0;
+  o_timer = NULL;
+  o_uring_bufs = 0;
   o_v_bitmask = 0;
 
   /* default values for optional positional params */
   bind_if = NULL;
 
-  while ((opt = getopt(argc, argv, "hl:m:n:r:v:w:")) != EOF) {
+  while ((opt = getopt(argc, argv, "a:B:hi:l:m:n:r:t:T:U:v:w:")) != EOF) {
     switch (opt) {
+    case 'a':
+      o_first_cpu = atoi(optarg);
+      break;
+    case 'B':
+      o_steer = optarg;
+      break;
     case 'h':
       help();  exit(0);
       break;
+    case 'i':
+      o_interval_ms = atoi(optarg);
+      break;
     case 'l':
       o_linger_ms = atoi(optarg);
       break;
@@ -133,6 +216,15 @@ void get_parms(int argc, char **argv)
     case 'r':
       o_rcvbuf_size = atoi(optarg);
       break;
+    case 't':
+      o_num_threads = atoi(optarg);
+      break;
+    case 'T':
+      o_timer = optarg;
+      break;
+    case 'U':
+      o_uring_bufs = atoi(optarg);
+      break;
     case 'v':
       o_v_bitmask = atoi(optarg);
       break;
@@ -146,6 +238,24 @@ void get_parms(int argc, char **argv)
     }  /* switch */
   }  /* while opt */
 
+  if (o_uring_bufs < 0 || o_uring_bufs > 32768 || (o_uring_bufs & (o_uring_bufs - 1)) != 0) {
+    usage("uring_bufs must be a power of 2 up to 32768");
+  }
+  if (o_uring_bufs > 0 && o_multi_rcv > 0) {
+    usage("-m and -U are mutually exclusive");
+  }
+  if (o_num_threads < 0 || o_num_threads > MAX_THREADS) {
+    usage("num_threads must be 0..64");
+  }
+  if (o_steer != NULL) {
+    if (o_num_threads == 0) {
+      usage("-B needs -t");
+    }
+    if (strcmp(o_steer, "seq") != 0 && strcmp(o_steer, "cpu") != 0) {
+      usage("steer must be seq or cpu");
+    }
+  }
+
   num_parms = argc - optind;
 
   /* handle positional parameters */
@@ -160,105 +270,157 @@ void get_parms(int argc, char **argv)
 }  /* get_parms */
 
 
-void process_datagram(uint32_t *buffer, int len)
+void process_datagram(rcv_t *rcv, char *buffer, int len)
 {
+  mwire_hdr_t hdr;
+
+  rcv->num_dgrams++;
+  rcv->num_bytes += len;
+  if (mwire_decode(buffer, len, &hdr) != 0) {
+    printf("Unexpected message (no header), quitting\n");
+    quit = 1;
+    return;
+  }
+
   if (o_v_bitmask & 1) {
-    printf("Process datagram, size=%d, type=%d sqn=%10u\n",
-           (int)len, buffer[0], buffer[1]);
+    printf("Process datagram, size=%d, type=%d sqn=%10llu\n",
+           (int)len, hdr.type, (unsigned long long)hdr.seq);
   }
 
-  if (buffer[0] == 0) {
-    num_msgs = 0;
-    num_warmups++;
-    if (state == STATE_INIT) {
-      start_ts = last_pkt_ts;
+  if (hdr.type == MWIRE_TYPE_WARMUP) {
+    rcv->num_msgs = 0;
+    rcv->num_warmups++;
+    if (rcv->state == STATE_INIT) {
+      rcv->start_ns = rcv->last_pkt_ns;
     }
   }
-  else if (buffer[0] == 1) {
-    uint32_t sqn = buffer[1];
-    if (o_v_bitmask & 2) {
-      sqn_cnt[sqn]++;
+  else if (hdr.type == MWIRE_TYPE_DATA) {
+    uint64_t sqn = hdr.seq;
+    uint64_t rcv_wall_ns = rcv->last_pkt_ns + mtime_wall_offset_ns;
+    int seq_result;
+    if (rcv_wall_ns >= hdr.send_ns) {
+      mhist_record(&rcv->latency_hist, rcv_wall_ns - hdr.send_ns);
+    } else {
+      rcv->num_negative_latency++;  /* clocks not synchronized */
     }
-    if (sqn != prev_sqn + 1) {
-      num_ooo++;
+    if (seq_stride > 0) {
+      seq_result = mseq_record(&rcv->seq, sqn / seq_stride);
+      if ((o_v_bitmask & 2) && seq_result != MSEQ_IN_ORDER) {
+        if (seq_result == MSEQ_GAP) {
+          printf("Gap: %llu msgs missing before sqn %llu\n", (unsigned long long)rcv->seq.last_gap,
+                 (unsigned long long)sqn);
+        } else {
+          printf("%s sqn %llu\n", (seq_result == MSEQ_LATE) ? "Late" :
+                 (seq_result == MSEQ_DUP) ? "Duplicate" : "Too old", (unsigned long long)sqn);
+        }
+      }
     }
-    prev_sqn = sqn;
-    num_msgs++;
-    state = STATE_MEASURING;
-  }
-  else if (buffer[0] == 2) {
-    if (state == STATE_MEASURING) {
-      stop_ts = last_pkt_ts;
-      state = STATE_QUITTING;
+    rcv->num_msgs++;
+    if (rcv->state == STATE_INIT && rcv->start_ns == 0) {
+      rcv->start_ns = rcv->last_pkt_ns;  /* no warmup reached this thread */
     }
-    num_quits++;
+    rcv->state = STATE_MEASURING;
+  }
+  else if (hdr.type == MWIRE_TYPE_END) {
+    if (rcv->state == STATE_MEASURING) {
+      rcv->stop_ns = rcv->last_pkt_ns;
+      rcv->state = STATE_QUITTING;
+    }
+    rcv->num_quits++;
   }
   else {
-    printf("Unexpected message: 0x%02x, quitting\n", buffer[0]);
+    printf("Unexpected message type: %d, quitting\n", hdr.type);
     quit = 1;
   }
 }  /* process_datagram */
 
 
-int main(int argc, char **argv)
+/* Make the receiver's counts visible to the reporter thread.  Called once
+ * per receive batch; relaxed stores are plain moves, with no locked
+ * instructions or fences. */
+void publish_counts(rcv_t *rcv)
 {
-  uint32_t *buff;
-  int i;
-  int opt;
-  struct epoll_event ev, events[100];
-  int flags;
-  int sockfd;
-  int epollfd;
-  socklen_t fromlen = sizeof(struct sockaddr_in);
-  int cur_size;
-  socklen_t opt_sz;
-  struct sockaddr_in name;
-  struct sockaddr_in src;
-  struct ip_mreq imr;
-  struct sockaddr_in *client_addrs;
-  struct mmsghdr *msgs;
-  struct iovec *iovecs;
-  int msg_len = 0;
-  uint64_t linger_ns;
-  uint64_t tot_bits;
-  uint64_t tot_ns;
-  double msgs_per_sec, bits_per_sec;
+  __atomic_store_n(&rcv->pub.num_dgrams, rcv->num_dgrams, __ATOMIC_RELAXED);
+  __atomic_store_n(&rcv->pub.num_bytes, rcv->num_bytes, __ATOMIC_RELAXED);
+  __atomic_store_n(&rcv->pub.num_gaps, rcv->seq.num_gaps, __ATOMIC_RELAXED);
+  __atomic_store_n(&rcv->pub.num_late, rcv->seq.num_late, __ATOMIC_RELAXED);
+  __atomic_store_n(&rcv->pub.num_dups, rcv->seq.num_dups, __ATOMIC_RELAXED);
+  __atomic_store_n(&rcv->pub.num_sock_drops, rcv->sock_drops, __ATOMIC_RELAXED);
+}  /* publish_counts */
 
-  quit = 0;
-  state = STATE_INIT;
-  signal(SIGINT, handle_signal);
-  signal(SIGTERM, handle_signal);
 
-  get_parms(argc, argv);
+/* Pick up the socket's drop count, which the kernel attaches (SO_RXQ_OVFL)
+ * to a datagram when any were dropped before it was queued. */
+void parse_drops(rcv_t *rcv, struct msghdr *msg)
+{
+  struct cmsghdr *cmsg;
 
-  sqn_cnt = (uint8_t *)malloc(o_num_msgs_expected);
-  if (sqn_cnt == NULL) { fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1); }
-  for (i = 0; i < o_num_msgs_expected; i++) {
-    sqn_cnt[i] = 0;
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+      memcpy(&rcv->sock_drops, CMSG_DATA(cmsg), sizeof(rcv->sock_drops));
+    }
   }
+}  /* parse_drops */
 
-  client_addrs = (struct sockaddr_in *)malloc(o_multi_rcv * sizeof(*client_addrs));
-  msgs = (struct mmsghdr *)malloc(o_multi_rcv * sizeof(*msgs));
-  iovecs = (struct iovec *)malloc(o_multi_rcv * sizeof(*iovecs));
-  buff = (uint32_t *)malloc(o_multi_rcv * MAX_UDP_PAYLOAD);
-  if (buff == NULL) { fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1); }
 
-  for (i = 0; i < o_multi_rcv; i++) {
-    memset(&client_addrs[i], 0, sizeof(client_addrs[i]));
-    iovecs[i].iov_base = &buff[i * (MAX_UDP_PAYLOAD/sizeof(uint32_t))];
-    iovecs[i].iov_len = MAX_UDP_PAYLOAD;
+/* Socket drop count from SO_MEMINFO, for io_uring multishot receive,
+ * which does not return control messages. */
+uint32_t meminfo_drops(int sockfd)
+{
+  uint32_t meminfo[SK_MEMINFO_VARS];
+  socklen_t opt_sz = sizeof(meminfo);
 
-    msgs[i].msg_len = 0;
-    msgs[i].msg_hdr.msg_name = &client_addrs[i];
-    msgs[i].msg_hdr.msg_namelen = sizeof(client_addrs[i]);
-    msgs[i].msg_hdr.msg_iov = &iovecs[i];
-    msgs[i].msg_hdr.msg_iovlen = 1;
-    msgs[i].msg_hdr.msg_control = NULL;
-    msgs[i].msg_hdr.msg_controllen = 0;
-    msgs[i].msg_hdr.msg_flags = 0;
+  memset(meminfo, 0, sizeof(meminfo));
+  if (getsockopt(sockfd, SOL_SOCKET, SO_MEMINFO, meminfo, &opt_sz) == -1) {
+    return 0;
   }
+  return meminfo[SK_MEMINFO_DROPS];
+}  /* meminfo_drops */
 
-  CHKERR(epollfd = epoll_create1(0));
+
+void check_size(rcv_t *rcv, int cur_size)
+{
+  if (rcv->msg_len == 0) {
+    rcv->msg_len = cur_size;
+  }
+  else if (cur_size != rcv->msg_len) {
+    fprintf(stderr, "ERROR, cur_size=%d, msg_len=%d\n", cur_size, rcv->msg_len);
+    exit(1);
+  }
+}  /* check_size */
+
+
+/* Nothing received (timeout). If it's been a while, quit.  A thread that
+ * got nothing at all quits once another thread has finished. */
+void check_linger(rcv_t *rcv)
+{
+  if (rcv->state != STATE_INIT) {
+    uint64_t ns_since_last_pkt = mtime_ns() - rcv->last_pkt_ns;
+    if (ns_since_last_pkt > (uint64_t)o_linger_ms * 1000000) {
+      rcv->quit = 1;
+    }
+  }
+  else if (__atomic_load_n(&num_rcvs_done, __ATOMIC_RELAXED) > 0) {
+    rcv->quit = 1;
+  }
+}  /* check_linger */
+
+
+uint64_t rusage_ns(struct timeval *tv)
+{
+  return (uint64_t)tv->tv_sec * 1000000000 + (uint64_t)tv->tv_usec * 1000;
+}  /* rusage_ns */
+
+
+int rcv_socket_open(rcv_t *rcv)
+{
+  int sockfd;
+  int flags;
+  int opt;
+  int cur_size;
+  socklen_t opt_sz;
+  struct sockaddr_in name;
+  struct ip_mreq imr;
 
   CHKERR(sockfd = socket(PF_INET,SOCK_DGRAM,0));
 
@@ -271,16 +433,17 @@ int main(int argc, char **argv)
 
   opt_sz = (socklen_t)sizeof(cur_size);
   CHKERR(getsockopt(sockfd,SOL_SOCKET,SO_RCVBUF,(char *)&cur_size, (socklen_t *)&opt_sz));
-  if (cur_size < o_rcvbuf_size) {
+  if (cur_size < o_rcvbuf_size && rcv->index == 0) {
     printf("WARNING: tried to set SO_RCVBUF to %d, only got %d\n", o_rcvbuf_size, cur_size); fflush(stdout);
   }
 
-  memset((char *)&imr,0,sizeof(imr));
-  imr.imr_multiaddr.s_addr = groupaddr;
-  imr.imr_interface.s_addr = inet_addr(bind_if);
-
   opt = 1;
   CHKERR(setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)));
+  if (o_num_threads > 0) {
+    /* The kernel spreads datagrams over the sockets sharing the port. */
+    CHKERR(setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (char *)&opt, sizeof(opt)));
+  }
+  CHKERR(setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, (char *)&opt, sizeof(opt)));
 
   memset((char *)&name,0,sizeof(name));
   name.sin_family = AF_INET;
@@ -288,76 +451,140 @@ int main(int argc, char **argv)
   name.sin_port = htons(groupport);
   CHKERR(bind(sockfd,(struct sockaddr *)&name,sizeof(name)));
 
-  CHKERR(setsockopt(sockfd,IPPROTO_IP,IP_ADD_MEMBERSHIP, (char *)&imr,sizeof(struct ip_mreq)));
+  if (IN_MULTICAST(ntohl(groupaddr))) {
+    memset((char *)&imr,0,sizeof(imr));
+    imr.imr_multiaddr.s_addr = groupaddr;
+    imr.imr_interface.s_addr = inet_addr(bind_if);
+    CHKERR(setsockopt(sockfd,IPPROTO_IP,IP_ADD_MEMBERSHIP, (char *)&imr,sizeof(struct ip_mreq)));
+  }
+
+  return sockfd;
+}  /* rcv_socket_open */
+
+
+/* Replace the reuseport flow hash with a classic BPF program that returns
+ * the index (in bind order) of the socket to deliver to.  For UDP the
+ * program sees the datagram starting at the UDP payload. */
+void attach_steering(int sockfd)
+{
+  struct sock_filter seq_code[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 20),  /* low 32 bits of the header's seq (big-endian on the wire, as BPF loads it) */
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (unsigned int)num_rcvs),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+  };
+  struct sock_filter cpu_code[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (unsigned int)(SKF_AD_OFF + SKF_AD_CPU)),
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (unsigned int)num_rcvs),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+  };
+  struct sock_fprog prog;
+
+  if (strcmp(o_steer, "seq") == 0) {
+    prog.len = sizeof(seq_code) / sizeof(seq_code[0]);
+    prog.filter = seq_code;
+  } else {
+    prog.len = sizeof(cpu_code) / sizeof(cpu_code[0]);
+    prog.filter = cpu_code;
+  }
+  CHKERR(setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)));
+}  /* attach_steering */
+
+
+void epoll_rcv_loop(rcv_t *rcv)
+{
+  char *buff = rcv->buff;
+  int i;
+  struct epoll_event ev, events[100];
+  int epollfd;
+  int cur_size;
+  struct sockaddr_in src;
+  struct msghdr msg;
+  struct iovec iov;
+  struct sockaddr_in *client_addrs;
+  struct mmsghdr *msgs;
+  struct iovec *iovecs;
+  char *ctls;  /* a control buffer per message, for SO_RXQ_OVFL */
+
+  client_addrs = (struct sockaddr_in *)malloc(o_multi_rcv * sizeof(*client_addrs));
+  msgs = (struct mmsghdr *)malloc(o_multi_rcv * sizeof(*msgs));
+  iovecs = (struct iovec *)malloc(o_multi_rcv * sizeof(*iovecs));
+  ctls = (char *)malloc((o_multi_rcv + 1) * CTL_SIZE);
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = buff;
+  iov.iov_len = MAX_UDP_PAYLOAD;
+  msg.msg_name = &src;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctls;
+
+  for (i = 0; i < o_multi_rcv; i++) {
+    memset(&client_addrs[i], 0, sizeof(client_addrs[i]));
+    iovecs[i].iov_base = &buff[i * MAX_UDP_PAYLOAD];
+    iovecs[i].iov_len = MAX_UDP_PAYLOAD;
+
+    msgs[i].msg_len = 0;
+    msgs[i].msg_hdr.msg_name = &client_addrs[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(client_addrs[i]);
+    msgs[i].msg_hdr.msg_iov = &iovecs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_control = &ctls[i * CTL_SIZE];
+    msgs[i].msg_hdr.msg_controllen = CTL_SIZE;
+    msgs[i].msg_hdr.msg_flags = 0;
+  }
+
+  CHKERR(epollfd = epoll_create1(0));
 
   /* Register sockfd with epoll. */
   ev.events = EPOLLIN;
-  ev.data.fd = sockfd;
-  CHKERR(epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &ev));
+  ev.data.fd = rcv->sockfd;
+  CHKERR(epoll_ctl(epollfd, EPOLL_CTL_ADD, rcv->sockfd, &ev));
 
-  num_warmups = 0;
-  num_quits = 0;
-  num_ooo = 0;
-  prev_sqn = (uint32_t)-1;
-  max_dgrams_in_loop = 1;
-  linger_ns = (uint64_t)o_linger_ms * 1000000;
-
-  while (!quit) {
+  while (!quit && !rcv->quit) {
     int nfds, ev;
 
     CHKERR(nfds = epoll_wait(epollfd, events, 100, o_wait_ms));
+    rcv->num_syscalls++;
 
     if (nfds == 0) {
-      if (state != STATE_INIT) {
-        /* Nothing received (timeout). If it's been a while, quit. */
-        struct timespec timeout_ts;
-        int64_t ns_since_last_pkt;
-        clock_gettime(CLOCK_MONOTONIC, &timeout_ts);
-        DIFF_TS(ns_since_last_pkt, timeout_ts, last_pkt_ts);
-        if (ns_since_last_pkt > linger_ns) {
-          quit = 1;
-        }
-      }
+      check_linger(rcv);
     } else {  /* nfds > 0 */
-      clock_gettime(CLOCK_MONOTONIC, &last_pkt_ts);
+      rcv->last_pkt_ns = mtime_ns();
     }
 
     for (ev = 0; ev < nfds; ++ev) {
       if (events[ev].events & EPOLLIN) {
 
         if (o_multi_rcv == 0) {  /* Single receive. */
-          CHKERR(cur_size = recvfrom(events[ev].data.fd, buff, MAX_UDP_PAYLOAD, 0, (struct sockaddr *)&src, &fromlen));
-          if (msg_len == 0) {
-            msg_len = cur_size;
-          }
-          else if (cur_size != msg_len) {
-            fprintf(stderr, "ERROR, cur_size=%d, msg_len=%d\n", cur_size, msg_len);
-            exit(1);
-          }
-          process_datagram(buff, cur_size);
+          msg.msg_namelen = sizeof(src);
+          msg.msg_controllen = CTL_SIZE;
+          CHKERR(cur_size = recvmsg(events[ev].data.fd, &msg, 0));
+          rcv->num_syscalls++;
+          parse_drops(rcv, &msg);
+          check_size(rcv, cur_size);
+          process_datagram(rcv, buff, cur_size);
         }  /* single read */
 
         else {  /* multi-receive */
           int n_dgrams;
+          for (i = 0; i < o_multi_rcv; ++i) {
+            msgs[i].msg_hdr.msg_controllen = CTL_SIZE;  /* the kernel overwrites it */
+          }
           CHKERR(n_dgrams = recvmmsg(events[ev].data.fd, msgs, o_multi_rcv, 0, NULL));
+          rcv->num_syscalls++;
           if (n_dgrams == 0) { printf("recvmmsg(%d) returned 0\n", events[ev].data.fd); }
-          if (n_dgrams > max_dgrams_in_loop) {
-            max_dgrams_in_loop = n_dgrams;
+          if (n_dgrams > rcv->max_dgrams_in_loop) {
+            rcv->max_dgrams_in_loop = n_dgrams;
           }
 
-          uint32_t *b = buff;
+          char *b = buff;
           for (i = 0; i < n_dgrams; ++i) {
             cur_size = msgs[i].msg_len;
-            if (msg_len == 0) {
-              msg_len = cur_size;
-            }
-            else if (cur_size != msg_len) {
-              fprintf(stderr, "ERROR, cur_size=%d, msg_len=%d\n", cur_size, msg_len);
-              exit(1);
-            }
-            process_datagram(b, cur_size);
-
-            b += (MAX_UDP_PAYLOAD/sizeof(uint32_t));  /* Step to the next buffer. */
+            parse_drops(rcv, &msgs[i].msg_hdr);
+            check_size(rcv, cur_size);
+            process_datagram(rcv, b, cur_size);
+
+            b += MAX_UDP_PAYLOAD;  /* Step to the next buffer. */
           }  /* for i */
         }  /* multi-read */
       }  /* if EPOLLIN */
@@ -366,13 +593,351 @@ int main(int argc, char **argv)
             ev, events[ev].events, events[ev].data.fd);
       }
     }
+    if (nfds > 0) {
+      publish_counts(rcv);
+    }
   }  /* while !quit */
 
-  if (state == STATE_MEASURING) {
-    stop_ts = last_pkt_ts;
+  close(epollfd);
+  free(client_addrs);
+  free(msgs);
+  free(iovecs);
+  free(ctls);
+}  /* epoll_rcv_loop */
+
+
+/* Arm a multishot receive: one SQE keeps producing a completion per
+ * datagram, each in a buffer the kernel takes from the provided ring. */
+void uring_arm_recv(struct muring_s *ring, int sockfd)
+{
+  struct io_uring_sqe *sqe = muring_get_sqe(ring);
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = sockfd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BGID;
+}  /* uring_arm_recv */
+
+
+void uring_rcv_loop(rcv_t *rcv)
+{
+  struct muring_s ring;
+  struct muring_buf_ring_s bring;
+  struct io_uring_cqe *cqe;
+  int armed;
+
+  /* Room for a completion per buffer, plus the final one of a multishot. */
+  CHKERR(muring_init(&ring, URING_ENTRIES,
+                     (o_uring_bufs > URING_ENTRIES) ? 2 * o_uring_bufs : 2 * URING_ENTRIES, 0));
+  CHKERR(muring_buf_ring_init(&ring, &bring, URING_BGID, rcv->buff, MAX_UDP_PAYLOAD, o_uring_bufs));
+  uring_arm_recv(&ring, rcv->sockfd);
+  armed = 1;
+
+  while (!quit && !rcv->quit) {
+    int n_cqes = 0;
+    int n_dgrams = 0;
+
+    if (!armed) {
+      uring_arm_recv(&ring, rcv->sockfd);
+      armed = 1;
+      rcv->num_rearms++;
+    }
+    /* With wait_ms 0, just reap what is ready (like epoll_wait with 0). */
+    if (muring_submit_and_wait(&ring, (o_wait_ms > 0) ? 1 : 0, (uint64_t)o_wait_ms * 1000000) == -1) {
+      if (errno != ETIME && errno != EINTR) {
+        CHKERR(-1);
+      }
+    }
+
+    while ((cqe = muring_peek_cqe(&ring)) != NULL) {
+      if (n_cqes == 0) {
+        rcv->last_pkt_ns = mtime_ns();
+      }
+      n_cqes++;
+      if (cqe->res == -ENOBUFS) {
+        rcv->num_enobufs++;  /* all buffers in use; multishot stops */
+      }
+      else if (cqe->res < 0) {
+        errno = -cqe->res;
+        CHKERR(-1);
+      }
+      else {
+        uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        check_size(rcv, cqe->res);
+        process_datagram(rcv, &rcv->buff[(size_t)bid * MAX_UDP_PAYLOAD], cqe->res);
+        muring_buf_ring_recycle(&bring, bid);
+        n_dgrams++;
+      }
+      if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        armed = 0;
+      }
+      muring_cqe_seen(&ring);
+    }
+    muring_buf_ring_publish(&bring);
+
+    rcv->num_cqes += n_dgrams;
+    if (n_dgrams > 0) {
+      rcv->num_busy_enters++;
+    }
+    if (n_dgrams > rcv->max_dgrams_in_loop) {
+      rcv->max_dgrams_in_loop = n_dgrams;
+    }
+    if (n_cqes == 0) {
+      check_linger(rcv);
+    } else {
+      publish_counts(rcv);
+    }
+  }  /* while !quit */
+
+  rcv->num_syscalls = ring.num_enters;
+  rcv->sock_drops = meminfo_drops(rcv->sockfd);
+  close(ring.ring_fd);
+}  /* uring_rcv_loop */
+
+
+void *rcv_thread(void *arg)
+{
+  rcv_t *rcv = (rcv_t *)arg;
+  struct rusage start_usage, end_usage;
+
+  if (rcv->cpu >= 0) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(rcv->cpu, &cpuset);
+    errno = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (errno != 0) {
+      CHKERR(-1);
+    }
+  }
+
+  CHKERR(getrusage(RUSAGE_THREAD, &start_usage));
+
+  if (o_uring_bufs > 0) {
+    uring_rcv_loop(rcv);
+  } else {
+    epoll_rcv_loop(rcv);
+  }
+
+  CHKERR(getrusage(RUSAGE_THREAD, &end_usage));
+  rcv->user_ns = rusage_ns(&end_usage.ru_utime) - rusage_ns(&start_usage.ru_utime);
+  rcv->sys_ns = rusage_ns(&end_usage.ru_stime) - rusage_ns(&start_usage.ru_stime);
+
+  if (rcv->state == STATE_MEASURING) {
+    rcv->stop_ns = rcv->last_pkt_ns;
+  }
+  __atomic_fetch_add(&num_rcvs_done, 1, __ATOMIC_RELAXED);
+
+  return NULL;
+}  /* rcv_thread */
+
+
+double rate_per_sec(uint64_t count, uint64_t ns)
+{
+  return (ns > 0) ? (double)count * 1000000000.0 / (double)ns : 0.0;
+}  /* rate_per_sec */
+
+
+/* Reporter thread (-i): every interval, sum the receivers' published
+ * counters and print the change, with the host drop counters.  All stdio
+ * happens here, not in the receive path.  Bits/sec counts the wire
+ * overhead, like the exit report. */
+void *reporter_thread(void *arg)
+{
+  rcv_pub_t prev, cur;
+  mdrops_t prev_drops, cur_drops;
+  char drops_desc[200];
+  uint64_t prev_ns, now_ns, next_ns, interval_ns;
+  uint64_t wall_ns;
+  time_t wall_sec;
+  struct tm wall_tm;
+  int i;
+
+  interval_ns = (uint64_t)o_interval_ms * 1000000;
+  memset(&prev, 0, sizeof(prev));
+  prev_drops = drops_start;
+  prev_ns = mtime_ns();
+  next_ns = prev_ns + interval_ns;
+  while (!__atomic_load_n(&quit, __ATOMIC_RELAXED)
+         && __atomic_load_n(&num_rcvs_done, __ATOMIC_RELAXED) < num_rcvs) {
+    now_ns = mtime_ns();
+    if (now_ns < next_ns) {
+      /* Short naps, so that the end of the run is noticed. */
+      uint64_t nap_ns = next_ns - now_ns;
+      usleep((nap_ns > 100000000) ? 100000 : (useconds_t)(nap_ns / 1000));
+      continue;
+    }
+    next_ns += interval_ns;
+
+    memset(&cur, 0, sizeof(cur));
+    for (i = 0; i < num_rcvs; i++) {
+      rcv_pub_t *pub = &rcvs[i].pub;
+      cur.num_dgrams += __atomic_load_n(&pub->num_dgrams, __ATOMIC_RELAXED);
+      cur.num_bytes += __atomic_load_n(&pub->num_bytes, __ATOMIC_RELAXED);
+      cur.num_gaps += __atomic_load_n(&pub->num_gaps, __ATOMIC_RELAXED);
+      cur.num_late += __atomic_load_n(&pub->num_late, __ATOMIC_RELAXED);
+      cur.num_dups += __atomic_load_n(&pub->num_dups, __ATOMIC_RELAXED);
+      if (o_uring_bufs > 0) {
+        cur.num_sock_drops += meminfo_drops(rcvs[i].sockfd);
+      } else {
+        cur.num_sock_drops += __atomic_load_n(&pub->num_sock_drops, __ATOMIC_RELAXED);
+      }
+    }
+    mdrops_sample(&cur_drops);
+
+    wall_ns = now_ns + mtime_wall_offset_ns;
+    wall_sec = (time_t)(wall_ns / 1000000000);
+    localtime_r(&wall_sec, &wall_tm);
+    printf("%02d:%02d:%02d.%03d: %.0f dgrams/sec, %.0f bits/sec, %llu gaps, %llu late, %llu dups, %llu socket drops, host %s\n",
+           wall_tm.tm_hour, wall_tm.tm_min, wall_tm.tm_sec, (int)((wall_ns % 1000000000) / 1000000),
+           rate_per_sec(cur.num_dgrams - prev.num_dgrams, now_ns - prev_ns),
+           rate_per_sec(8 * (cur.num_bytes - prev.num_bytes + WIRE_OVERHEAD * (cur.num_dgrams - prev.num_dgrams)),
+                        now_ns - prev_ns),
+           (unsigned long long)(cur.num_gaps - prev.num_gaps),
+           (unsigned long long)(cur.num_late - prev.num_late),
+           (unsigned long long)(cur.num_dups - prev.num_dups),
+           (unsigned long long)(cur.num_sock_drops - prev.num_sock_drops),
+           mdrops_describe(&prev_drops, &cur_drops, drops_desc, sizeof(drops_desc)));
+    fflush(stdout);
+    prev = cur;
+    prev_drops = cur_drops;
+    prev_ns = now_ns;
   }
 
-  DIFF_TS(tot_ns, stop_ts, start_ts);
+  return NULL;
+}  /* reporter_thread */
+
+
+int main(int argc, char **argv)
+{
+  int i;
+  int num_bufs;
+  int num_cpus;
+  uint64_t tot_bits;
+  uint64_t tot_ns;
+  double msgs_per_sec, bits_per_sec;
+  char timer_desc[80];
+  char hist_desc[256];
+  /* Merged over all receivers. */
+  uint64_t num_msgs = 0;
+  int num_warmups = 0, num_quits = 0;
+  mseq_t seq;
+  char seq_desc[256];
+  int num_negative_latency = 0, max_dgrams_in_loop = 1, msg_len = 0;
+  int num_rearms = 0, num_enobufs = 0;
+  uint64_t start_ns = 0, stop_ns = 0;
+  uint64_t num_dgrams = 0, num_syscalls = 0, num_cqes = 0, num_busy_enters = 0;
+  uint64_t user_ns = 0, sys_ns = 0;
+  uint64_t sock_drops = 0;
+  mhist_t latency_hist;
+  mdrops_t drops_end;
+  char drops_desc[200];
+
+  quit = 0;
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+
+  get_parms(argc, argv);
+
+  if (mtime_init(o_timer) != 0) {
+    exit(1);
+  }
+
+  num_rcvs = (o_num_threads > 0) ? o_num_threads : 1;
+  /* With -B seq and a power-of-2 thread count, thread i gets the sequence
+   * numbers congruent to i, so seq / num_rcvs is consecutive per thread. */
+  if (num_rcvs == 1) {
+    seq_stride = 1;
+  } else if (o_steer != NULL && strcmp(o_steer, "seq") == 0 && (num_rcvs & (num_rcvs - 1)) == 0) {
+    seq_stride = num_rcvs;
+  } else {
+    seq_stride = 0;
+  }
+  rcvs = (rcv_t *)calloc(num_rcvs, sizeof(*rcvs));
+  if (rcvs == NULL) { fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1); }
+  num_rcvs_done = 0;
+
+  if (o_num_threads > 0 && IN_MULTICAST(ntohl(groupaddr))) {
+    printf("WARNING: the kernel delivers multicast to every SO_REUSEPORT socket; use a unicast address to spread the load\n");
+  }
+
+  num_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  num_bufs = (o_uring_bufs > o_multi_rcv) ? o_uring_bufs : o_multi_rcv;
+  for (i = 0; i < num_rcvs; i++) {
+    rcv_t *rcv = &rcvs[i];
+    rcv->index = i;
+    rcv->cpu = (o_num_threads > 0) ? (o_first_cpu + i) % num_cpus : -1;
+    rcv->buff = (char *)malloc((size_t)num_bufs * MAX_UDP_PAYLOAD + MAX_UDP_PAYLOAD);
+    if (rcv->buff == NULL) { fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1); }
+    rcv->state = STATE_INIT;
+    mseq_init(&rcv->seq);
+    mhist_init(&rcv->latency_hist);
+    rcv->max_dgrams_in_loop = 1;
+    rcv->sockfd = rcv_socket_open(rcv);  /* bind order = steering index */
+  }
+  if (o_steer != NULL) {
+    attach_steering(rcvs[0].sockfd);
+  }
+  mdrops_sample(&drops_start);
+  if (o_interval_ms > 0) {
+    errno = pthread_create(&reporter_thread_id, NULL, reporter_thread, NULL);
+    if (errno != 0) {
+      CHKERR(-1);
+    }
+  }
+
+  if (o_num_threads == 0) {
+    rcv_thread(&rcvs[0]);
+  } else {
+    for (i = 0; i < num_rcvs; i++) {
+      errno = pthread_create(&rcvs[i].thread_id, NULL, rcv_thread, &rcvs[i]);
+      if (errno != 0) {
+        CHKERR(-1);
+      }
+    }
+    for (i = 0; i < num_rcvs; i++) {
+      pthread_join(rcvs[i].thread_id, NULL);
+    }
+  }
+  if (o_interval_ms > 0) {
+    pthread_join(reporter_thread_id, NULL);
+  }
+  mdrops_sample(&drops_end);
+
+  mhist_init(&latency_hist);
+  mseq_init(&seq);
+  for (i = 0; i < num_rcvs; i++) {
+    rcv_t *rcv = &rcvs[i];
+    num_msgs += rcv->num_msgs;
+    num_warmups += rcv->num_warmups;
+    num_quits += rcv->num_quits;
+    mseq_merge(&seq, &rcv->seq);
+    num_negative_latency += rcv->num_negative_latency;
+    if (rcv->max_dgrams_in_loop > max_dgrams_in_loop) {
+      max_dgrams_in_loop = rcv->max_dgrams_in_loop;
+    }
+    if (msg_len == 0) {
+      msg_len = rcv->msg_len;
+    }
+    num_rearms += rcv->num_rearms;
+    num_enobufs += rcv->num_enobufs;
+    if (rcv->start_ns != 0 && (start_ns == 0 || rcv->start_ns < start_ns)) {
+      start_ns = rcv->start_ns;
+    }
+    if (rcv->stop_ns > stop_ns) {
+      stop_ns = rcv->stop_ns;
+    }
+    num_dgrams += rcv->num_dgrams;
+    num_syscalls += rcv->num_syscalls;
+    num_cqes += rcv->num_cqes;
+    num_busy_enters += rcv->num_busy_enters;
+    user_ns += rcv->user_ns;
+    sys_ns += rcv->sys_ns;
+    sock_drops += rcv->sock_drops;
+    mhist_merge(&latency_hist, &rcv->latency_hist);
+  }
+
+  tot_ns = stop_ns - start_ns;
 
   tot_bits = (uint64_t)num_msgs * (uint64_t)8 * (
       (uint64_t)msg_len  /* UDP payload */
@@ -392,27 +957,75 @@ int main(int argc, char **argv)
   bits_per_sec *= 1000000000.0;
 
   printf("\n");
+  printf("o_linger_ms=%d, o_multi_rcv=%d, o_num_msgs_expected=%d, o_rcvbuf_size=%d, o_num_threads=%d, o_uring_bufs=%d, o_v_bitmask=%d\n",
+          o_linger_ms, o_multi_rcv, o_num_msgs_expected, o_rcvbuf_size, o_num_threads, o_uring_bufs, o_v_bitmask);
+  printf("Timer: %s\n", mtime_describe(timer_desc, sizeof(timer_desc)));
+  printf("One-way latency (needs synchronized clocks): %s, %d negative\n",
+         mhist_describe(&latency_hist, hist_desc, sizeof(hist_desc)), num_negative_latency);
+  if (o_uring_bufs > 0) {
+    /* Per non-empty enter: with -w 0 most enters are empty polls. */
+    printf("io_uring: %llu dgram completions in %llu io_uring_enter, %llu non-empty (%.2f dgrams per non-empty enter), %d re-arms, %d ENOBUFS\n",
+           (unsigned long long)num_cqes, (unsigned long long)num_syscalls, (unsigned long long)num_busy_enters,
+           (num_busy_enters > 0) ? (double)num_cqes / (double)num_busy_enters : 0.0, num_rearms, num_enobufs);
+  } else {
+    printf("epoll: %llu dgrams in %llu syscalls (%.2f per syscall)\n",
+           (unsigned long long)num_dgrams, (unsigned long long)num_syscalls,
+           (num_syscalls > 0) ? (double)num_dgrams / (double)num_syscalls : 0.0);
+  }
+  printf("CPU: %.0f ns/dgram (user %.0f, sys %.0f)\n",
+         (num_dgrams > 0) ? (double)(user_ns + sys_ns) / (double)num_dgrams : 0.0,
+         (num_dgrams > 0) ? (double)user_ns / (double)num_dgrams : 0.0,
+         (num_dgrams > 0) ? (double)sys_ns / (double)num_dgrams : 0.0);
 
-  if (o_v_bitmask & 2) {
-    printf("Sqn issues: ");
-    for (i = 0; i < o_num_msgs_expected; i++) {
-      if (sqn_cnt[i] != 1) {
-        printf("sqn_cnt[%d]=%d ", i, sqn_cnt[i]);
+  if (seq_stride > 0) {
+    printf("Sequence: %s\n", mseq_describe(&seq, seq_desc, sizeof(seq_desc)));
+    if (seq.num_late > 0) {
+      printf("Reorder depth: %s\n", mseq_describe_depths(&seq, seq_desc, sizeof(seq_desc)));
+    }
+  } else {
+    printf("Sequence: not tracked (with -t, needs -B seq and a power-of-2 thread count)\n");
+  }
+  /* Where loss happened: the socket buffer, the host, or (as the sequence
+   * numbers show) anywhere up to the application. */
+  printf("Drops: socket %llu (%s), host %s, application ",
+         (unsigned long long)sock_drops, (o_uring_bufs > 0) ? "SO_MEMINFO" : "SO_RXQ_OVFL",
+         mdrops_describe(&drops_start, &drops_end, drops_desc, sizeof(drops_desc)));
+  if (seq_stride > 0) {
+    printf("%llu unrecovered loss\n", (unsigned long long)seq.num_lost);
+  } else {
+    printf("not tracked\n");
+  }
+
+  if (o_num_threads > 0) {
+    uint64_t max_msgs = 0, min_msgs = num_msgs;
+    for (i = 0; i < num_rcvs; i++) {
+      rcv_t *rcv = &rcvs[i];
+      printf("Thread %d (cpu %d): %llu dgrams at %.0f dgrams/sec, %llu gaps, %llu late, CPU %.0f ns/dgram\n",
+             i, rcv->cpu, (unsigned long long)rcv->num_msgs, rate_per_sec(rcv->num_msgs, rcv->stop_ns - rcv->start_ns),
+             (unsigned long long)rcv->seq.num_gaps, (unsigned long long)rcv->seq.num_late,
+             (rcv->num_dgrams > 0) ? (double)(rcv->user_ns + rcv->sys_ns) / (double)rcv->num_dgrams : 0.0);
+      if (rcv->num_msgs > max_msgs) {
+        max_msgs = rcv->num_msgs;
+      }
+      if (rcv->num_msgs < min_msgs) {
+        min_msgs = rcv->num_msgs;
       }
     }
+    /* 1.00 is an even spread; num_threads means one thread got everything. */
+    printf("Imbalance: max/mean %.2f (max %llu, min %llu dgrams per thread)\n",
+           (num_msgs > 0) ? (double)max_msgs * (double)num_rcvs / (double)num_msgs : 0.0,
+           (unsigned long long)max_msgs, (unsigned long long)min_msgs);
   }
 
-  printf("\n");
-  printf("o_linger_ms=%d, o_multi_rcv=%d, o_num_msgs_expected=%d, o_rcvbuf_size=%d, o_v_bitmask=%d\n",
-          o_linger_ms, o_multi_rcv, o_num_msgs_expected, o_rcvbuf_size, o_v_bitmask);
-  printf("%d dgrams at %.0f dgrams/sec (%.0f bits/sec), %d max dgrams in loop, %d warmups, %d quits, %d ooo, %d loss (%.2f%%)\n",
-         num_msgs, msgs_per_sec, bits_per_sec, max_dgrams_in_loop, num_warmups, num_quits, num_ooo,
-         o_num_msgs_expected - (int)num_msgs,
+  printf("%llu dgrams at %.0f dgrams/sec (%.0f bits/sec), %d max dgrams in loop, %d warmups, %d quits, %lld loss (%.2f%%)\n",
+         (unsigned long long)num_msgs, msgs_per_sec, bits_per_sec, max_dgrams_in_loop, num_warmups, num_quits,
+         (long long)o_num_msgs_expected - (long long)num_msgs,
          ((double)o_num_msgs_expected - (double)num_msgs) * 100.0 / (double)o_num_msgs_expected);
 
-  close(sockfd);
-  close(epollfd);
-  free(buff);
+  for (i = 0; i < num_rcvs; i++) {
+    close(rcvs[i].sockfd);
+    free(rcvs[i].buff);
+  }
 
   return 0;
 }  /* main */
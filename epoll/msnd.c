@@ -1,5 +1,7 @@
 /* msnd.c */
 
+#define _GNU_SOURCE  /* Needed for sendmmsg */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -10,15 +12,24 @@
 #include <errno.h>
 #include <string.h>
 
+#include "../mtime.h"
+#include "../mwire.h"
+#include "muring.h"
+
 #define MAX_UDP_PAYLOAD 1472  /* Even multiple of 64. */
 #define WARMUP_LOOPS 100
 #define END_LOOPS 300
+#define BATCH_HIST_BUCKETS 17  /* batch sizes 1, 2-3, 4-7, ... 65536+ */
+#define RATE_HELD_PCT 99.0  /* achieved rate must be within 1% of -r */
 
 /* program options */
 int o_msg_len;
 int o_num_msgs;
 int o_rate;
 int o_sndbuf_size;
+char *o_timer;
+int o_uring_entries;
+int o_mmsg_batch;
 
 /* program positional parameters */
 unsigned long int groupaddr;
@@ -27,8 +38,24 @@ char *bind_if;
 
 
 struct sockaddr_in group_sin;
+uint32_t sender_id;
 int global_max_tight_sends;
 uint64_t start_usec;
+uint64_t num_syscalls;
+uint64_t batch_hist[BATCH_HIST_BUCKETS];  /* catch-up batch sizes, log2 buckets */
+
+/* sendmmsg mode: one pre-built message vector, reused for every batch. */
+struct mmsghdr *mmsgs;
+char *mmsg_bufs;
+
+/* io_uring send backend: each in-flight send owns one registered buffer. */
+struct muring_s ring;
+char *uring_bufs;
+int *uring_free_slots;
+int uring_num_free;
+int uring_num_queued;  /* prepared, not yet submitted */
+uint64_t num_send_errors;
+int first_send_errno;
 
 
 #define CHKERR(chkerr_s_) do { \
@@ -39,15 +66,8 @@ uint64_t start_usec;
   } \
 } while (0)
 
-#define DIFF_TS(diff_ts_result_ns_, diff_ts_end_ns_, diff_ts_start_ns_) do { \
-  (diff_ts_result_ns_) = (((uint64_t)diff_ts_end_ns_.tv_sec \
-                           - (uint64_t)diff_ts_start_ns_.tv_sec) * 1000000000ull \
-                          + (uint64_t)diff_ts_end_ns_.tv_nsec) \
-                         - (uint64_t)diff_ts_start_ns_.tv_nsec; \
-} while (0)  /* DIFF_TS */
 
-
-char usage_str[] = "[-h] [-m msg_len] [-n num_msg] [-r rate] [-s sndbuf_size] group port interface";
+char usage_str[] = "[-b mmsg_batch] [-h] [-m msg_len] [-n num_msg] [-r rate] [-s sndbuf_size] [-T timer] [-U uring_entries] group port interface";
 void usage(char *msg)
 {
   fprintf(stderr, "\n%s\n\n", msg);
@@ -61,11 +81,16 @@ void help()
 {
   fprintf(stderr, "Usage: mdump %s\n", usage_str);
   fprintf(stderr, "Where:\n"
+          "  -b mmsg_batch : send catch-up runs with sendmmsg(), up to mmsg_batch\n"
+          "                  per call (0 = sendto() per datagram) [0]\n"
           "  -h : help\n"
           "  -m msg_len : size (bytes) of UDP datagram\n"
           "  -n num_msg : number of measurement messages to send\n"
           "  -r rate : messages per second to send\n"
           "  -s sndbuf_size : sender socket buffer size\n"
+          "  -T timer : clock for pacing: mono, raw, tsc, tscp [mono]\n"
+          "  -U uring_entries : send with io_uring, up to uring_entries in flight\n"
+          "                     (power of 2; 0 = sendto() per datagram) [0]\n"
           "\n"
           "  group : multicast address to receive (required)\n"
           "  port : destination port (required)\n"
@@ -84,18 +109,25 @@ void get_parms(int argc, char **argv)
   o_num_msgs = 1000000;
   o_rate = 1000;
   o_sndbuf_size = 0;
+  o_timer = NULL;
+  o_uring_entries = 0;
+  o_mmsg_batch = 0;
 
   /* default values for optional positional params */
   bind_if = NULL;
 
-  while ((opt = getopt(argc, argv, "hm:n:r:s:")) != EOF) {
+  while ((opt = getopt(argc, argv, "b:hm:n:r:s:T:U:")) != EOF) {
     switch (opt) {
+    case 'b':
+      o_mmsg_batch = atoi(optarg);
+      if (o_mmsg_batch < 0 || o_mmsg_batch > 1024) { fprintf(stderr, "mmsg_batch must be 0..1024\n"); exit(1); }
+      break;
     case 'h':
       help();  exit(0);
       break;
     case 'm':
       o_msg_len = atoi(optarg);
-      if (o_msg_len > MAX_UDP_PAYLOAD) { fprintf(stderr, "msg_len must be 1..%d\n", MAX_UDP_PAYLOAD); exit(1); }
+      if (o_msg_len < MWIRE_HDR_LEN || o_msg_len > MAX_UDP_PAYLOAD) { fprintf(stderr, "msg_len must be %d..%d\n", MWIRE_HDR_LEN, MAX_UDP_PAYLOAD); exit(1); }
       break;
     case 'n':
       o_num_msgs = atoi(optarg);
@@ -106,6 +138,15 @@ void get_parms(int argc, char **argv)
     case 's':
       o_sndbuf_size = atoi(optarg);
       break;
+    case 'T':
+      o_timer = optarg;
+      break;
+    case 'U':
+      o_uring_entries = atoi(optarg);
+      if (o_uring_entries < 0 || o_uring_entries > 4096 || (o_uring_entries & (o_uring_entries - 1)) != 0) {
+        fprintf(stderr, "uring_entries must be a power of 2 up to 4096\n"); exit(1);
+      }
+      break;
     default:
       usage("unrecognized option");
       exit(1);
@@ -113,6 +154,10 @@ void get_parms(int argc, char **argv)
     }  /* switch */
   }  /* while opt */
 
+  if (o_mmsg_batch > 0 && o_uring_entries > 0) {
+    usage("-b and -U are mutually exclusive");
+  }
+
   num_parms = argc - optind;
 
   /* handle positional parameters */
@@ -127,10 +172,148 @@ void get_parms(int argc, char **argv)
 }  /* get_parms */
 
 
-void send_loop(int sockfd, int num_sends, uint64_t sends_per_sec, uint32_t *buffer)
+void uring_setup(int sockfd)
+{
+  struct iovec *iovecs;
+  int i;
+
+  CHKERR(muring_init(&ring, o_uring_entries, 0, 0));
+
+  uring_bufs = (char *)calloc(o_uring_entries, MAX_UDP_PAYLOAD);
+  iovecs = (struct iovec *)malloc(o_uring_entries * sizeof(*iovecs));
+  uring_free_slots = (int *)malloc(o_uring_entries * sizeof(*uring_free_slots));
+  if (uring_bufs == NULL || iovecs == NULL || uring_free_slots == NULL) {
+    fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1);
+  }
+  for (i = 0; i < o_uring_entries; i++) {
+    iovecs[i].iov_base = &uring_bufs[i * MAX_UDP_PAYLOAD];
+    iovecs[i].iov_len = MAX_UDP_PAYLOAD;
+    uring_free_slots[i] = i;
+  }
+  uring_num_free = o_uring_entries;
+  uring_num_queued = 0;
+
+  /* Pin the buffers and the socket once instead of on every send. */
+  CHKERR(muring_register(&ring, IORING_REGISTER_BUFFERS, iovecs, o_uring_entries));
+  CHKERR(muring_register(&ring, IORING_REGISTER_FILES, &sockfd, 1));
+  free(iovecs);
+}  /* uring_setup */
+
+
+/* Submit queued sends (if any) and wait for 'wait_nr' completions, then
+ * recycle the buffers of all completed sends. */
+void uring_submit(unsigned int wait_nr)
+{
+  struct io_uring_cqe *cqe;
+
+  if (muring_submit_and_wait(&ring, wait_nr, 0) == -1) {
+    if (errno != EINTR) {
+      CHKERR(-1);
+    }
+  }
+  uring_num_queued = 0;
+
+  while ((cqe = muring_peek_cqe(&ring)) != NULL) {
+    if (cqe->res < 0) {
+      num_send_errors++;
+      if (first_send_errno == 0) {
+        first_send_errno = -cqe->res;
+      }
+    }
+    else if (cqe->res != o_msg_len) {
+      num_send_errors++;  /* truncated */
+    }
+    uring_free_slots[uring_num_free++] = (int)cqe->user_data;
+    muring_cqe_seen(&ring);
+  }
+}  /* uring_submit */
+
+
+/* Queue one send; it goes out at the next uring_submit(). */
+void uring_queue_send(int msg_type, uint64_t seq)
+{
+  struct io_uring_sqe *sqe;
+  char *buffer;
+  int slot;
+
+  while (uring_num_free == 0) {
+    uring_submit(1);  /* every buffer is in flight */
+  }
+  slot = uring_free_slots[--uring_num_free];
+  buffer = &uring_bufs[slot * MAX_UDP_PAYLOAD];
+  mwire_encode(buffer, msg_type, sender_id, 0, seq, mtime_wall_ns(), o_msg_len - MWIRE_HDR_LEN);
+
+  sqe = muring_get_sqe(&ring);  /* never NULL: SQ has a slot per buffer */
+  /* A write on the connected socket is a send; WRITE_FIXED takes a
+   * registered buffer on any kernel with io_uring. */
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = 0;  /* index into the registered files */
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->buf_index = (uint16_t)slot;
+  sqe->addr = (uint64_t)(uintptr_t)buffer;
+  sqe->len = o_msg_len;
+  sqe->user_data = (uint64_t)slot;
+  uring_num_queued++;
+}  /* uring_queue_send */
+
+
+void mmsg_setup()
+{
+  struct iovec *iovecs;
+  int i;
+
+  mmsgs = (struct mmsghdr *)calloc(o_mmsg_batch, sizeof(*mmsgs));
+  iovecs = (struct iovec *)calloc(o_mmsg_batch, sizeof(*iovecs));
+  mmsg_bufs = (char *)calloc(o_mmsg_batch, MAX_UDP_PAYLOAD);
+  if (mmsgs == NULL || iovecs == NULL || mmsg_bufs == NULL) {
+    fprintf(stderr, "Error, %s:%d, malloc failed\n", __FILE__, __LINE__); exit(1);
+  }
+  for (i = 0; i < o_mmsg_batch; i++) {
+    iovecs[i].iov_base = &mmsg_bufs[i * MAX_UDP_PAYLOAD];
+    iovecs[i].iov_len = o_msg_len;
+    mmsgs[i].msg_hdr.msg_name = &group_sin;
+    mmsgs[i].msg_hdr.msg_namelen = sizeof(group_sin);
+    mmsgs[i].msg_hdr.msg_iov = &iovecs[i];
+    mmsgs[i].msg_hdr.msg_iovlen = 1;
+  }
+}  /* mmsg_setup */
+
+
+/* Send up to 'count' messages, sequence numbers from 'seq', with one
+ * sendmmsg().  Returns the number sent (the kernel may send fewer). */
+int mmsg_send(int sockfd, int msg_type, uint64_t seq, uint64_t count)
+{
+  uint64_t send_ns = mtime_wall_ns();  /* the batch leaves together */
+  int n, i;
+
+  n = (count > (uint64_t)o_mmsg_batch) ? o_mmsg_batch : (int)count;
+  for (i = 0; i < n; i++) {
+    mwire_encode(&mmsg_bufs[i * MAX_UDP_PAYLOAD], msg_type, sender_id, 0, seq + i, send_ns,
+                 o_msg_len - MWIRE_HDR_LEN);
+  }
+  CHKERR(n = sendmmsg(sockfd, mmsgs, n, 0));
+  num_syscalls++;
+
+  return n;
+}  /* mmsg_send */
+
+
+void record_batch(uint64_t batch)
+{
+  int bucket = 0;
+
+  while (batch > 1 && bucket < BATCH_HIST_BUCKETS - 1) {
+    batch >>= 1;
+    bucket++;
+  }
+  batch_hist[bucket]++;
+}  /* record_batch */
+
+
+void send_loop(int sockfd, int num_sends, uint64_t sends_per_sec, int msg_type, char *buffer)
 {
-  struct timespec cur_ts;
-  struct timespec start_ts;
+  uint64_t cur_ns;
+  uint64_t start_ns;
   uint64_t num_sent;
   int max_tight_sends;
 
@@ -138,12 +321,11 @@ void send_loop(int sockfd, int num_sends, uint64_t sends_per_sec, uint32_t *buff
 
   /* Send messages evenly-spaced using busy looping. Based on algorithm:
    * http://www.geeky-boy.com/catchup/html/ */
-  clock_gettime(CLOCK_MONOTONIC, &start_ts);
-  cur_ts = start_ts;
+  start_ns = mtime_ns();
+  cur_ns = start_ns;
   num_sent = 0;
   do {  /* while num_sent < num_sends */
-    uint64_t ns_so_far;
-    DIFF_TS(ns_so_far, cur_ts, start_ts);
+    uint64_t ns_so_far = cur_ns - start_ns;
     /* The +1 is because we want to send, then pause. */
     uint64_t should_have_sent = (ns_so_far * sends_per_sec)/1000000000 + 1;
     if (should_have_sent > num_sends) {
@@ -152,37 +334,64 @@ void send_loop(int sockfd, int num_sends, uint64_t sends_per_sec, uint32_t *buff
     if (should_have_sent - num_sent > max_tight_sends) {
       max_tight_sends = should_have_sent - num_sent;
     }
+    if (should_have_sent > num_sent && msg_type == MWIRE_TYPE_DATA) {
+      record_batch(should_have_sent - num_sent);
+    }
 
     /* If we are behind where we should be, get caught up. */
     while (num_sent < should_have_sent) {
       /* Send message. */
-      CHKERR(sendto(sockfd, buffer, o_msg_len, 0, (struct sockaddr *)&group_sin, sizeof(group_sin)));
-      buffer[1]++;
-
-      num_sent++;
+      if (o_uring_entries > 0) {
+        uring_queue_send(msg_type, num_sent);
+        num_sent++;
+      } else if (o_mmsg_batch > 0) {
+        num_sent += mmsg_send(sockfd, msg_type, num_sent, should_have_sent - num_sent);
+      } else {
+        mwire_encode(buffer, msg_type, sender_id, 0, num_sent, mtime_wall_ns(), o_msg_len - MWIRE_HDR_LEN);
+        CHKERR(sendto(sockfd, buffer, o_msg_len, 0, (struct sockaddr *)&group_sin, sizeof(group_sin)));
+        num_syscalls++;
+        num_sent++;
+      }
     }  /* while num_sent < should_have_sent */
-    clock_gettime(CLOCK_MONOTONIC, &cur_ts);
+    if (uring_num_queued > 0) {
+      uring_submit(0);  /* the whole catch-up batch in one syscall */
+    }
+    cur_ns = mtime_ns();
   } while (num_sent < num_sends);
 
-  global_max_tight_sends = max_tight_sends;
+  /* Wait for the last sends so their errors are counted. */
+  while (o_uring_entries > 0 && uring_num_free < o_uring_entries) {
+    uring_submit(1);
+  }
+
+  if (msg_type == MWIRE_TYPE_DATA) {  /* report the measurement, not the end loop */
+    global_max_tight_sends = max_tight_sends;
+  }
 }  /* send_loop */
 
 
 int main(int argc, char **argv)
 {
   int opt, i;
-  uint32_t buffer[MAX_UDP_PAYLOAD/sizeof(uint32_t)];
+  char buffer[MAX_UDP_PAYLOAD];
   int sockfd;
   struct in_addr iface_in;
   int cur_size, sz;
   uint64_t tot_bits;
-  struct timespec start_ts;
-  struct timespec stop_ts;
+  uint64_t start_ns;
   uint64_t tot_ns;
+  uint64_t data_syscalls;
   double msgs_per_sec, bits_per_sec;
+  char timer_desc[80];
 
   get_parms(argc, argv);
 
+  if (mtime_init(o_timer) != 0) {
+    exit(1);
+  }
+  sender_id = mwire_new_sender_id();
+  memset(buffer, 0, sizeof(buffer));
+
   CHKERR(sockfd = socket(PF_INET,SOCK_DGRAM,0));
 
   if (o_sndbuf_size > 0) {
@@ -207,26 +416,28 @@ int main(int argc, char **argv)
   group_sin.sin_addr.s_addr = groupaddr;
   group_sin.sin_port = htons(groupport);
 
-  buffer[0] = 0;
-  buffer[1] = 0;
+  if (o_uring_entries > 0) {
+    /* io_uring sends have no destination address; connect instead. */
+    CHKERR(connect(sockfd, (struct sockaddr *)&group_sin, sizeof(group_sin)));
+    uring_setup(sockfd);
+  }
+  if (o_mmsg_batch > 0) {
+    mmsg_setup();
+  }
+
   for (i = 0; i < WARMUP_LOOPS; ++i) {
     usleep(1000);  /* 1 ms */
+    mwire_encode(buffer, MWIRE_TYPE_WARMUP, sender_id, 0, i, mtime_wall_ns(), o_msg_len - MWIRE_HDR_LEN);
     CHKERR(sendto(sockfd, buffer, o_msg_len, 0, (struct sockaddr *)&group_sin, sizeof(group_sin)));
-    buffer[1]++;
   }  /* for ;; */
 
-  buffer[0] = 1;
-  buffer[1] = 0;
-
-  clock_gettime(CLOCK_MONOTONIC, &start_ts);
-  send_loop(sockfd, o_num_msgs, (uint64_t)o_rate, buffer);
-  clock_gettime(CLOCK_MONOTONIC, &stop_ts);
-  DIFF_TS(tot_ns, stop_ts, start_ts);
-
-  buffer[0] = 2;
-  buffer[1] = 0;
+  num_syscalls = 0;
+  start_ns = mtime_ns();
+  send_loop(sockfd, o_num_msgs, (uint64_t)o_rate, MWIRE_TYPE_DATA, buffer);
+  tot_ns = mtime_ns() - start_ns;
+  data_syscalls = (o_uring_entries > 0) ? ring.num_enters : num_syscalls;
 
-  send_loop(sockfd, END_LOOPS, (uint64_t)o_rate, buffer);
+  send_loop(sockfd, END_LOOPS, (uint64_t)o_rate, MWIRE_TYPE_END, buffer);
 
   close(sockfd);
 
@@ -248,8 +459,34 @@ int main(int argc, char **argv)
 
   printf("o_msg_len=%d, o_num_msgs=%d, o_rate=%d, o_sndbuf_size=%d\n",
          o_msg_len, o_num_msgs, o_rate, o_sndbuf_size);
+  printf("Timer: %s, sender ID %08x\n", mtime_describe(timer_desc, sizeof(timer_desc)), sender_id);
   printf("%d dgrams at %.0f dgrams/sec (%.0f bits/sec), %d max tight sends\n",
          o_num_msgs, msgs_per_sec, bits_per_sec, global_max_tight_sends);
+  printf("Catch-up batch sizes:");
+  for (i = 0; i < BATCH_HIST_BUCKETS; i++) {
+    if (batch_hist[i] > 0) {
+      if (i < 1) {
+        printf(" %d:%llu", 1 << i, (unsigned long long)batch_hist[i]);
+      } else if (i < BATCH_HIST_BUCKETS - 1) {
+        printf(" %d-%d:%llu", 1 << i, (2 << i) - 1, (unsigned long long)batch_hist[i]);
+      } else {
+        printf(" %d+:%llu", 1 << i, (unsigned long long)batch_hist[i]);
+      }
+    }
+  }
+  printf("\n");
+  printf("%s: %llu syscalls (%.3f per dgram), rate %s (%.1f%% of %d)\n",
+         (o_uring_entries > 0) ? "io_uring" : (o_mmsg_batch > 0) ? "sendmmsg" : "sendto",
+         (unsigned long long)data_syscalls, (double)data_syscalls / (double)o_num_msgs,
+         (msgs_per_sec * 100.0 >= RATE_HELD_PCT * (double)o_rate) ? "held" : "NOT held",
+         msgs_per_sec * 100.0 / (double)o_rate, o_rate);
+  if (o_uring_entries > 0) {
+    printf("%llu send completion errors", (unsigned long long)num_send_errors);
+    if (first_send_errno != 0) {
+      printf(" (first: %s)", strerror(first_send_errno));
+    }
+    printf("\n");
+  }
 
   return 0;
 }  /* main */
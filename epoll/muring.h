@@ -0,0 +1,266 @@
+/* muring.h */
+/*   Minimal io_uring access for msnd and mrcv, using the raw system calls
+ * (liburing is not required).  Like ../mtime.h, this header holds
+ * definitions; include it once.
+ *
+ * Functions return -1 and set errno on failure, so they can be wrapped in
+ * CHKERR().
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef MURING_H
+#define MURING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct muring_s {
+  int ring_fd;
+  unsigned int features;
+  /* submission queue */
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int sq_mask;
+  unsigned int *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned int sq_local_tail;  /* SQEs prepared but not yet published */
+  unsigned int sq_entries;
+  /* completion queue */
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe *cqes;
+  /* statistics */
+  uint64_t num_enters;
+};
+
+/* Provided-buffer ring: the kernel picks a buffer for each receive. */
+struct muring_buf_ring_s {
+  struct io_uring_buf_ring *br;
+  unsigned int mask;
+  uint16_t local_tail;  /* buffers added but not yet published */
+  char *bufs;
+  int buf_size;
+};
+
+
+int muring_setup(unsigned int entries, struct io_uring_params *params)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}  /* muring_setup */
+
+int muring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete,
+                 unsigned int flags, void *arg, size_t arg_sz)
+{
+  return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_sz);
+}  /* muring_enter */
+
+int muring_register(struct muring_s *ring, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+  return (int)syscall(__NR_io_uring_register, ring->ring_fd, opcode, arg, nr_args);
+}  /* muring_register */
+
+
+/* Create a ring with 'entries' submission slots and map its queues.
+ * 'cq_entries' sizes the completion queue (0 for the default of twice
+ * 'entries'); a multishot request stops if the completion queue fills. */
+int muring_init(struct muring_s *ring, unsigned int entries, unsigned int cq_entries,
+                unsigned int setup_flags)
+{
+  struct io_uring_params params;
+  size_t sq_len, cq_len;
+  char *sq_ptr, *cq_ptr;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&params, 0, sizeof(params));
+  params.flags = setup_flags;
+  if (cq_entries > 0) {
+    params.flags |= IORING_SETUP_CQSIZE;
+    params.cq_entries = cq_entries;
+  }
+  ring->ring_fd = muring_setup(entries, &params);
+  if (ring->ring_fd == -1) {
+    return -1;
+  }
+  ring->features = params.features;
+  ring->sq_entries = params.sq_entries;
+
+  sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cq_len > sq_len) {
+      sq_len = cq_len;
+    }
+  }
+  sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring->ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) {
+    return -1;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ptr = sq_ptr;
+  } else {
+    cq_ptr = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring->ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) {
+      return -1;
+    }
+  }
+  ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    return -1;
+  }
+
+  ring->sq_head = (unsigned int *)(sq_ptr + params.sq_off.head);
+  ring->sq_tail = (unsigned int *)(sq_ptr + params.sq_off.tail);
+  ring->sq_mask = *(unsigned int *)(sq_ptr + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned int *)(sq_ptr + params.sq_off.array);
+  ring->sq_local_tail = *ring->sq_tail;
+  ring->cq_head = (unsigned int *)(cq_ptr + params.cq_off.head);
+  ring->cq_tail = (unsigned int *)(cq_ptr + params.cq_off.tail);
+  ring->cq_mask = *(unsigned int *)(cq_ptr + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq_ptr + params.cq_off.cqes);
+
+  return 0;
+}  /* muring_init */
+
+
+/* Next free submission slot (zeroed), or NULL if the queue is full. */
+struct io_uring_sqe *muring_get_sqe(struct muring_s *ring)
+{
+  struct io_uring_sqe *sqe;
+  unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+  if (ring->sq_local_tail - head >= ring->sq_entries) {
+    return NULL;
+  }
+  sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+  ring->sq_array[ring->sq_local_tail & ring->sq_mask] = ring->sq_local_tail & ring->sq_mask;
+  ring->sq_local_tail++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}  /* muring_get_sqe */
+
+
+/* Publish prepared SQEs and enter the kernel once to submit them and
+ * wait for 'wait_nr' completions.  With 'wait_nr' 0 this still reaps any
+ * completions the kernel has pending (they are only posted to the queue
+ * from inside the kernel).  With a non-zero 'timeout_ns', returns -1 with
+ * errno ETIME if nothing completed in time. */
+int muring_submit_and_wait(struct muring_s *ring, unsigned int wait_nr, uint64_t timeout_ns)
+{
+  /* Count from the kernel's head: submission stops at an SQE that fails,
+   * leaving the rest for the next call. */
+  unsigned int to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  unsigned int flags = IORING_ENTER_GETEVENTS;
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  int rtn;
+
+  __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+  ring->num_enters++;
+  if (wait_nr > 0 && timeout_ns > 0) {
+    ts.tv_sec = timeout_ns / 1000000000;
+    ts.tv_nsec = timeout_ns % 1000000000;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    rtn = muring_enter(ring->ring_fd, to_submit, wait_nr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  } else {
+    rtn = muring_enter(ring->ring_fd, to_submit, wait_nr, flags, NULL, 0);
+  }
+  return rtn;
+}  /* muring_submit_and_wait */
+
+
+/* Oldest unconsumed completion, or NULL if there are none. */
+struct io_uring_cqe *muring_peek_cqe(struct muring_s *ring)
+{
+  unsigned int head = *ring->cq_head;
+
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return &ring->cqes[head & ring->cq_mask];
+}  /* muring_peek_cqe */
+
+void muring_cqe_seen(struct muring_s *ring)
+{
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}  /* muring_cqe_seen */
+
+
+/* Register 'num_bufs' buffers of 'buf_size' bytes (at 'bufs') as buffer
+ * group 'bgid'.  'num_bufs' must be a power of 2. */
+int muring_buf_ring_init(struct muring_s *ring, struct muring_buf_ring_s *bring,
+                         uint16_t bgid, char *bufs, int buf_size, unsigned int num_bufs)
+{
+  struct io_uring_buf_reg reg;
+  size_t ring_len = num_bufs * sizeof(struct io_uring_buf);
+  unsigned int i;
+
+  bring->br = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (bring->br == MAP_FAILED) {
+    return -1;
+  }
+  bring->mask = num_bufs - 1;
+  bring->local_tail = 0;
+  bring->bufs = bufs;
+  bring->buf_size = buf_size;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)bring->br;
+  reg.ring_entries = num_bufs;
+  reg.bgid = bgid;
+  if (muring_register(ring, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+    return -1;
+  }
+
+  bring->br->tail = 0;
+  for (i = 0; i < num_bufs; i++) {
+    struct io_uring_buf *buf = &bring->br->bufs[bring->local_tail & bring->mask];
+    buf->addr = (uint64_t)(uintptr_t)&bufs[(size_t)i * buf_size];
+    buf->len = buf_size;
+    buf->bid = (uint16_t)i;
+    bring->local_tail++;
+  }
+  __atomic_store_n(&bring->br->tail, bring->local_tail, __ATOMIC_RELEASE);
+
+  return 0;
+}  /* muring_buf_ring_init */
+
+
+/* Give buffer 'bid' back to the kernel (visible after muring_buf_ring_publish). */
+void muring_buf_ring_recycle(struct muring_buf_ring_s *bring, uint16_t bid)
+{
+  struct io_uring_buf *buf = &bring->br->bufs[bring->local_tail & bring->mask];
+
+  buf->addr = (uint64_t)(uintptr_t)&bring->bufs[(size_t)bid * bring->buf_size];
+  buf->len = bring->buf_size;
+  buf->bid = bid;
+  bring->local_tail++;
+}  /* muring_buf_ring_recycle */
+
+void muring_buf_ring_publish(struct muring_buf_ring_s *bring)
+{
+  __atomic_store_n(&bring->br->tail, bring->local_tail, __ATOMIC_RELEASE);
+}  /* muring_buf_ring_publish */
+
+#endif /* MURING_H */
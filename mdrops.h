@@ -0,0 +1,135 @@
+/* mdrops.h */
+/*   Host-level receive drop counters shared by the mtools programs.
+ * See https://github.com/UltraMessaging/mtools
+ *
+ * Samples the kernel's UDP counters in /proc/net/snmp (InErrors,
+ * RcvbufErrors) and the per-CPU backlog counters in /proc/net/softnet_stat
+ * (dropped, time_squeeze), so a program can report how much was lost in
+ * the host beside what its own sockets and sequence numbers show.  The
+ * counters cover the whole host, not just one program.  Linux only; on
+ * other systems mdrops_sample() returns -1.
+ *
+ * Like mtime.h, this header holds definitions; include it once.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef MDROPS_H
+#define MDROPS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef struct mdrops_s {
+	int valid;  /* the sample was read */
+	uint64_t udp_in_errors;  /* all UDP receive errors */
+	uint64_t udp_rcvbuf_errors;  /* socket receive buffer full */
+	uint64_t softnet_dropped;  /* input backlog full, summed over CPUs */
+	uint64_t softnet_squeezed;  /* softirq ran out of budget with work left */
+} mdrops_t;
+
+
+#if defined(__linux__)
+/* Value of field 'name' from the "Udp:" header and value lines of
+ * /proc/net/snmp. */
+uint64_t mdrops_snmp_field(const char *names, const char *values, const char *name)
+{
+	const char *n = names;
+	const char *v = values;
+	size_t name_len = strlen(name);
+
+	for (;;) {
+		while (*n == ' ') n++;
+		while (*v == ' ') v++;
+		if (*n == '\0' || *n == '\n' || *v == '\0' || *v == '\n')
+			return 0;
+		if (strncmp(n, name, name_len) == 0 && (n[name_len] == ' ' || n[name_len] == '\n' || n[name_len] == '\0'))
+			return strtoull(v, NULL, 10);
+		while (*n != ' ' && *n != '\n' && *n != '\0') n++;
+		while (*v != ' ' && *v != '\n' && *v != '\0') v++;
+	}
+}  /* mdrops_snmp_field */
+#endif
+
+
+/* Read the current host counters.  Returns 0, or -1 (and clears 'valid')
+ * if they are not available. */
+int mdrops_sample(mdrops_t *drops)
+{
+#if defined(__linux__)
+	FILE *fp;
+	char names[512];
+	char values[512];
+	unsigned int processed, dropped, squeezed;
+
+	memset((char *)drops, 0, sizeof(*drops));
+
+	fp = fopen("/proc/net/snmp", "r");
+	if (fp == NULL)
+		return -1;
+	names[0] = '\0';
+	while (fgets(values, sizeof(values), fp) != NULL) {
+		if (strncmp(values, "Udp:", 4) != 0)
+			continue;
+		if (names[0] == '\0') {
+			strcpy(names, values);  /* first "Udp:" line has the field names */
+			continue;
+		}
+		drops->udp_in_errors = mdrops_snmp_field(&names[4], &values[4], "InErrors");
+		drops->udp_rcvbuf_errors = mdrops_snmp_field(&names[4], &values[4], "RcvbufErrors");
+		drops->valid = 1;
+		break;
+	}
+	fclose(fp);
+	if (! drops->valid)
+		return -1;
+
+	/* One line per CPU, hex: processed, dropped, time_squeeze, ... */
+	fp = fopen("/proc/net/softnet_stat", "r");
+	if (fp != NULL) {
+		while (fgets(values, sizeof(values), fp) != NULL) {
+			if (sscanf(values, "%x %x %x", &processed, &dropped, &squeezed) == 3) {
+				drops->softnet_dropped += dropped;
+				drops->softnet_squeezed += squeezed;
+			}
+		}
+		fclose(fp);
+	}
+	return 0;
+#else
+	memset((char *)drops, 0, sizeof(*drops));
+	return -1;
+#endif
+}  /* mdrops_sample */
+
+
+/* "RcvbufErrors N, InErrors N, softnet dropped N, squeezed N" for the
+ * change from 'from' to 'to'. */
+char *mdrops_describe(const mdrops_t *from, const mdrops_t *to, char *buf, int buf_size)
+{
+	if (! from->valid || ! to->valid) {
+		snprintf(buf, buf_size, "not available");
+		return buf;
+	}
+	snprintf(buf, buf_size, "Udp RcvbufErrors %llu, InErrors %llu, softnet dropped %llu, squeezed %llu",
+			(unsigned long long)(to->udp_rcvbuf_errors - from->udp_rcvbuf_errors),
+			(unsigned long long)(to->udp_in_errors - from->udp_in_errors),
+			(unsigned long long)(to->softnet_dropped - from->softnet_dropped),
+			(unsigned long long)(to->softnet_squeezed - from->softnet_squeezed));
+	return buf;
+}  /* mdrops_describe */
+
+#endif /* MDROPS_H */
@@ -23,6 +23,10 @@
   THE LIKELIHOOD OF SUCH DAMAGES.
  */
 
+#if defined(__linux__)
+#define _GNU_SOURCE  /* Needed for recvmmsg */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -59,6 +63,7 @@ typedef unsigned long socklen_t;
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #define SLEEP_SEC(s) sleep(s)
 #define SLEEP_MSEC(s) usleep((s) * 1000)
@@ -84,12 +89,34 @@ typedef unsigned long socklen_t;
 
 #define MAXPDU 65536
 
+#if defined(__linux__)
+#   define HAVE_RECVMMSG
+#   define HAVE_TIMESTAMPNS  /* SO_TIMESTAMPNS kernel receive timestamps */
+#   define HAVE_RXQ_OVFL  /* SO_RXQ_OVFL socket drop counts (receives use recvmsg) */
+#endif
+
+#if defined(HAVE_PTHREAD_H) && defined(__GNUC__)
+#   define HAVE_ASYNC_OUTPUT  /* needs threads and __atomic builtins */
+#endif
+
+#include "mtime.h"
+#include "mwire.h"
+#include "mseq.h"
+#include "mdrops.h"
+
 
 /* program name (from argv[0] */
 char *prog_name = "xxx";
 
 /* program options */
+int o_async_ring_size;
+char *o_capture_file;
+TLONGLONG o_capture_rotate_bytes;
+TLONGLONG o_capture_rotate_sec;
 int o_compact_dump;
+int o_interval_ms;
+int o_kernel_ts;
+int o_multi_rcv;
 int o_quiet_lvl;
 int o_rcvbuf_size;
 int o_pause_ms;
@@ -97,16 +124,149 @@ int o_pause_num;
 int o_verify;
 int o_stop;
 int o_tcp;
+char *o_Timer;
 FILE *o_output;
 char o_output_equiv_opt[1024];
+char o_capture_equiv_opt[1024];
 
 /* program positional parameters */
 unsigned long int groupaddr;
 unsigned short int groupport;
 char *bind_if;
 
+/* receive state */
+uint64_t num_rcvd;  /* data msgs from all sources since the last reset (for -p) */
+volatile int stop;  /* set by 'stat' with -s, or by a signal */
+TLONGLONG *batch_hist;  /* batch_hist[n] = recvmmsg() calls returning n dgrams */
+TLONGLONG num_no_kernel_ts;  /* -k datagrams that came without a timestamp */
+uint32_t sock_drops;  /* datagrams the socket dropped (SO_RXQ_OVFL, cumulative) */
+mdrops_t drops_start;  /* host counters when receiving started */
+
+#if defined(HAVE_RXQ_OVFL)
+/* Room for SO_TIMESTAMPNS and SO_RXQ_OVFL control messages. */
+#define CTL_BUF_SIZE (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)))
+#endif
 
-char usage_str[] = "[-h] [-o ofile] [-c compact_dump] [-p pause_ms[/loops]] [-Q Quiet_lvl] [-q] [-r rcvbuf_size] [-s] [-t] [-v] group port [interface]";
+/* Source address strings ("a.b.c.d.port") of recent senders, so that each
+ * is only formatted once.  Direct-mapped on address and port. */
+#define SRC_CACHE_BITS 6
+#define SRC_CACHE_SIZE (1 << SRC_CACHE_BITS)
+struct src_cache_s {
+	unsigned int addr;  /* network order */
+	unsigned short port;  /* network order */
+	char str[sizeof("xxx.xxx.xxx.xxx.xxxxx")];  /* empty if unused */
+};
+struct src_cache_s src_cache[SRC_CACHE_SIZE];
+
+/* Per-source statistics, so that several senders on one group are each
+ * accounted for.  Open-addressing hash table (linear probing) keyed on
+ * source address, port and binary header sender ID, kept at most half
+ * full; sources beyond that share source_other.  Only the receive thread
+ * touches it until the exit report. */
+#define SOURCE_TABLE_BITS 12
+#define SOURCE_TABLE_SIZE (1 << SOURCE_TABLE_BITS)
+#define SOURCE_TABLE_MAX (SOURCE_TABLE_SIZE / 2)
+struct source_s {
+	int used;
+	unsigned int addr;  /* network order */
+	unsigned short port;  /* network order */
+	uint32_t sender_id;  /* 0 for legacy text messages */
+	TLONGLONG num_msgs;  /* data msgs */
+	TLONGLONG num_bytes;  /* all datagrams */
+	uint64_t first_ns;
+	uint64_t last_ns;
+	TLONGLONG num_stats;
+	uint64_t num_rcvd;  /* data msgs since the last 'stat' or 'echo' */
+	TLONGLONG cur_seq;  /* next expected, for -v */
+	mseq_t *seq;  /* [0] since the last reset, [1] earlier runs */
+};
+struct source_s *source_table;
+int source_table_num;
+struct source_s source_other;
+struct source_s *source_last;  /* most recent lookup */
+
+/* Running totals over all sources, for the interval reporter (-i).  The
+ * receive thread keeps rpt_totals and copies it to rpt_pub with relaxed
+ * atomic stores (it is the only writer, so these are plain moves with no
+ * locks); the reporter thread reads rpt_pub. */
+struct rpt_counts_s {
+	TLONGLONG num_dgrams;
+	TLONGLONG num_bytes;
+	TLONGLONG num_gaps;
+	TLONGLONG num_late;
+	TLONGLONG num_dups;
+	TLONGLONG num_sock_drops;
+};
+struct rpt_counts_s rpt_totals;
+struct rpt_counts_s rpt_pub;
+
+#if defined(HAVE_ASYNC_OUTPUT)
+/* Async output (-a): the receive thread copies each datagram into a
+ * single-producer/single-consumer ring and a writer thread does all of the
+ * formatting and file I/O.  Records are variable length, 8-byte aligned,
+ * and never straddle the end of the buffer; a RING_REC_WRAP record sends
+ * the reader back to the start.  ring_head and ring_tail are free-running
+ * byte counts, each written by only one thread. */
+#define RING_REC_WRAP 0
+#define RING_REC_DGRAM 1
+#define RING_REC_TEXT 2
+#define RING_ALIGN(n) (((n) + 7) & ~7)
+#define MIN_ASYNC_RING_SIZE (2 * (MAXPDU + 64))
+struct ring_rec_s {
+	int rec_len;  /* total bytes, including this header */
+	int type;  /* RING_REC_* */
+	uint64_t rcv_ns;  /* wall-clock receive time */
+	struct sockaddr_in src;
+	int dgram_len;  /* datagram size (data may be truncated to what is printed) */
+	int data_len;  /* bytes following this header */
+};
+char *ring_buf;
+unsigned long long ring_head;  /* written by receive thread */
+unsigned long long ring_tail;  /* written by writer thread */
+int ring_quit;
+TLONGLONG ring_overflows;  /* datagrams not printed because the ring was full */
+pthread_t writer_thread_id;
+
+/* Capture (-w): the receive thread appends pcap records to one of
+ * CAP_NUM_BUFS large buffers and hands each full one to a capture thread,
+ * which writes it with a single write().  A buffer is also handed off once
+ * it is CAP_FLUSH_NS old, or when the file is to be rotated (new_file is
+ * then set on the next one).  cap_head and cap_tail are free-running
+ * buffer counts, each written by only one thread. */
+#define CAP_BUF_SIZE (4 * 1024 * 1024)
+#define CAP_NUM_BUFS 8
+#define CAP_FLUSH_NS 1000000000ull
+#define CAP_SNAPLEN (MAXPDU + 42)
+#define CAP_FILE_HDR_LEN 24
+#define CAP_REC_HDR_LEN 16
+#define CAP_NET_HDR_LEN 42  /* Ethernet, IPv4, UDP */
+struct cap_buf_s {
+	char *data;  /* CAP_BUF_SIZE bytes, page aligned */
+	int len;
+	int new_file;  /* open the next file before writing this buffer */
+	uint64_t start_ns;  /* receive time of the first record */
+};
+struct cap_buf_s cap_bufs[CAP_NUM_BUFS];
+unsigned long long cap_head;  /* written by receive thread */
+unsigned long long cap_tail;  /* written by capture thread */
+int cap_quit;
+int cap_pending_new_file;
+int cap_fd;
+int cap_file_num;  /* of the open file */
+TLONGLONG cap_file_bytes;  /* receive thread's view of the current file */
+uint64_t cap_file_start_ns;
+unsigned short cap_ip_id;
+TLONGLONG cap_num_dgrams;
+TLONGLONG cap_bytes_written;
+TLONGLONG cap_overflows;  /* datagrams not captured because all buffers were full */
+pthread_t cap_thread_id;
+
+int rpt_quit;
+pthread_t rpt_thread_id;
+#endif /* HAVE_ASYNC_OUTPUT */
+
+
+char usage_str[] = "[-a async_ring_size] [-h] [-i interval_ms] [-k] [-o ofile] [-c compact_dump] [-m multi_rcv] [-p pause_ms[/loops]] [-Q Quiet_lvl] [-q] [-r rcvbuf_size] [-s] [-T Timer] [-t] [-v] [-W rotate] [-w capture_file] group port [interface]";
 
 void usage(char *msg)
 {
@@ -124,9 +284,15 @@ void help(char *msg)
 		fprintf(stderr, "\n%s\n\n", msg);
 	fprintf(stderr, "Usage: %s %s\n", prog_name, usage_str);
 	fprintf(stderr, "Where:\n"
+			"  -a async_ring_size : format output on a separate thread, buffering up to\n"
+			"                       'async_ring_size' bytes of datagrams [0: no async]\n"
 			"  -h : help\n"
+			"  -i interval_ms : print rates, sequence counts and drops every 'interval_ms' from\n"
+			"                   a separate thread [0: no interval reports]\n"
+			"  -k : timestamp datagrams when the kernel received them (SO_TIMESTAMPNS, Linux only)\n"
 			"  -o ofile : print results to file (in addition to stdout)\n"
 			"  -c compact_dump : Single-line output of 'compact_dump' max length [0: no compact]\n"
+			"  -m multi_rcv : receive up to 'multi_rcv' datagrams per recvmmsg() call (Linux only) [0: recvfrom()]\n"
 			"  -p pause_ms[/num] : milliseconds to pause after each receive [0: no pause]\n"
 			"                      and number of loops to apply the pause [0: all loops]\n"
 			"  -Q Quiet_lvl : set quiet level [0] :\n"
@@ -137,8 +303,13 @@ void help(char *msg)
 			"  -r rcvbuf_size : size (bytes) of UDP receive buffer (SO_RCVBUF) [4194304]\n"
 			"                   (use 0 for system default buff size)\n"
 			"  -s : stop execution when status msg received\n"
+			"  -T Timer : clock for timestamps: mono, raw, tsc, tscp (qpc on Windows) [mono]\n"
 			"  -t : Use TCP (use '0.0.0.0' for group)\n"
 			"  -v : verify the sequence numbers\n"
+			"  -W rotate : with -w, start a new file every 'rotate' bytes (k, m, g suffixes ok)\n"
+			"              or, with an 's' suffix, every 'rotate' seconds [0: one file]\n"
+			"  -w capture_file : write datagrams to 'capture_file' in pcap format\n"
+			"                    (nanosecond timestamps, synthesized Ethernet/IP/UDP headers)\n"
 			"\n"
 			"  group : multicast address to receive (required, use '0.0.0.0' for unicast)\n"
 			"  port : destination port (required)\n"
@@ -147,6 +318,30 @@ void help(char *msg)
 }  /* help */
 
 
+/* Parse a -W rotation: bytes with optional decimal k/m/g suffix (e.g.
+ * "500m"), or seconds with an 's' suffix (e.g. "60s"). */
+void parse_rotate(const char *str)
+{
+	char *end;
+	double val = strtod(str, &end);
+
+	o_capture_rotate_bytes = 0;
+	o_capture_rotate_sec = 0;
+	if (*end == 's' && end[1] == '\0') {
+		o_capture_rotate_sec = (TLONGLONG)val;
+		return;
+	}
+	if (*end == 'k' || *end == 'K') { val *= 1e3; ++end; }
+	else if (*end == 'm' || *end == 'M') { val *= 1e6; ++end; }
+	else if (*end == 'g' || *end == 'G') { val *= 1e9; ++end; }
+	if (*end != '\0' || val < 0.0) {
+		fprintf(stderr, "Error, invalid rotate '%s'\n", str);
+		exit(1);
+	}
+	o_capture_rotate_bytes = (TLONGLONG)val;
+}  /* parse_rotate */
+
+
 /* faster routine to replace inet_ntoa() (from tcpdump) */
 char *intoa(unsigned int addr)
 {
@@ -179,21 +374,53 @@ char *intoa(unsigned int addr)
 }  /* intoa */
 
 
-/* Return ptr to ascii time string. NOT THREAD SAFE! */
-char *format_time(const struct timeval *in_tv)
+/* Return ptr to ascii time string for a wall-clock time in ns.  The
+ * "HH:MM:SS." prefix is only rebuilt (with localtime()) when the second
+ * changes; otherwise just the microseconds are rewritten.
+ * NOT THREAD SAFE! */
+char *format_time(uint64_t wall_ns)
 {
 	/* Static so that a pointer to it can be returned. */
-	static char buff[sizeof(".xx:xx:xx.xxxxxx")];
-
-	time_t epoch_sec = (time_t)in_tv->tv_sec;
-	struct tm *in_tm = localtime(&epoch_sec);
+	static char buff[sizeof("xx:xx:xx.xxxxxx")];
+	static uint64_t buff_sec;  /* second that the prefix is for */
+	uint64_t sec = wall_ns / 1000000000;
+	int usec = (int)((wall_ns % 1000000000) / 1000);
+	int i;
 
-	snprintf(buff, sizeof(buff), "%02d:%02d:%02d.%06d",
-		in_tm->tm_hour, in_tm->tm_min, in_tm->tm_sec, (int)in_tv->tv_usec);
+	if (sec != buff_sec || buff[0] == '\0') {
+		time_t epoch_sec = (time_t)sec;
+		struct tm *in_tm = localtime(&epoch_sec);
+		snprintf(buff, sizeof(buff), "%02d:%02d:%02d.",
+			in_tm->tm_hour, in_tm->tm_min, in_tm->tm_sec);
+		buff_sec = sec;
+	}
+	for (i = 14; i >= 9; i--) {  /* 6 digits after "xx:xx:xx." */
+		buff[i] = usec % 10 + '0';
+		usec /= 10;
+	}
+	buff[15] = '\0';
 	return buff;
 }  /* format_time */
 
 
+/* Return ptr to "a.b.c.d.port" for a source address, from the cache when
+ * the sender has been seen recently.  NOT THREAD SAFE! */
+char *format_src(const struct sockaddr_in *src)
+{
+	unsigned int addr = src->sin_addr.s_addr;
+	unsigned short port = src->sin_port;
+	struct src_cache_s *entry;
+
+	entry = &src_cache[((addr ^ port) * 2654435761u) >> (32 - SRC_CACHE_BITS)];
+	if (entry->addr != addr || entry->port != port || entry->str[0] == '\0') {
+		entry->addr = addr;
+		entry->port = port;
+		snprintf(entry->str, sizeof(entry->str), "%s.%d", intoa(addr), ntohs(port));
+	}
+	return entry->str;
+}  /* format_src */
+
+
 void dump(FILE *ofile, const char *buffer, int size)
 {
 	int i,j;
@@ -219,7 +446,7 @@ void dump(FILE *ofile, const char *buffer, int size)
 		textver[i] = ' ';
 	}
 	textver[i] = 0;
-	fprintf(ofile, "\t%s\n",textver); fflush(ofile);
+	fprintf(ofile, "\t%s\n",textver);
 }  /* dump */
 
 
@@ -257,17 +484,888 @@ char *dump_compact(const char *buffer, int size)
 }  /* dump */
 
 
-void currenttv(struct timeval *tv)
+/* Print one datagram according to the quiet level.  When 'flush' is zero
+ * the caller is responsible for flushing the output streams. */
+void print_datagram(uint64_t rcv_ns, const struct sockaddr_in *src,
+		const char *buff, int cur_size, int flush)
 {
-#if defined(_WIN32)
-	struct _timeb tb;
-	_ftime(&tb);
-	tv->tv_sec = (long)tb.time;
-	tv->tv_usec = 1000*tb.millitm;
-#else
-	gettimeofday(tv,NULL);
-#endif /* _WIN32 */
-}  /* currenttv */
+	char *time_str = format_time(rcv_ns);
+	char *src_str = format_src(src);
+
+	if (o_quiet_lvl == 0) {  /* non-quiet: print full dump */
+		if (o_compact_dump > 0) {
+			char *compact_str = dump_compact(buff, cur_size);
+			printf("%s %s %d bytes: %s\n",
+					time_str, src_str, cur_size, compact_str);
+			if (o_output) {
+				fprintf(o_output, "%s %s %d bytes: %s\n",
+						time_str, src_str, cur_size, compact_str);
+			}
+		} else {  /* not compact */
+			printf("%s %s %d bytes:\n",
+					time_str, src_str, cur_size);
+			dump(stdout, buff, cur_size);
+			if (o_output) {
+				fprintf(o_output, "%s %s %d bytes:\n",
+						time_str, src_str, cur_size);
+				dump(o_output, buff, cur_size);
+			}
+		}
+	}
+	if (o_quiet_lvl == 1) {  /* semi-quiet: print datagram summary */
+		mwire_hdr_t hdr;
+		char hdr_str[120];
+		hdr_str[0] = '\0';
+		if (mwire_decode(buff, cur_size, &hdr) == 0) {
+			snprintf(hdr_str, sizeof(hdr_str), ", %s seq %llu, sender %08x, stream %u",
+					mwire_type_name(hdr.type), (unsigned long long)hdr.seq,
+					hdr.sender_id, hdr.stream_id);
+		}
+		printf("%s %s %d bytes%s\n",  /* no colon */
+				time_str, src_str, cur_size, hdr_str);
+		if (o_output) {
+			fprintf(o_output, "%s %s %d bytes%s\n",  /* no colon */
+					time_str, src_str, cur_size, hdr_str);
+		}
+	}
+
+	if (flush) {
+		fflush(stdout);
+		if (o_output) fflush(o_output);
+	}
+}  /* print_datagram */
+
+
+#if defined(HAVE_ASYNC_OUTPUT)
+/* Receive thread: append a record to the output ring.  Datagrams are
+ * dropped (and counted) if the ring is full; text lines wait for room. */
+void ring_put(int type, uint64_t rcv_ns, const struct sockaddr_in *src,
+		const char *data, int dgram_len)
+{
+	struct ring_rec_s *rec;
+	unsigned long long head, tail;
+	int data_len, rec_len, ofs, wrap_len;
+
+	data_len = dgram_len;
+	if (type == RING_REC_DGRAM) {  /* only copy what will be printed */
+		if (o_quiet_lvl == 1)
+			data_len = 0;
+		else if (o_compact_dump > 0 && data_len > o_compact_dump)
+			data_len = o_compact_dump;
+	}
+	rec_len = RING_ALIGN((int)sizeof(struct ring_rec_s) + data_len + 1);
+
+	head = ring_head;  /* only this thread writes it */
+	ofs = (int)(head % o_async_ring_size);
+	wrap_len = (ofs + rec_len > o_async_ring_size) ? o_async_ring_size - ofs : 0;
+	for (;;) {
+		tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+		if (head + wrap_len + rec_len - tail <= (unsigned long long)o_async_ring_size)
+			break;  /* room */
+		if (type == RING_REC_DGRAM) {
+			ring_overflows++;
+			return;
+		}
+		SLEEP_MSEC(1);
+	}
+
+	if (wrap_len > 0) {
+		rec = (struct ring_rec_s *)&ring_buf[ofs];
+		rec->rec_len = wrap_len;
+		rec->type = RING_REC_WRAP;
+		head += wrap_len;  /* published with the record below */
+		ofs = 0;
+	}
+
+	rec = (struct ring_rec_s *)&ring_buf[ofs];
+	rec->rec_len = rec_len;
+	rec->type = type;
+	rec->rcv_ns = rcv_ns;
+	if (src) rec->src = *src;
+	rec->dgram_len = dgram_len;
+	rec->data_len = data_len;
+	memcpy((char *)rec + sizeof(struct ring_rec_s), data, data_len);
+	((char *)rec)[sizeof(struct ring_rec_s) + data_len] = '\0';
+
+	__atomic_store_n(&ring_head, head + rec_len, __ATOMIC_RELEASE);
+}  /* ring_put */
+
+
+/* Writer thread: drain the output ring.  Output is flushed only when the
+ * ring runs empty, not per line. */
+void *writer_thread(void *arg)
+{
+	struct ring_rec_s *rec;
+	unsigned long long head, tail;
+	int unflushed = 0;
+
+	tail = 0;
+	for (;;) {
+		head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			if (unflushed) {
+				fflush(stdout);
+				if (o_output) fflush(o_output);
+				unflushed = 0;
+			}
+			if (__atomic_load_n(&ring_quit, __ATOMIC_ACQUIRE)
+					&& __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE) == tail)
+				break;
+			SLEEP_MSEC(1);
+			continue;
+		}
+
+		while (tail != head) {
+			rec = (struct ring_rec_s *)&ring_buf[tail % o_async_ring_size];
+			if (rec->type == RING_REC_DGRAM) {
+				print_datagram(rec->rcv_ns, &rec->src,
+						(char *)rec + sizeof(struct ring_rec_s), rec->dgram_len, 0);
+			}
+			else if (rec->type == RING_REC_TEXT) {
+				printf("%s\n", (char *)rec + sizeof(struct ring_rec_s));
+				if (o_output) fprintf(o_output, "%s\n", (char *)rec + sizeof(struct ring_rec_s));
+			}
+			tail += rec->rec_len;
+			__atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+		}
+		unflushed = 1;
+	}
+
+	return NULL;
+}  /* writer_thread */
+
+
+/* Wait for the writer thread to drain the ring and exit. */
+void writer_finish(void)
+{
+	__atomic_store_n(&ring_quit, 1, __ATOMIC_RELEASE);
+	pthread_join(writer_thread_id, NULL);
+	if (ring_overflows > 0) {
+		printf("%.0f datagrams not printed (async ring full)\n", (double)ring_overflows);
+		fflush(stdout);
+		if (o_output) {
+			fprintf(o_output, "%.0f datagrams not printed (async ring full)\n", (double)ring_overflows);
+			fflush(o_output);
+		}
+	}
+}  /* writer_finish */
+
+
+/* Name of capture file 'num': with -W, ".num" goes before the extension
+ * ("cap.pcap" -> "cap.3.pcap"). */
+void cap_file_name(char *name, int name_size, int num)
+{
+	char *ext = strrchr(o_capture_file, '.');
+
+	if (o_capture_rotate_bytes == 0 && o_capture_rotate_sec == 0)
+		snprintf(name, name_size, "%s", o_capture_file);
+	else if (ext == NULL || strchr(ext, '/') != NULL)
+		snprintf(name, name_size, "%s.%d", o_capture_file, num);
+	else
+		snprintf(name, name_size, "%.*s.%d%s", (int)(ext - o_capture_file), o_capture_file, num, ext);
+}  /* cap_file_name */
+
+
+void cap_write(const char *data, int len)
+{
+	int n;
+
+	while (len > 0) {
+		n = (int)write(cap_fd, data, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "ERROR: ");  perror("write capture file");
+			exit(1);
+		}
+		data += n;
+		len -= n;
+		cap_bytes_written += n;
+	}
+}  /* cap_write */
+
+
+/* Open capture file 'num' and write the pcap file header. */
+void cap_open_file(int num)
+{
+	char name[1100];
+	unsigned char hdr[CAP_FILE_HDR_LEN];
+	uint32_t u32;
+	uint16_t u16;
+
+	if (cap_fd != -1)
+		close(cap_fd);
+	cap_file_name(name, sizeof(name), num);
+	cap_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (cap_fd == -1) {
+		fprintf(stderr, "ERROR: open %s: ", name);  perror("");
+		exit(1);
+	}
+	cap_file_num = num;
+
+	/* Host byte order; the nanosecond magic number tells readers which. */
+	u32 = 0xa1b23c4d;  memcpy(&hdr[0], &u32, 4);
+	u16 = 2;  memcpy(&hdr[4], &u16, 2);  /* version 2.4 */
+	u16 = 4;  memcpy(&hdr[6], &u16, 2);
+	u32 = 0;  memcpy(&hdr[8], &u32, 4);  /* thiszone */
+	u32 = 0;  memcpy(&hdr[12], &u32, 4);  /* sigfigs */
+	u32 = CAP_SNAPLEN;  memcpy(&hdr[16], &u32, 4);
+	u32 = 1;  memcpy(&hdr[20], &u32, 4);  /* LINKTYPE_ETHERNET */
+	cap_write((char *)hdr, sizeof(hdr));
+}  /* cap_open_file */
+
+
+/* Capture thread: write each buffer the receive thread hands off. */
+void *cap_thread(void *arg)
+{
+	struct cap_buf_s *buf;
+	unsigned long long head, tail;
+
+	tail = 0;
+	for (;;) {
+		head = __atomic_load_n(&cap_head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			if (__atomic_load_n(&cap_quit, __ATOMIC_ACQUIRE)
+					&& __atomic_load_n(&cap_head, __ATOMIC_ACQUIRE) == tail)
+				break;
+			SLEEP_MSEC(1);
+			continue;
+		}
+
+		while (tail != head) {
+			buf = &cap_bufs[tail % CAP_NUM_BUFS];
+			if (buf->new_file)
+				cap_open_file(cap_file_num + 1);
+			cap_write(buf->data, buf->len);
+			buf->len = 0;
+			buf->new_file = 0;
+			tail++;
+			__atomic_store_n(&cap_tail, tail, __ATOMIC_RELEASE);
+		}
+	}
+
+	return NULL;
+}  /* cap_thread */
+
+
+/* Receive thread: the buffer being filled, or NULL if the capture thread
+ * has all of them. */
+struct cap_buf_s *cap_cur_buf(void)
+{
+	if (cap_head - __atomic_load_n(&cap_tail, __ATOMIC_ACQUIRE) >= CAP_NUM_BUFS)
+		return NULL;
+	return &cap_bufs[cap_head % CAP_NUM_BUFS];
+}  /* cap_cur_buf */
+
+
+/* Receive thread: give the buffer being filled to the capture thread. */
+void cap_handoff(void)
+{
+	__atomic_store_n(&cap_head, cap_head + 1, __ATOMIC_RELEASE);
+}  /* cap_handoff */
+
+
+/* Internet checksum of an IPv4 header. */
+uint16_t cap_ip_cksum(const unsigned char *hdr, int len)
+{
+	uint32_t sum = 0;
+	int i;
+
+	for (i = 0; i < len; i += 2)
+		sum += (hdr[i] << 8) | hdr[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}  /* cap_ip_cksum */
+
+
+/* Receive thread: append one datagram as a pcap record, with Ethernet,
+ * IPv4 and UDP headers made up from the addresses it was received on. */
+void cap_put(const char *data, int dgram_len, const struct sockaddr_in *src, uint64_t rcv_ns)
+{
+	struct cap_buf_s *buf;
+	int rec_len = CAP_REC_HDR_LEN + CAP_NET_HDR_LEN + dgram_len;
+	unsigned char *rec;
+	unsigned char *eth, *ip, *udp;
+	uint32_t u32;
+	unsigned long dst_addr;
+	uint16_t cksum;
+
+	if (cap_file_start_ns == 0)
+		cap_file_start_ns = rcv_ns;
+	if ((o_capture_rotate_bytes > 0 && cap_file_bytes > CAP_FILE_HDR_LEN
+				&& cap_file_bytes + rec_len > o_capture_rotate_bytes)
+			|| (o_capture_rotate_sec > 0
+				&& rcv_ns - cap_file_start_ns >= (uint64_t)o_capture_rotate_sec * 1000000000)) {
+		/* Records up to here go in the current file. */
+		buf = cap_cur_buf();
+		if (buf != NULL && buf->len > 0)
+			cap_handoff();
+		cap_pending_new_file = 1;
+		cap_file_bytes = CAP_FILE_HDR_LEN;
+		cap_file_start_ns = rcv_ns;
+	}
+
+	buf = cap_cur_buf();
+	if (buf != NULL && buf->len + rec_len > CAP_BUF_SIZE) {
+		cap_handoff();
+		buf = cap_cur_buf();
+	}
+	if (buf == NULL) {
+		cap_overflows++;
+		return;
+	}
+	if (buf->len == 0) {
+		buf->new_file = cap_pending_new_file;
+		cap_pending_new_file = 0;
+		buf->start_ns = rcv_ns;
+	}
+
+	rec = (unsigned char *)&buf->data[buf->len];
+	u32 = (uint32_t)(rcv_ns / 1000000000);  memcpy(&rec[0], &u32, 4);
+	u32 = (uint32_t)(rcv_ns % 1000000000);  memcpy(&rec[4], &u32, 4);
+	u32 = CAP_NET_HDR_LEN + dgram_len;  memcpy(&rec[8], &u32, 4);  /* incl_len */
+	memcpy(&rec[12], &u32, 4);  /* orig_len */
+
+	dst_addr = ntohl(groupaddr);
+	if (dst_addr == 0 && bind_if != NULL)
+		dst_addr = ntohl(inet_addr(bind_if));
+	eth = &rec[CAP_REC_HDR_LEN];
+	memset(eth, 0, 12);
+	if ((dst_addr >> 28) == 0xe) {  /* multicast MAC */
+		eth[0] = 0x01;  eth[1] = 0x00;  eth[2] = 0x5e;
+		eth[3] = (dst_addr >> 16) & 0x7f;  eth[4] = (dst_addr >> 8) & 0xff;  eth[5] = dst_addr & 0xff;
+	}
+	eth[12] = 0x08;  eth[13] = 0x00;  /* IPv4 */
+
+	ip = &eth[14];
+	ip[0] = 0x45;  ip[1] = 0;
+	ip[2] = (unsigned char)((20 + 8 + dgram_len) >> 8);  ip[3] = (unsigned char)(20 + 8 + dgram_len);
+	ip[4] = (unsigned char)(cap_ip_id >> 8);  ip[5] = (unsigned char)cap_ip_id;
+	cap_ip_id++;
+	ip[6] = 0;  ip[7] = 0;
+	ip[8] = 64;  ip[9] = 17;  /* ttl, UDP */
+	ip[10] = 0;  ip[11] = 0;
+	memcpy(&ip[12], &src->sin_addr.s_addr, 4);
+	u32 = htonl((uint32_t)dst_addr);  memcpy(&ip[16], &u32, 4);
+	cksum = cap_ip_cksum(ip, 20);
+	ip[10] = (unsigned char)(cksum >> 8);  ip[11] = (unsigned char)cksum;
+
+	udp = &ip[20];
+	memcpy(&udp[0], &src->sin_port, 2);
+	udp[2] = (unsigned char)(groupport >> 8);  udp[3] = (unsigned char)groupport;
+	udp[4] = (unsigned char)((8 + dgram_len) >> 8);  udp[5] = (unsigned char)(8 + dgram_len);
+	udp[6] = 0;  udp[7] = 0;  /* no checksum */
+	memcpy(&udp[8], data, dgram_len);
+
+	buf->len += rec_len;
+	cap_file_bytes += rec_len;
+	cap_num_dgrams++;
+	if (rcv_ns - buf->start_ns >= CAP_FLUSH_NS)
+		cap_handoff();
+}  /* cap_put */
+
+
+/* Hand off what is buffered, wait for the capture thread to write it, and
+ * report. */
+void cap_finish(void)
+{
+	struct cap_buf_s *buf = cap_cur_buf();
+	char line[256];
+
+	if (buf != NULL && buf->len > 0)
+		cap_handoff();
+	__atomic_store_n(&cap_quit, 1, __ATOMIC_RELEASE);
+	pthread_join(cap_thread_id, NULL);
+	close(cap_fd);
+
+	snprintf(line, sizeof(line), "Captured %.0f datagrams (%.0f bytes) in %d file(s), %.0f not captured (capture buffers full)",
+			(double)cap_num_dgrams, (double)cap_bytes_written, cap_file_num + 1, (double)cap_overflows);
+	printf("%s\n", line);  fflush(stdout);
+	if (o_output) { fprintf(o_output, "%s\n", line);  fflush(o_output); }
+}  /* cap_finish */
+#endif /* HAVE_ASYNC_OUTPUT */
+
+
+/* Print a line of text to stdout and the output file (in order with any
+ * datagrams still queued for the writer thread). */
+void out_line(const char *line)
+{
+#if defined(HAVE_ASYNC_OUTPUT)
+	if (o_async_ring_size > 0) {
+		ring_put(RING_REC_TEXT, 0, NULL, line, (int)strlen(line));
+		return;
+	}
+#endif
+	printf("%s\n", line); fflush(stdout);
+	if (o_output) { fprintf(o_output, "%s\n", line); fflush(o_output); }
+}  /* out_line */
+
+
+/* Find or add the entry for a source. */
+struct source_s *source_lookup(const struct sockaddr_in *src, uint32_t sender_id)
+{
+	unsigned int addr = src->sin_addr.s_addr;
+	unsigned short port = src->sin_port;
+	struct source_s *source = source_last;
+	unsigned int i;
+
+	if (source != NULL && source->addr == addr && source->port == port && source->sender_id == sender_id)
+		return source;  /* usually a run of datagrams from one sender */
+
+	i = ((addr ^ ((unsigned int)port << 16) ^ sender_id) * 2654435761u) >> (32 - SOURCE_TABLE_BITS);
+	for (;;) {
+		source = &source_table[i];
+		if (! source->used)
+			break;
+		if (source->addr == addr && source->port == port && source->sender_id == sender_id) {
+			source_last = source;
+			return source;
+		}
+		i = (i + 1) & (SOURCE_TABLE_SIZE - 1);
+	}
+
+	/* New source. */
+	if (source_table_num >= SOURCE_TABLE_MAX) {
+		source_other.used = 1;
+		return &source_other;
+	}
+	source->seq = (mseq_t *)malloc(2 * sizeof(mseq_t));
+	if (source->seq == NULL) { fprintf(stderr, "malloc failed\n"); exit(1); }
+	mseq_init(&source->seq[0]);
+	mseq_init(&source->seq[1]);
+	source->addr = addr;
+	source->port = port;
+	source->sender_id = sender_id;
+	source->used = 1;
+	source_table_num++;
+	source_last = source;
+	return source;
+}  /* source_lookup */
+
+
+/* "a.b.c.d.port" (plus the sender ID, if any) without static buffers, so
+ * that the receive thread can use it while the writer thread formats. */
+char *source_name(const struct source_s *source, char *buf, int buf_size)
+{
+	const unsigned char *a = (const unsigned char *)&source->addr;
+
+	if (source == &source_other)
+		snprintf(buf, buf_size, "(other sources)");
+	else if (source->sender_id != 0)
+		snprintf(buf, buf_size, "%u.%u.%u.%u.%u sender %08x", a[0], a[1], a[2], a[3],
+				ntohs(source->port), source->sender_id);
+	else
+		snprintf(buf, buf_size, "%u.%u.%u.%u.%u", a[0], a[1], a[2], a[3], ntohs(source->port));
+	return buf;
+}  /* source_name */
+
+
+/* Start a new test run for a source ('stat' or 'echo' received). */
+void source_reset(struct source_s *source)
+{
+	if (source->seq != NULL) {
+		mseq_merge(&source->seq[1], &source->seq[0]);
+		mseq_init(&source->seq[0]);
+	}
+	source->num_rcvd = 0;
+	source->cur_seq = 0;
+	num_rcvd = 0;
+}  /* source_reset */
+
+
+/* Reset every source with the given address and port (an 'echo' carries
+ * no sender ID). */
+void source_reset_addr(const struct sockaddr_in *src)
+{
+	int i;
+
+	for (i = 0; i < SOURCE_TABLE_SIZE; ++i) {
+		if (source_table[i].used && source_table[i].addr == src->sin_addr.s_addr
+				&& source_table[i].port == src->sin_port)
+			source_reset(&source_table[i]);
+	}
+	num_rcvd = 0;
+}  /* source_reset_addr */
+
+
+/* When sender tells us to, calc and print stats. */
+void stat_received(struct source_s *source, uint64_t num_sent)
+{
+	char line[256];
+	char name[64];
+	double perc_loss;
+
+	/* In double, so that receiving more than was sent (dups) gives negative loss. */
+	perc_loss = ((double)num_sent - (double)source->num_rcvd) * 100.0 / (double)num_sent;
+	snprintf(line, sizeof(line), "%llu msgs sent, %llu received (not including 'stat') from %s",
+			(unsigned long long)num_sent, (unsigned long long)source->num_rcvd,
+			source_name(source, name, sizeof(name)));
+	out_line(line);
+	snprintf(line, sizeof(line), "%f%% loss", perc_loss);
+	out_line(line);
+
+	if (o_stop)
+		stop = 1;
+
+	source->num_stats++;
+	source_reset(source);
+}  /* stat_received */
+
+
+/* Count a data message; 'seq_text' is the sequence number as received
+ * (legacy text messages only, for the verify report).  'seq_tracked' is
+ * zero for messages outside the data sequence (e.g. msnd warmups). */
+void data_received(struct source_s *source, TLONGLONG seq, const char *seq_text, int seq_tracked)
+{
+	char line[256];
+
+	if (o_pause_ms > 0 && ( (o_pause_num > 0 && num_rcvd < (uint64_t)o_pause_num)
+							|| (o_pause_num == 0) )) {
+		SLEEP_MSEC(o_pause_ms);
+	}
+
+	if (o_verify) {
+		if (source->cur_seq != seq) {
+			if (seq_text != NULL)
+				snprintf(line, sizeof(line), "Expected seq %llx (hex), got %s", (unsigned long long)source->cur_seq, seq_text);
+			else
+				snprintf(line, sizeof(line), "Expected seq %llx (hex), got %llx", (unsigned long long)source->cur_seq, (unsigned long long)seq);
+			out_line(line);
+			/* resyncronize sequence numbers in case there is loss */
+			source->cur_seq = seq;
+		}
+	}
+	if (seq_tracked && source->seq != NULL) {
+		switch (mseq_record(&source->seq[0], (uint64_t)seq)) {
+		  case MSEQ_GAP: rpt_totals.num_gaps++;  break;
+		  case MSEQ_LATE: rpt_totals.num_late++;  break;
+		  case MSEQ_DUP: rpt_totals.num_dups++;  break;
+		}
+	}
+
+	++num_rcvd;
+	++source->num_rcvd;
+	++source->num_msgs;
+	++source->cur_seq;
+}  /* data_received */
+
+
+/* Print where datagrams were lost: dropped by the socket (its receive
+ * buffer was full), by the host (counters shared by all sockets), or
+ * missing from the sources' sequence numbers as the application saw it. */
+void print_drops(FILE *ofile, const mdrops_t *drops_end)
+{
+	mseq_t seq;
+	char drops_desc[200];
+	int i;
+
+	mseq_init(&seq);
+	for (i = 0; i < SOURCE_TABLE_SIZE; ++i) {
+		if (source_table[i].used && source_table[i].seq != NULL) {
+			mseq_merge(&seq, &source_table[i].seq[1]);
+			mseq_merge(&seq, &source_table[i].seq[0]);
+		}
+	}
+	fprintf(ofile, "Drops: socket %lu (SO_RXQ_OVFL), host %s, application %.0f msgs missing from sequence\n",
+			(unsigned long)sock_drops, mdrops_describe(&drops_start, drops_end, drops_desc, sizeof(drops_desc)),
+			(double)seq.num_lost);
+	fflush(ofile);
+}  /* print_drops */
+
+
+/* Print the per-source summary table (after the writer thread is done). */
+void print_sources(FILE *ofile)
+{
+	struct source_s *source;
+	mseq_t seq;
+	char name[64];
+	char first[32];
+	int i;
+
+	if (source_table_num == 0)
+		return;
+	fprintf(ofile, "%-36s %10s %12s %8s %10s %8s %8s %10s %6s %-15s %s\n",
+			"Source", "Msgs", "Bytes", "Gaps", "Gap msgs", "Late", "Dups", "Lost", "Stats", "First", "Last");
+	for (i = 0; i <= SOURCE_TABLE_SIZE; ++i) {
+		source = (i < SOURCE_TABLE_SIZE) ? &source_table[i] : &source_other;
+		if (! source->used)
+			continue;
+		mseq_init(&seq);
+		if (source->seq != NULL) {
+			mseq_merge(&seq, &source->seq[1]);
+			mseq_merge(&seq, &source->seq[0]);
+		}
+		snprintf(first, sizeof(first), "%s", format_time(source->first_ns));
+		fprintf(ofile, "%-36s %10.0f %12.0f %8.0f %10.0f %8.0f %8.0f %10.0f %6.0f %-15s %s\n",
+				source_name(source, name, sizeof(name)),
+				(double)source->num_msgs, (double)source->num_bytes,
+				(double)seq.num_gaps, (double)seq.num_gap_msgs, (double)seq.num_late,
+				(double)seq.num_dups, (double)seq.num_lost, (double)source->num_stats,
+				first, format_time(source->last_ns));
+	}
+	fflush(ofile);
+}  /* print_sources */
+
+
+#if defined(HAVE_ASYNC_OUTPUT)
+/* Receive thread: make the running totals visible to the reporter. */
+void rpt_publish(void)
+{
+	__atomic_store_n(&rpt_pub.num_dgrams, rpt_totals.num_dgrams, __ATOMIC_RELAXED);
+	__atomic_store_n(&rpt_pub.num_bytes, rpt_totals.num_bytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&rpt_pub.num_gaps, rpt_totals.num_gaps, __ATOMIC_RELAXED);
+	__atomic_store_n(&rpt_pub.num_late, rpt_totals.num_late, __ATOMIC_RELAXED);
+	__atomic_store_n(&rpt_pub.num_dups, rpt_totals.num_dups, __ATOMIC_RELAXED);
+	__atomic_store_n(&rpt_pub.num_sock_drops, (TLONGLONG)sock_drops, __ATOMIC_RELAXED);
+}  /* rpt_publish */
+
+
+/* Reporter thread (-i): print the change in the published totals and
+ * the host drop counters every interval, stamped with the time of day.
+ * It prints directly (not through the async ring, which only the receive
+ * thread may write). */
+void *rpt_thread(void *arg)
+{
+	struct rpt_counts_s prev, cur;
+	mdrops_t prev_drops, cur_drops;
+	uint64_t prev_ns, now_ns, next_ns, interval_ns, nap_ns;
+	uint64_t wall_ns;
+	time_t wall_sec;
+	struct tm wall_tm;
+	double secs;
+	char drops_desc[200];
+	char line[512];
+
+	interval_ns = (uint64_t)o_interval_ms * 1000000;
+	memset((char *)&prev, 0, sizeof(prev));
+	prev_drops = drops_start;
+	prev_ns = mtime_ns();
+	next_ns = prev_ns + interval_ns;
+	while (! __atomic_load_n(&rpt_quit, __ATOMIC_RELAXED)) {
+		now_ns = mtime_ns();
+		if (now_ns < next_ns) {
+			/* Short naps, so that the end of the run is noticed. */
+			nap_ns = next_ns - now_ns;
+			SLEEP_MSEC((nap_ns > 100000000) ? 100 : (int)(nap_ns / 1000000) + 1);
+			continue;
+		}
+		next_ns += interval_ns;
+
+		cur.num_dgrams = __atomic_load_n(&rpt_pub.num_dgrams, __ATOMIC_RELAXED);
+		cur.num_bytes = __atomic_load_n(&rpt_pub.num_bytes, __ATOMIC_RELAXED);
+		cur.num_gaps = __atomic_load_n(&rpt_pub.num_gaps, __ATOMIC_RELAXED);
+		cur.num_late = __atomic_load_n(&rpt_pub.num_late, __ATOMIC_RELAXED);
+		cur.num_dups = __atomic_load_n(&rpt_pub.num_dups, __ATOMIC_RELAXED);
+		cur.num_sock_drops = __atomic_load_n(&rpt_pub.num_sock_drops, __ATOMIC_RELAXED);
+		mdrops_sample(&cur_drops);
+
+		wall_ns = now_ns + mtime_wall_offset_ns;
+		wall_sec = (time_t)(wall_ns / 1000000000);
+		localtime_r(&wall_sec, &wall_tm);
+		secs = (double)(now_ns - prev_ns) / 1000000000.0;
+		snprintf(line, sizeof(line), "%02d:%02d:%02d.%03d interval: %.0f msgs/sec, %.0f payload bits/sec, %.0f gaps, %.0f late, %.0f dups, %.0f socket drops, host %s",
+				wall_tm.tm_hour, wall_tm.tm_min, wall_tm.tm_sec, (int)((wall_ns % 1000000000) / 1000000),
+				(double)(cur.num_dgrams - prev.num_dgrams) / secs,
+				(double)(cur.num_bytes - prev.num_bytes) * 8.0 / secs,
+				(double)(cur.num_gaps - prev.num_gaps), (double)(cur.num_late - prev.num_late),
+				(double)(cur.num_dups - prev.num_dups), (double)(cur.num_sock_drops - prev.num_sock_drops),
+				mdrops_describe(&prev_drops, &cur_drops, drops_desc, sizeof(drops_desc)));
+		printf("%s\n", line);  fflush(stdout);
+		if (o_output) { fprintf(o_output, "%s\n", line);  fflush(o_output); }
+		prev = cur;
+		prev_drops = cur_drops;
+		prev_ns = now_ns;
+	}
+
+	return NULL;
+}  /* rpt_thread */
+#endif /* HAVE_ASYNC_OUTPUT */
+
+
+/* Print, verify, and account for one received datagram.
+ * 'rcv_ns' is the kernel receive time (-k), or 0 to read the -T clock. */
+void process_datagram(char *buff, int cur_size, struct sockaddr_in *src, uint64_t rcv_ns)
+{
+	mwire_hdr_t hdr;
+	int is_binary;
+	struct source_s *source;
+
+	if (rcv_ns == 0)
+		rcv_ns = mtime_wall_ns();
+#if defined(HAVE_ASYNC_OUTPUT)
+	if (o_capture_file != NULL)
+		cap_put(buff, cur_size, src, rcv_ns);
+#endif
+	if (o_quiet_lvl < 2) {
+#if defined(HAVE_ASYNC_OUTPUT)
+		if (o_async_ring_size > 0)
+			ring_put(RING_REC_DGRAM, rcv_ns, src, buff, cur_size);
+		else
+#endif
+			print_datagram(rcv_ns, src, buff, cur_size, 1);
+	}
+
+	is_binary = (mwire_decode(buff, cur_size, &hdr) == 0);
+	if (is_binary || cur_size <= 5 || memcmp(buff, "echo ", 5) != 0) {
+		source = source_lookup(src, is_binary ? hdr.sender_id : 0);
+		if (source->num_bytes == 0)
+			source->first_ns = rcv_ns;
+		source->last_ns = rcv_ns;
+		source->num_bytes += cur_size;
+	}
+
+	if (is_binary) {
+		/* binary header */
+		if (hdr.type == MWIRE_TYPE_STAT)
+			stat_received(source, hdr.seq);
+		else
+			data_received(source, (TLONGLONG)hdr.seq, NULL, hdr.type == MWIRE_TYPE_DATA);
+	}
+	else if (cur_size > 5 && memcmp(buff, "echo ", 5) == 0) {
+		/* echo command */
+		buff[cur_size] = '\0';  /* guarantee trailing null */
+		if (buff[cur_size - 1] == '\n')
+			buff[cur_size - 1] = '\0';  /* strip trailing nl */
+		out_line(buff);
+
+		/* reset stats of the sender, whatever its sender ID */
+		source_reset_addr(src);
+	}
+	else if (cur_size > 5 && memcmp(buff, "stat ", 5) == 0) {
+		/* legacy text 'stat' message contains num msgs sent */
+		buff[cur_size] = '\0';  /* guarantee trailing null */
+		stat_received(source, strtoull(&buff[5], NULL, 10));
+	}
+	else {  /* not a cmd; legacy text "Message <hex seq>", or foreign traffic */
+		buff[cur_size] = '\0';  /* guarantee trailing null */
+		data_received(source, (cur_size > 8) ? strtol(&buff[8], NULL, 16) : -1, &buff[8],
+				cur_size > 8 && memcmp(buff, "Message ", 8) == 0);
+	}
+
+	rpt_totals.num_dgrams++;
+	rpt_totals.num_bytes += cur_size;
+#if defined(HAVE_ASYNC_OUTPUT)
+	if (o_interval_ms > 0)
+		rpt_publish();
+#endif
+}  /* process_datagram */
+
+
+#if defined(HAVE_RXQ_OVFL)
+/* Read a datagram's control messages: note the socket's drop count
+ * (SO_RXQ_OVFL, only present once something was dropped) and return the
+ * kernel receive time (SO_TIMESTAMPNS), or 0 if there is none. */
+uint64_t parse_cmsgs(struct msghdr *hdr)
+{
+	struct cmsghdr *cmsg;
+	uint64_t rcv_ns = 0;
+
+	for (cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+		if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			rcv_ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+		}
+		else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(&sock_drops, CMSG_DATA(cmsg), sizeof(sock_drops));
+		}
+	}
+	if (o_kernel_ts && rcv_ns == 0)
+		num_no_kernel_ts++;
+	return rcv_ns;
+}  /* parse_cmsgs */
+#endif /* HAVE_RXQ_OVFL */
+
+
+#if defined(HAVE_RECVMMSG)
+/* Receive datagrams in batches with recvmmsg() until stopped. */
+void multi_rcv_loop(SOCKET sock)
+{
+	struct mmsghdr *msgs;
+	struct iovec *iovecs;
+	struct sockaddr_in *src_addrs;
+	char *buffs;
+	char *ctl_bufs;
+	int n_dgrams, i;
+
+	/* One extra byte per buffer for trailing null (if needed). */
+	msgs = (struct mmsghdr *)malloc(o_multi_rcv * sizeof(*msgs));
+	iovecs = (struct iovec *)malloc(o_multi_rcv * sizeof(*iovecs));
+	src_addrs = (struct sockaddr_in *)malloc(o_multi_rcv * sizeof(*src_addrs));
+	buffs = (char *)malloc((size_t)o_multi_rcv * (MAXPDU + 1));
+	batch_hist = (TLONGLONG *)malloc((o_multi_rcv + 1) * sizeof(*batch_hist));
+	if (msgs == NULL || iovecs == NULL || src_addrs == NULL || buffs == NULL || batch_hist == NULL) {
+		fprintf(stderr, "malloc failed\n"); exit(1);
+	}
+	memset(batch_hist, 0, (o_multi_rcv + 1) * sizeof(*batch_hist));
+	ctl_bufs = (char *)malloc((size_t)o_multi_rcv * CTL_BUF_SIZE);
+	if (ctl_bufs == NULL) { fprintf(stderr, "malloc failed\n"); exit(1); }
+
+	for (i = 0; i < o_multi_rcv; ++i) {
+		iovecs[i].iov_base = &buffs[i * (MAXPDU + 1)];
+		iovecs[i].iov_len = MAXPDU;
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &src_addrs[i];
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = &ctl_bufs[i * CTL_BUF_SIZE];
+	}
+
+	while (! stop) {
+		/* msg_namelen and msg_controllen are value-result; reset them each call. */
+		for (i = 0; i < o_multi_rcv; ++i) {
+			msgs[i].msg_hdr.msg_namelen = sizeof(src_addrs[i]);
+			msgs[i].msg_hdr.msg_controllen = CTL_BUF_SIZE;
+		}
+
+		n_dgrams = recvmmsg(sock, msgs, o_multi_rcv, MSG_WAITFORONE, NULL);
+		if (n_dgrams == SOCKET_ERROR) {
+			if (ERRNO == EINTR)
+				continue;
+			fprintf(stderr, "ERROR: ");  perror("recvmmsg");
+			exit(1);
+		}
+		batch_hist[n_dgrams]++;
+
+		for (i = 0; i < n_dgrams && ! stop; ++i) {
+			process_datagram(&buffs[i * (MAXPDU + 1)], (int)msgs[i].msg_len, &src_addrs[i],
+					parse_cmsgs(&msgs[i].msg_hdr));
+		}
+	}  /* while ! stop */
+}  /* multi_rcv_loop */
+
+
+/* Print the distribution of datagrams returned per recvmmsg() call. */
+void print_batch_hist(FILE *ofile)
+{
+	TLONGLONG num_calls = 0, num_dgrams = 0;
+	int i;
+
+	for (i = 0; i <= o_multi_rcv; ++i) {
+		num_calls += batch_hist[i];
+		num_dgrams += batch_hist[i] * i;
+	}
+	fprintf(ofile, "recvmmsg batch sizes: %.0f calls, %.0f dgrams, %.2f dgrams/call\n",
+			(double)num_calls, (double)num_dgrams,
+			(num_calls > 0) ? (double)num_dgrams / (double)num_calls : 0.0);
+	for (i = 0; i <= o_multi_rcv; ++i) {
+		if (batch_hist[i] > 0)
+			fprintf(ofile, "  %5d dgrams: %.0f calls\n", i, (double)batch_hist[i]);
+	}
+	fflush(ofile);
+}  /* print_batch_hist */
+#endif /* HAVE_RECVMMSG */
+
+
+#if !defined(_WIN32)
+void handle_signal(int sig)
+{
+	stop = 1;
+}  /* handle_signal */
+#endif /* !_WIN32 */
 
 
 int main(int argc, char **argv)
@@ -280,15 +1378,17 @@ int main(int argc, char **argv)
 	SOCKET sock;
 	socklen_t fromlen = sizeof(struct sockaddr_in);
 	int default_rcvbuf_sz, cur_size, sz;
-	int num_rcvd;
 	struct sockaddr_in name;
 	struct sockaddr_in src;
 	struct ip_mreq imr;
-	struct timeval tv;
-	int num_sent;
-	float perc_loss;
-	int cur_seq;
 	char *pause_slash;
+	uint64_t rcv_ns;
+	int i;
+#if defined(HAVE_RXQ_OVFL)
+	struct msghdr msg;
+	struct iovec iov;
+	char ctl_buf[CTL_BUF_SIZE];
+#endif
 
 	prog_name = argv[0];
 
@@ -305,6 +1405,15 @@ int main(int argc, char **argv)
 	}
 #else
 	signal(SIGPIPE, SIG_IGN);
+	{
+		/* No SA_RESTART, so a blocked receive returns on a signal and the
+		 * exit report can be printed. */
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = handle_signal;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+	}
 #endif /* _WIN32 */
 
 	/* get system default value for socket buffer size */
@@ -321,7 +1430,15 @@ int main(int argc, char **argv)
 	CLOSESOCKET(sock);
 
 	/* default values for options */
+	o_async_ring_size = 0;
+	o_capture_file = NULL;
+	o_capture_rotate_bytes = 0;
+	o_capture_rotate_sec = 0;
+	o_capture_equiv_opt[0] = '\0';
 	o_compact_dump = 0;
+	o_interval_ms = 0;
+	o_kernel_ts = 0;
+	o_multi_rcv = 0;
 	o_quiet_lvl = 0;
 	o_rcvbuf_size = 0x400000;  /* 4MB */
 	o_pause_ms = 0;
@@ -329,20 +1446,62 @@ int main(int argc, char **argv)
 	o_verify = 0;
 	o_stop = 0;
 	o_tcp = 0;
+	o_Timer = NULL;  /* platform default clock */
 	o_output = NULL;
 	o_output_equiv_opt[0] = '\0';
 
 	/* default values for optional positional params */
 	bind_if = NULL;
 
-	while ((opt = tgetopt(argc, argv, "c:hqQ:p:r:o:vst")) != EOF) {
+	while ((opt = tgetopt(argc, argv, "a:c:hi:km:qQ:p:r:o:vsT:tW:w:")) != EOF) {
 		switch (opt) {
 		  case 'h':
 			help(NULL);  exit(0);
 			break;
+		  case 'a':
+			o_async_ring_size = atoi(toptarg);
+#if defined(HAVE_ASYNC_OUTPUT)
+			o_async_ring_size = RING_ALIGN(o_async_ring_size);
+			if (o_async_ring_size > 0 && o_async_ring_size < MIN_ASYNC_RING_SIZE) {
+				fprintf(stderr, "ERROR: async_ring_size must be at least %d\n", MIN_ASYNC_RING_SIZE);
+				exit(1);
+			}
+#else
+			if (o_async_ring_size > 0) {
+				fprintf(stderr, "ERROR: -a not supported on this platform\n");
+				exit(1);
+			}
+#endif
+			break;
 		  case 'c':
 			o_compact_dump = atoi(toptarg);
 			break;
+		  case 'i':
+			o_interval_ms = atoi(toptarg);
+#if !defined(HAVE_ASYNC_OUTPUT)
+			if (o_interval_ms > 0) {
+				fprintf(stderr, "ERROR: -i not supported on this platform\n");
+				exit(1);
+			}
+#endif
+			break;
+		  case 'k':
+#if defined(HAVE_TIMESTAMPNS)
+			o_kernel_ts = 1;
+#else
+			fprintf(stderr, "ERROR: -k not supported on this platform\n");
+			exit(1);
+#endif
+			break;
+		  case 'm':
+			o_multi_rcv = atoi(toptarg);
+#if !defined(HAVE_RECVMMSG)
+			if (o_multi_rcv > 0) {
+				fprintf(stderr, "ERROR: -m not supported on this platform\n");
+				exit(1);
+			}
+#endif
+			break;
 		  case 'q':
 			o_quiet_lvl = 2;
 			break;
@@ -366,6 +1525,9 @@ int main(int argc, char **argv)
 		  case 's':
 			o_stop = 1;
 			break;
+		  case 'T':
+			o_Timer = toptarg;
+			break;
 		  case 't':
 			o_tcp = 1;
 			break;
@@ -381,6 +1543,21 @@ int main(int argc, char **argv)
 			}
 			snprintf(o_output_equiv_opt, sizeof(o_output_equiv_opt), "-o %s ", toptarg);
 			break;
+		  case 'W':
+			parse_rotate(toptarg);
+			break;
+		  case 'w':
+#if defined(HAVE_ASYNC_OUTPUT)
+			if (strlen(toptarg) > 1000) {
+				fprintf(stderr, "ERROR: file name too long (%s)\n", toptarg);
+				exit(1);
+			}
+			o_capture_file = toptarg;
+#else
+			fprintf(stderr, "ERROR: -w not supported on this platform\n");
+			exit(1);
+#endif
+			break;
 		  default:
 			usage("unrecognized option");
 			exit(1);
@@ -388,17 +1565,35 @@ int main(int argc, char **argv)
 		}  /* switch */
 	}  /* while opt */
 
+#if defined(HAVE_ASYNC_OUTPUT)
+	if (o_async_ring_size > 0) {
+		/* The writer thread flushes when idle, so let stdio buffer freely. */
+		setvbuf(stdout, NULL, _IOFBF, 1024*1024);
+		if (o_output) setvbuf(o_output, NULL, _IOFBF, 1024*1024);
+	}
+#endif
+
+	if (o_capture_file != NULL) {
+		if (o_capture_rotate_sec > 0)
+			snprintf(o_capture_equiv_opt, sizeof(o_capture_equiv_opt), "-W %.0fs -w %s ", (double)o_capture_rotate_sec, o_capture_file);
+		else if (o_capture_rotate_bytes > 0)
+			snprintf(o_capture_equiv_opt, sizeof(o_capture_equiv_opt), "-W %.0f -w %s ", (double)o_capture_rotate_bytes, o_capture_file);
+		else
+			snprintf(o_capture_equiv_opt, sizeof(o_capture_equiv_opt), "-w %s ", o_capture_file);
+	}
+
 	num_parms = argc - toptind;
 
 	/* handle positional parameters */
 	if (num_parms == 2) {
 		groupaddr = inet_addr(argv[toptind]);
 		groupport = (unsigned short)atoi(argv[toptind+1]);
-		snprintf(equiv_cmd, sizeof(equiv_cmd), "mdump %s-p%d -Q%d -r%d %s%s%s%s %s",
-				o_output_equiv_opt, o_pause_ms, o_quiet_lvl, o_rcvbuf_size,
+		snprintf(equiv_cmd, sizeof(equiv_cmd), "mdump -a%d -i%d %s%s-m%d -p%d -Q%d -r%d %s%s%s%s%s %s",
+				o_async_ring_size, o_interval_ms, o_kernel_ts ? "-k " : "", o_output_equiv_opt, o_multi_rcv, o_pause_ms, o_quiet_lvl, o_rcvbuf_size,
 				o_stop ? "-s " : "",
 				o_tcp ? "-t " : "",
 				o_verify ? "-v " : "",
+				o_capture_equiv_opt,
 				argv[toptind],argv[toptind+1]);
 		printf("Equiv cmd line: %s\n", equiv_cmd); fflush(stdout);
 		if (o_output) { fprintf(o_output, "Equiv cmd line: %s\n", equiv_cmd); fflush(o_output); }
@@ -406,11 +1601,12 @@ int main(int argc, char **argv)
 		groupaddr = inet_addr(argv[toptind]);
 		groupport = (unsigned short)atoi(argv[toptind+1]);
 		bind_if  = argv[toptind+2];
-		snprintf(equiv_cmd, sizeof(equiv_cmd), "mdump %s-p%d -Q%d -r%d %s%s%s%s %s %s",
-				o_output_equiv_opt, o_pause_ms, o_quiet_lvl, o_rcvbuf_size,
+		snprintf(equiv_cmd, sizeof(equiv_cmd), "mdump -a%d -i%d %s%s-m%d -p%d -Q%d -r%d %s%s%s%s%s %s %s",
+				o_async_ring_size, o_interval_ms, o_kernel_ts ? "-k " : "", o_output_equiv_opt, o_multi_rcv, o_pause_ms, o_quiet_lvl, o_rcvbuf_size,
 				o_stop ? "-s " : "",
 				o_tcp ? "-t " : "",
 				o_verify ? "-v " : "",
+				o_capture_equiv_opt,
 				argv[toptind],argv[toptind+1],argv[toptind+2]);
 		printf("Equiv cmd line: %s\n", equiv_cmd); fflush(stdout);
 		if (o_output) { fprintf(o_output, "Equiv cmd line: %s\n", equiv_cmd); fflush(o_output); }
@@ -419,9 +1615,26 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (mtime_init(o_Timer) != 0)
+		exit(1);
+	printf("Timer: %s\n", mtime_describe(equiv_cmd, sizeof(equiv_cmd))); fflush(stdout);
+	if (o_output) { fprintf(o_output, "Timer: %s\n", equiv_cmd); fflush(o_output); }
+
 	if (o_tcp && groupaddr != inet_addr("0.0.0.0")) {
 		usage("-t incompatible with non-zero multicast group");
 	}
+	if (o_tcp && o_multi_rcv > 0) {
+		usage("-t incompatible with -m");
+		exit(1);
+	}
+	if (o_tcp && o_kernel_ts) {
+		usage("-t incompatible with -k");
+		exit(1);
+	}
+	if (o_tcp && o_capture_file != NULL) {
+		usage("-t incompatible with -w");
+		exit(1);
+	}
 
 	if (o_tcp) {
 		if((listensock = socket(PF_INET,SOCK_STREAM,0)) == INVALID_SOCKET) {
@@ -506,122 +1719,158 @@ int main(int argc, char **argv)
 		}
 	}
 
-	cur_seq = 0;
+#if defined(HAVE_RXQ_OVFL)
+	if (! o_tcp) {
+		opt = 1;
+		if (o_kernel_ts && setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, (char *)&opt, sizeof(opt)) == SOCKET_ERROR) {
+			fprintf(stderr, "ERROR: ");  perror("setsockopt SO_TIMESTAMPNS");
+			exit(1);
+		}
+		if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, (char *)&opt, sizeof(opt)) == SOCKET_ERROR) {
+			fprintf(stderr, "ERROR: ");  perror("setsockopt SO_RXQ_OVFL");
+			exit(1);
+		}
+		memset((char *)&msg, 0, sizeof(msg));
+		msg.msg_name = &src;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = ctl_buf;
+		iov.iov_base = buff;
+		iov.iov_len = 65536;
+	}
+#endif
+
 	num_rcvd = 0;
-	for (;;) {
+	source_table = (struct source_s *)calloc(SOURCE_TABLE_SIZE, sizeof(struct source_s));
+	if (source_table == NULL) { fprintf(stderr, "malloc failed\n"); exit(1); }
+	source_table_num = 0;
+	memset((char *)&source_other, 0, sizeof(source_other));
+	source_last = NULL;
+	memset((char *)&rpt_totals, 0, sizeof(rpt_totals));
+	memset((char *)&rpt_pub, 0, sizeof(rpt_pub));
+	sock_drops = 0;
+	mdrops_sample(&drops_start);
+	num_no_kernel_ts = 0;
+	stop = 0;
+#if defined(HAVE_ASYNC_OUTPUT)
+	if (o_async_ring_size > 0) {
+		ring_buf = (char *)malloc(o_async_ring_size);
+		if (ring_buf == NULL) { fprintf(stderr, "malloc failed\n"); exit(1); }
+		ring_head = 0;
+		ring_tail = 0;
+		ring_quit = 0;
+		ring_overflows = 0;
+		if (pthread_create(&writer_thread_id, NULL, writer_thread, NULL) != 0) {
+			fprintf(stderr, "ERROR: pthread_create failed\n");
+			exit(1);
+		}
+	}
+	if (o_capture_file != NULL) {
+		for (i = 0; i < CAP_NUM_BUFS; ++i) {
+			if (posix_memalign((void **)&cap_bufs[i].data, 4096, CAP_BUF_SIZE) != 0) {
+				fprintf(stderr, "malloc failed\n"); exit(1);
+			}
+			cap_bufs[i].len = 0;
+			cap_bufs[i].new_file = 0;
+		}
+		cap_head = 0;
+		cap_tail = 0;
+		cap_quit = 0;
+		cap_pending_new_file = 0;
+		cap_fd = -1;
+		cap_file_bytes = CAP_FILE_HDR_LEN;
+		cap_file_start_ns = 0;
+		cap_ip_id = 0;
+		cap_num_dgrams = 0;
+		cap_bytes_written = 0;
+		cap_overflows = 0;
+		cap_open_file(0);
+		if (pthread_create(&cap_thread_id, NULL, cap_thread, NULL) != 0) {
+			fprintf(stderr, "ERROR: pthread_create failed\n");
+			exit(1);
+		}
+	}
+	if (o_interval_ms > 0) {
+		rpt_quit = 0;
+		if (pthread_create(&rpt_thread_id, NULL, rpt_thread, NULL) != 0) {
+			fprintf(stderr, "ERROR: pthread_create failed\n");
+			exit(1);
+		}
+	}
+#endif
+#if defined(HAVE_RECVMMSG)
+	if (o_multi_rcv > 0)
+		multi_rcv_loop(sock);
+#endif
+	while (! stop && o_multi_rcv == 0) {
+		rcv_ns = 0;
 		if (o_tcp) {
 			cur_size = recv(sock,buff,65536,0);
 			if (cur_size == 0) {
-				printf("EOF\n");
-				if (o_output) { fprintf(o_output, "EOF\n"); }
+				out_line("EOF");
 				break;
 			}
-		} else {
+		}
+#if defined(HAVE_RXQ_OVFL)
+		else {
+			msg.msg_namelen = sizeof(src);
+			msg.msg_controllen = sizeof(ctl_buf);
+			cur_size = recvmsg(sock, &msg, 0);
+			if (cur_size != SOCKET_ERROR)
+				rcv_ns = parse_cmsgs(&msg);
+		}
+#else
+		else {
 			cur_size = recvfrom(sock,buff,65536,0,
 					(struct sockaddr *)&src,&fromlen);
 		}
+#endif
 		if (cur_size == SOCKET_ERROR) {
+#if !defined(_WIN32)
+			if (ERRNO == EINTR)
+				continue;
+#endif
 			fprintf(stderr, "ERROR: ");  perror("recv");
 			exit(1);
 		}
 
-		if (o_quiet_lvl == 0) {  /* non-quiet: print full dump */
-			currenttv(&tv);
-			if (o_compact_dump > 0) {
-				printf("%s %s.%d %d bytes: %s\n",
-						format_time(&tv), inet_ntoa(src.sin_addr),
-						ntohs(src.sin_port), cur_size,
-						dump_compact(buff, cur_size));
-				fflush(stdout);
-			} else {  /* not compact */
-				printf("%s %s.%d %d bytes:\n",
-						format_time(&tv), inet_ntoa(src.sin_addr),
-						ntohs(src.sin_port), cur_size);
-				dump(stdout, buff, cur_size);
-			}
-			if (o_output) {
-				if (o_compact_dump > 0) {
-					fprintf(o_output, "%s %s.%d %d bytes: %s\n",
-							format_time(&tv), inet_ntoa(src.sin_addr),
-							ntohs(src.sin_port), cur_size,
-							dump_compact(buff, cur_size));
-					fflush(o_output);
-				} else {  /* not compact */
-					printf("%s %s.%d %d bytes:\n",
-							format_time(&tv), inet_ntoa(src.sin_addr),
-							ntohs(src.sin_port), cur_size);
-					dump(o_output, buff, cur_size);
-				}
-			}
-		}
-		if (o_quiet_lvl == 1) {  /* semi-quiet: print datagram summary */
-			currenttv(&tv);
-			printf("%s %s.%d %d bytes\n",  /* no colon */
-					format_time(&tv), inet_ntoa(src.sin_addr),
-					ntohs(src.sin_port), cur_size);
-			fflush(stdout);
-			if (o_output) {
-				fprintf(o_output, "%s %s.%d %d bytes\n",  /* no colon */
-						format_time(&tv), inet_ntoa(src.sin_addr),
-						ntohs(src.sin_port), cur_size);
-				fflush(o_output);
-			}
-		}
-
-		if (cur_size > 5 && memcmp(buff, "echo ", 5) == 0) {
-			/* echo command */
-			buff[cur_size] = '\0';  /* guarantee trailing null */
-			if (buff[cur_size - 1] == '\n')
-				buff[cur_size - 1] = '\0';  /* strip trailing nl */
-			printf("%s\n", buff); fflush(stdout);
-			if (o_output) { fprintf(o_output, "%s\n", buff); fflush(o_output); }
-
-			/* reset stats */
-			num_rcvd = 0;
-			cur_seq = 0;
-		}
-		else if (cur_size > 5 && memcmp(buff, "stat ", 5) == 0) {
-			/* when sender tells us to, calc and print stats */
-			buff[cur_size] = '\0';  /* guarantee trailing null */
-			/* 'stat' message contains num msgs sent */
-			num_sent = atoi(&buff[5]);
-			perc_loss = (float)(num_sent - num_rcvd) * (float)100.0 / (float)num_sent;
-			printf("%d msgs sent, %d received (not including 'stat')\n", num_sent, num_rcvd);
-			printf("%f%% loss\n", perc_loss);
-			fflush(stdout);
-			if (o_output) {
-				fprintf(o_output, "%d msgs sent, %d received (not including 'stat')\n", num_sent, num_rcvd);
-				fprintf(o_output, "%f%% loss\n", perc_loss);
-				fflush(o_output);
-			}
-
-			if (o_stop)
-				exit(0);
-
-			/* reset stats */
-			num_rcvd = 0;
-			cur_seq = 0;
-		}
-		else {  /* not a cmd */
-			if (o_pause_ms > 0 && ( (o_pause_num > 0 && num_rcvd < o_pause_num)
-									|| (o_pause_num == 0) )) {
-				SLEEP_MSEC(o_pause_ms);
-			}
-
-			if (o_verify) {
-				buff[cur_size] = '\0';  /* guarantee trailing null */
-				if (cur_seq != strtol(&buff[8], NULL, 16)) {
-					printf("Expected seq %x (hex), got %s\n", cur_seq, &buff[8]);
-					fflush(stdout);
-					/* resyncronize sequence numbers in case there is loss */
-					cur_seq = strtol(&buff[8], NULL, 16);
-				}
-			}
+		process_datagram(buff, cur_size, &src, rcv_ns);
+		if (stop)
+			break;
+	}  /* while ! stop */
 
-			++num_rcvd;
-			++cur_seq;
+#if defined(HAVE_ASYNC_OUTPUT)
+	if (o_interval_ms > 0) {
+		__atomic_store_n(&rpt_quit, 1, __ATOMIC_RELAXED);
+		pthread_join(rpt_thread_id, NULL);
+	}
+	if (o_async_ring_size > 0)
+		writer_finish();
+	if (o_capture_file != NULL)
+		cap_finish();
+#endif
+	print_sources(stdout);
+	if (o_output) print_sources(o_output);
+	if (! o_tcp) {
+		mdrops_t drops_end;
+		mdrops_sample(&drops_end);
+		print_drops(stdout, &drops_end);
+		if (o_output) print_drops(o_output, &drops_end);
+	}
+#if defined(HAVE_RECVMMSG)
+	if (o_multi_rcv > 0) {
+		print_batch_hist(stdout);
+		if (o_output) print_batch_hist(o_output);
+	}
+#endif
+	if (num_no_kernel_ts > 0) {
+		printf("%.0f datagrams without a kernel timestamp (used the -T clock)\n", (double)num_no_kernel_ts);
+		fflush(stdout);
+		if (o_output) {
+			fprintf(o_output, "%.0f datagrams without a kernel timestamp (used the -T clock)\n", (double)num_no_kernel_ts);
+			fflush(o_output);
 		}
-	}  /* for ;; */
+	}
 
 	CLOSESOCKET(sock);
 	if (o_tcp)
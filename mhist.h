@@ -0,0 +1,211 @@
+/* mhist.h */
+/*   Log-linear ("HDR-style") latency histogram shared by the mtools programs.
+ * See https://github.com/UltraMessaging/mtools
+ *
+ * Values (nanoseconds) below MHIST_SUB_COUNT are counted exactly.  Above
+ * that, each power-of-two range is split into MHIST_SUB_COUNT/2 equal
+ * buckets, so every bucket is within 1/64 (1.6%) of its true value.
+ * Recording is O(1) and the histogram has a fixed size regardless of the
+ * number of samples.  The exact mean and variance are kept alongside,
+ * using Welford's online algorithm.
+ *
+ * Like mtime.h, this header holds definitions; include it once.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef MHIST_H
+#define MHIST_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#define MHIST_SUB_BITS 7
+#define MHIST_SUB_COUNT (1 << MHIST_SUB_BITS)  /* 128 */
+#define MHIST_MAX_BITS 40  /* values are clamped to 2^40 ns (about 18 minutes) */
+#define MHIST_NUM_BUCKETS ((MHIST_MAX_BITS - MHIST_SUB_BITS + 2) * (MHIST_SUB_COUNT / 2))
+
+typedef struct mhist_s {
+	uint64_t counts[MHIST_NUM_BUCKETS];
+	uint64_t total;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	double mean_ns;
+	double m2;  /* sum of squared differences from the mean */
+} mhist_t;
+
+
+void mhist_init(mhist_t *hist)
+{
+	memset((char *)hist, 0, sizeof(*hist));
+}  /* mhist_init */
+
+
+/* Bucket for a value.  Values 0..127 have their own buckets; above that,
+ * shift s > 0 covers [64 << s, 128 << s) in steps of 1 << s. */
+int mhist_index(uint64_t ns)
+{
+	int msb, shift;
+
+	if (ns < MHIST_SUB_COUNT)
+		return (int)ns;
+	if (ns >= ((uint64_t)1 << MHIST_MAX_BITS))
+		ns = ((uint64_t)1 << MHIST_MAX_BITS) - 1;
+#if defined(__GNUC__)
+	msb = 63 - __builtin_clzll(ns);
+#else
+	for (msb = MHIST_MAX_BITS - 1; (ns >> msb) == 0; --msb)
+		;
+#endif
+	shift = msb - MHIST_SUB_BITS + 1;  /* keep the top 6 bits below the msb */
+	return shift * (MHIST_SUB_COUNT / 2) + (int)(ns >> shift);
+}  /* mhist_index */
+
+
+/* Highest value that maps to a bucket (reported for percentiles). */
+uint64_t mhist_bucket_max(int index)
+{
+	int shift, sub;
+
+	if (index < MHIST_SUB_COUNT)
+		return (uint64_t)index;
+	shift = index / (MHIST_SUB_COUNT / 2) - 1;
+	sub = index % (MHIST_SUB_COUNT / 2) + MHIST_SUB_COUNT / 2;
+	return (((uint64_t)sub + 1) << shift) - 1;
+}  /* mhist_bucket_max */
+
+
+void mhist_record(mhist_t *hist, uint64_t ns)
+{
+	double delta;
+
+	hist->counts[mhist_index(ns)]++;
+	if (hist->total == 0 || ns < hist->min_ns)
+		hist->min_ns = ns;
+	if (ns > hist->max_ns)
+		hist->max_ns = ns;
+	hist->total++;
+
+	delta = (double)ns - hist->mean_ns;
+	hist->mean_ns += delta / (double)hist->total;
+	hist->m2 += delta * ((double)ns - hist->mean_ns);
+}  /* mhist_record */
+
+
+/* Add the samples of 'src' into 'dst'. */
+void mhist_merge(mhist_t *dst, const mhist_t *src)
+{
+	double delta, total;
+	int i;
+
+	if (src->total == 0)
+		return;
+	for (i = 0; i < MHIST_NUM_BUCKETS; ++i)
+		dst->counts[i] += src->counts[i];
+	if (dst->total == 0 || src->min_ns < dst->min_ns)
+		dst->min_ns = src->min_ns;
+	if (src->max_ns > dst->max_ns)
+		dst->max_ns = src->max_ns;
+
+	/* Combine the means and variances (Chan et al.). */
+	total = (double)dst->total + (double)src->total;
+	delta = src->mean_ns - dst->mean_ns;
+	dst->mean_ns += delta * (double)src->total / total;
+	dst->m2 += src->m2 + delta * delta * (double)dst->total * (double)src->total / total;
+	dst->total += src->total;
+}  /* mhist_merge */
+
+
+/* Population standard deviation. */
+double mhist_stddev_ns(const mhist_t *hist)
+{
+	if (hist->total == 0)
+		return 0.0;
+	return sqrt(hist->m2 / (double)hist->total);
+}  /* mhist_stddev_ns */
+
+
+/* Value at or below which 'percentile' percent of the samples fall. */
+uint64_t mhist_percentile(const mhist_t *hist, double percentile)
+{
+	uint64_t target, sum;
+	int i;
+
+	if (hist->total == 0)
+		return 0;
+	target = (uint64_t)((percentile / 100.0) * (double)hist->total + 0.5);
+	if (target < 1)
+		target = 1;
+	sum = 0;
+	for (i = 0; i < MHIST_NUM_BUCKETS; ++i) {
+		sum += hist->counts[i];
+		if (sum >= target) {
+			uint64_t value = mhist_bucket_max(i);
+			return (value > hist->max_ns) ? hist->max_ns : value;
+		}
+	}
+	return hist->max_ns;
+}  /* mhist_percentile */
+
+
+/* One-line percentile summary, in microseconds. */
+char *mhist_describe(const mhist_t *hist, char *buf, int buf_size)
+{
+	snprintf(buf, buf_size,
+			"p50 %.3f us, p90 %.3f us, p99 %.3f us, p99.9 %.3f us, p99.99 %.3f us, max %.3f us",
+			(double)mhist_percentile(hist, 50.0) / 1000.0,
+			(double)mhist_percentile(hist, 90.0) / 1000.0,
+			(double)mhist_percentile(hist, 99.0) / 1000.0,
+			(double)mhist_percentile(hist, 99.9) / 1000.0,
+			(double)mhist_percentile(hist, 99.99) / 1000.0,
+			(double)hist->max_ns / 1000.0);
+	return buf;
+}  /* mhist_describe */
+
+
+/* Write every non-empty bucket as "value_us count cumulative_percentile",
+ * in the style of an HdrHistogram percentile distribution. */
+int mhist_export(const mhist_t *hist, const char *file_name)
+{
+	FILE *fp;
+	uint64_t sum;
+	int i;
+
+	fp = fopen(file_name, "w");
+	if (fp == NULL)
+		return -1;
+	fprintf(fp, "# %llu samples, min %.3f us, max %.3f us\n",
+			(unsigned long long)hist->total,
+			(double)hist->min_ns / 1000.0, (double)hist->max_ns / 1000.0);
+	fprintf(fp, "# value_us count percentile\n");
+	sum = 0;
+	for (i = 0; i < MHIST_NUM_BUCKETS; ++i) {
+		uint64_t value;
+		if (hist->counts[i] == 0)
+			continue;
+		sum += hist->counts[i];
+		value = mhist_bucket_max(i);
+		if (value > hist->max_ns)
+			value = hist->max_ns;
+		fprintf(fp, "%.3f %llu %.6f\n", (double)value / 1000.0,
+				(unsigned long long)hist->counts[i],
+				(double)sum * 100.0 / (double)hist->total);
+	}
+	fclose(fp);
+	return 0;
+}  /* mhist_export */
+
+#endif /* MHIST_H */
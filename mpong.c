@@ -20,11 +20,16 @@
  THE LIKELIHOOD OF SUCH DAMAGES.
  */
 
+#if defined(__linux__)
+#define _GNU_SOURCE  /* Needed for recvmmsg/sendmmsg */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <signal.h>
 
 #if defined(_WIN32)
 #pragma warning(disable : 4996)
@@ -55,7 +60,6 @@ typedef unsigned long socklen_t;
 #else
 /* Unix-only includes */
 #define HAVE_PTHREAD_H
-#include <signal.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -79,6 +83,21 @@ typedef unsigned long socklen_t;
 #   define perror(x) fprintf(stderr,"%s: %d\n",x,GetLastError())
 #endif
 
+#if defined(__linux__)
+#   define HAVE_RECVMMSG  /* recvmmsg() and sendmmsg() */
+#endif
+
+#if defined(HAVE_PTHREAD_H) && defined(__GNUC__)
+#   define HAVE_OPEN_LOOP  /* needs threads and __atomic builtins */
+#endif
+
+#include "mtime.h"
+#include "mhist.h"
+#include "mwire.h"
+
+#define WARMUP_PINGS 20
+#define OPEN_LOOP_TIMEOUT_NS 1000000000  /* a ping with no reply after 1 sec is lost */
+
 
 #define EXIT(x) do { fprintf(stdout, "Exit, file: '%s', line: %d\n", __FILE__, __LINE__);  exit(x);  } while (0)
 
@@ -87,11 +106,18 @@ typedef unsigned long socklen_t;
 char *prog_name = "xxx";
 
 /* program options */
+int o_Flight;
+char *o_Hist_file;
+int o_Interval;
 int o_initiator;
+int o_busy_poll;
+int o_multi;
 FILE *o_output;
+int o_Rate;
 int o_rcvbuf_size;
 int o_Sndbuf_size;
 int o_samples;
+char *o_Timer;
 int o_verbose;
 
 /* program positional parameters */
@@ -101,11 +127,40 @@ unsigned char ttlvar;
 char *bind_if;
 
 
-struct timeval *start_tvs;
-struct timeval *end_tvs;
+uint64_t *start_nss;
+uint64_t *end_nss;
+mhist_t rtt_hist;
+mhist_t interval_hist;
+mhist_t actual_hist;
+mhist_t service_hist;
+volatile int stop;
+
+uint32_t sender_id;  /* replies from other initiators are ignored */
+
+/* Open-loop ping: header (send_ns is the actual send time) followed by the
+ * time the ping was scheduled to go.  The reflector echoes it unchanged. */
+#define PING_LEN (MWIRE_HDR_LEN + 8)
+
+#if defined(HAVE_OPEN_LOOP)
+/* Outstanding pings, by seq % ol_window: when each was sent, and whether
+ * its reply came.  A ping is settled when its reply arrives or when it
+ * times out; pings below ol_low_seq have been retired and their slots can
+ * be reused.  The receive thread writes the counters and ol_low_seq. */
+uint64_t ol_window;  /* power of 2 */
+uint64_t *ol_send_ns;
+uint64_t *ol_replied;  /* bitmap */
+uint64_t ol_low_seq;
+uint64_t num_pings_sent;
+uint64_t num_replies;  /* distinct pings answered in time */
+uint64_t num_expired;  /* no reply in time (lost) */
+uint64_t num_dup_replies;
+uint64_t num_late_replies;  /* after the ping had timed out */
+uint64_t num_bad_replies;
+int rcv_thread_quit;
+#endif
 
 
-char usage_str[] = "[-h] [-i] [-o ofile] [-r rcvbuf_size] [-S Sndbuf_size] [-s samples] [-v] group port [ttl] [interface]";
+char usage_str[] = "[-b] [-F Flight] [-H Hist_file] [-h] [-I Interval] [-i] [-m multi] [-o ofile] [-R Rate] [-r rcvbuf_size] [-S Sndbuf_size] [-s samples] [-T Timer] [-v] group port [ttl] [interface]";
 
 void usage(char *msg)
 {
@@ -123,15 +178,24 @@ void help(char *msg)
 		fprintf(stderr, "\n%s\n\n", msg);
 	fprintf(stderr, "Usage: %s %s\n", prog_name, usage_str);
 	fprintf(stderr, "Where:\n"
+			"  -b : with -m, busy-poll the socket instead of blocking\n"
+			"  -F Flight : with -R, maximum pings outstanding (no reply in 1 sec = lost) [1000]\n"
+			"  -H Hist_file : write the full RTT histogram to 'Hist_file'\n"
 			"  -h : help\n"
+			"  -I Interval : print RTT statistics every 'Interval' seconds [0: only at end]\n"
 			"  -i : initiator (sends first packet) [reflector]\n"
+			"  -m multi : reflector receives and replies up to 'multi' datagrams per\n"
+			"             recvmmsg()/sendmmsg() call (Linux only) [0: recvfrom()/sendto()]\n"
 			"  -o ofile : print results to file (in addition to stdout)\n"
+			"  -R Rate : open loop: send 'Rate' pings/sec without waiting for replies\n"
+			"            (latency is measured from each ping's scheduled send time) [0: ping-pong]\n"
 			"  -r rcvbuf_size : size (bytes) of UDP receive buffer (SO_RCVBUF) [4194304]\n"
 			"                   (use 0 for system default buff size)\n"
 			"  -S Sndbuf_size : size (bytes) of UDP send buffer (SO_SNDBUF) [65536]\n"
 			"                   (use 0 for system default buff size)\n"
-			"  -s samples : number of cycles to measure [65536]\n"
-			"  -v : verbose (print each RTT sample)\n"
+			"  -s samples : number of cycles to measure (0=run until interrupted) [65536]\n"
+			"  -T Timer : clock for RTT timestamps: mono, raw, tsc, tscp (qpc on Windows) [mono]\n"
+			"  -v : verbose (print each RTT sample; stores all samples, so needs -s > 0)\n"
 			"\n"
 			"  group : multicast address to send on (use '0.0.0.0' for unicast)\n"
 			"  port : destination port\n"
@@ -142,43 +206,322 @@ void help(char *msg)
 }  /* help */
 
 
-/* After doing arithmetic on tv variables, you can end up with strange values.
- * (Code borrowed from ACE) */
-void normalize_tv(struct timeval *tv)
+void handle_signal(int sig)
 {
-	if (tv->tv_usec >= 1000000) {
-		do { tv->tv_sec++; tv->tv_usec -= 1000000; } while (tv->tv_usec >= 1000000);
-	} else if (tv->tv_usec <= -1000000) {
-		do { tv->tv_sec--; tv->tv_usec += 1000000; } while (tv->tv_usec <= -1000000);
+	stop = 1;
+}  /* handle_signal */
+
+
+/* Print a one-line summary of the samples in 'hist'. */
+void print_hist_summary(const char *label, const char *samples_name, const mhist_t *hist)
+{
+	char line[300];
+
+	snprintf(line, sizeof(line),
+			"%s: %llu %s, avg %.3f us, std dev %.3f, min %.3f us, p50 %.3f us, p99 %.3f us, p99.9 %.3f us, max %.3f us",
+			label, (unsigned long long)hist->total, samples_name, hist->mean_ns / 1000.0, mhist_stddev_ns(hist) / 1000.0,
+			(double)hist->min_ns / 1000.0, (double)mhist_percentile(hist, 50.0) / 1000.0,
+			(double)mhist_percentile(hist, 99.0) / 1000.0, (double)mhist_percentile(hist, 99.9) / 1000.0,
+			(double)hist->max_ns / 1000.0);
+	printf("%s\n", line); fflush(stdout);
+	if (o_output) { fprintf(o_output, "%s\n", line); fflush(o_output); }
+}  /* print_hist_summary */
+
+
+#if defined(HAVE_OPEN_LOOP)
+/* Retire the pings sent more than OPEN_LOOP_TIMEOUT_NS ago; those with
+ * no reply are lost.  Frees their slots for the sender. */
+void ol_expire(uint64_t now_ns)
+{
+	uint64_t sent = __atomic_load_n(&num_pings_sent, __ATOMIC_ACQUIRE);
+	uint64_t low = ol_low_seq;
+	uint64_t expired = num_expired;
+
+	while (low < sent && now_ns - ol_send_ns[low & (ol_window - 1)] > OPEN_LOOP_TIMEOUT_NS) {
+		uint64_t *word = &ol_replied[(low & (ol_window - 1)) >> 6];
+		uint64_t bit = (uint64_t)1 << (low & 63);
+		if (! (*word & bit))
+			expired++;
+		*word &= ~bit;
+		low++;
 	}
-	if (tv->tv_sec >= 1 && tv->tv_usec < 0) {
-		tv->tv_sec--; tv->tv_usec += 1000000;
-	} else if (tv->tv_sec < 0 && tv->tv_usec > 0) {
-		tv->tv_sec++; tv->tv_usec -= 1000000;
+	__atomic_store_n(&num_expired, expired, __ATOMIC_RELEASE);
+	__atomic_store_n(&ol_low_seq, low, __ATOMIC_RELEASE);
+}  /* ol_expire */
+
+
+/* Receive replies to open-loop pings and record their latencies.  This
+ * thread owns the histograms until open_loop() joins it. */
+void *rcv_thread(void *arg)
+{
+	SOCKET sock = *(SOCKET *)arg;
+	char ping[PING_LEN];
+	mwire_hdr_t hdr;
+	struct sockaddr_in src;
+	socklen_t fromlen;
+	uint64_t end_ns, intended_ns, first_ns, interval_start_ns, interval_ns;
+	char label[80];
+	int cur_size;
+	uint64_t *word, bit;
+
+	interval_ns = (uint64_t)o_Interval * 1000000000;
+	first_ns = 0;  interval_start_ns = 0;
+	while (! __atomic_load_n(&rcv_thread_quit, __ATOMIC_ACQUIRE)) {
+		fromlen = sizeof(src);
+		cur_size = recvfrom(sock, ping, sizeof(ping), 0, (struct sockaddr *)&src, &fromlen);
+		end_ns = mtime_wall_ns();
+		ol_expire(end_ns);
+		if (cur_size == SOCKET_ERROR) {
+			if (ERRNO == EAGAIN || ERRNO == EWOULDBLOCK || ERRNO == EINTR)
+				continue;  /* receive timeout; check for quit */
+			fprintf(stderr, "ERROR: ");  perror("recv"); EXIT(1);
+		}
+		if (cur_size != PING_LEN || mwire_decode(ping, cur_size, &hdr) != 0
+				|| hdr.type != MWIRE_TYPE_PING || hdr.sender_id != sender_id
+				|| hdr.seq >= __atomic_load_n(&num_pings_sent, __ATOMIC_ACQUIRE)) {
+			num_bad_replies++;
+			continue;
+		}
+		if (hdr.seq < ol_low_seq) {
+			num_late_replies++;
+			continue;
+		}
+		word = &ol_replied[(hdr.seq & (ol_window - 1)) >> 6];
+		bit = (uint64_t)1 << (hdr.seq & 63);
+		if (*word & bit) {
+			num_dup_replies++;
+			continue;
+		}
+		*word |= bit;
+		memcpy(&intended_ns, &ping[MWIRE_HDR_LEN], 8);
+		intended_ns = mwire_ntoh64(intended_ns);
+
+		if (hdr.seq >= WARMUP_PINGS) {
+			if (first_ns == 0) { first_ns = intended_ns;  interval_start_ns = end_ns; }
+			mhist_record(&rtt_hist, end_ns - intended_ns);
+			mhist_record(&actual_hist, end_ns - hdr.send_ns);
+			if (interval_ns > 0) {
+				mhist_record(&interval_hist, end_ns - intended_ns);
+				if (end_ns - interval_start_ns >= interval_ns) {
+					snprintf(label, sizeof(label), "interval %.3f sec", (double)(end_ns - first_ns) / 1000000000.0);
+					print_hist_summary(label, "RTTs", &interval_hist);
+					mhist_init(&interval_hist);
+					interval_start_ns = end_ns;
+				}
+			}
+		}
+		__atomic_store_n(&num_replies, num_replies + 1, __ATOMIC_RELEASE);
+	}  /* while */
+
+	return NULL;
+}  /* rcv_thread */
+
+
+/* Send pings at o_Rate per second, each at an absolute deadline, without
+ * waiting for replies (up to o_Flight outstanding).  Latency is measured
+ * from the deadline rather than the actual send, so a stalled sender is
+ * charged for every ping it delayed. */
+void open_loop(SOCKET sock, struct sockaddr_in *out_sa)
+{
+	char ping[PING_LEN];
+	pthread_t rcv_tid;
+	struct timeval rcv_timeout;
+	uint64_t start_ns, now_ns, intended_ns, total_pings, seq, settled;
+	int cur_size, max_in_flight_reached;
+	char line[256];
+
+	/* Let the receive thread wake up periodically to check for quit. */
+	rcv_timeout.tv_sec = 0;  rcv_timeout.tv_usec = 100000;
+	if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&rcv_timeout, sizeof(rcv_timeout)) == SOCKET_ERROR) {
+		fprintf(stderr, "ERROR: ");  perror("setsockopt - SO_RCVTIMEO");
+		EXIT(1);
 	}
-}  /* normalize_tv */
 
+	/* Room for every ping sent within the timeout, so that the window only
+	 * limits the sender if the rate is exceeded. */
+	for (ol_window = 64; ol_window < 2 * (uint64_t)o_Rate * (OPEN_LOOP_TIMEOUT_NS / 1000000000)
+			|| ol_window < 2 * (uint64_t)o_Flight; ol_window *= 2)
+		;
+	ol_send_ns = (uint64_t *)malloc(ol_window * sizeof(uint64_t));
+	ol_replied = (uint64_t *)calloc(ol_window / 64, sizeof(uint64_t));
+	if (ol_send_ns == NULL || ol_replied == NULL) { fprintf(stderr, "malloc failed\n"); EXIT(1); }
+	ol_low_seq = 0;
+	num_pings_sent = 0;  num_replies = 0;  num_expired = 0;
+	num_dup_replies = 0;  num_late_replies = 0;  num_bad_replies = 0;
+	rcv_thread_quit = 0;
+	if (pthread_create(&rcv_tid, NULL, rcv_thread, &sock) != 0) {
+		fprintf(stderr, "ERROR: ");  perror("pthread_create");
+		EXIT(1);
+	}
+
+	total_pings = (o_samples == 0) ? 0 : (uint64_t)o_samples + WARMUP_PINGS;
+	max_in_flight_reached = 0;
+	start_ns = mtime_wall_ns();
+	for (seq = 0; ! stop && (total_pings == 0 || seq < total_pings); ++seq) {
+		/* Absolute deadline; split to avoid overflow of seq * 1e9. */
+		intended_ns = start_ns + (seq / o_Rate) * 1000000000
+				+ (seq % o_Rate) * 1000000000 / o_Rate;
+		do {
+			now_ns = mtime_wall_ns();
+		} while (now_ns < intended_ns);
+
+		/* Wait for a slot; the deadline keeps its original value.  In flight
+		 * is sent minus settled (replied or timed out), so every wait ends
+		 * within the timeout, even if all replies are lost. */
+		if (seq - __atomic_load_n(&num_replies, __ATOMIC_ACQUIRE)
+					- __atomic_load_n(&num_expired, __ATOMIC_ACQUIRE) >= (uint64_t)o_Flight
+				|| seq - __atomic_load_n(&ol_low_seq, __ATOMIC_ACQUIRE) >= ol_window) {
+			max_in_flight_reached++;
+			while (! stop && (seq - __atomic_load_n(&num_replies, __ATOMIC_ACQUIRE)
+						- __atomic_load_n(&num_expired, __ATOMIC_ACQUIRE) >= (uint64_t)o_Flight
+					|| seq - __atomic_load_n(&ol_low_seq, __ATOMIC_ACQUIRE) >= ol_window))
+				;
+			if (stop)
+				break;
+		}
 
-/* Utility function to return current time of day */
-void current_tv(struct timeval *tv)
+		intended_ns = mwire_hton64(intended_ns);
+		memcpy(&ping[MWIRE_HDR_LEN], &intended_ns, 8);
+		now_ns = mtime_wall_ns();
+		mwire_encode(ping, MWIRE_TYPE_PING, sender_id, 0, seq, now_ns, 8);
+		ol_send_ns[seq & (ol_window - 1)] = now_ns;
+		__atomic_store_n(&num_pings_sent, seq + 1, __ATOMIC_RELEASE);
+		cur_size = sendto(sock, ping, PING_LEN,
+					0, (struct sockaddr *)out_sa, sizeof(*out_sa));
+		if (cur_size == SOCKET_ERROR) { fprintf(stderr, "ERROR: ");  perror("send"); EXIT(1); }
+	}  /* for seq */
+
+	/* Wait until every ping has a reply or has timed out. */
+	do {
+		SLEEP_MSEC(1);
+		settled = __atomic_load_n(&num_replies, __ATOMIC_ACQUIRE)
+				+ __atomic_load_n(&num_expired, __ATOMIC_ACQUIRE);
+	} while (settled < num_pings_sent);
+
+	__atomic_store_n(&rcv_thread_quit, 1, __ATOMIC_RELEASE);
+	pthread_join(rcv_tid, NULL);
+
+	snprintf(line, sizeof(line), "%llu pings sent at %d/sec, %llu replies, %llu lost, %llu duplicate, %llu late, %llu bad, %d waits for max in-flight (%d)",
+			(unsigned long long)num_pings_sent, o_Rate, (unsigned long long)num_replies,
+			(unsigned long long)num_expired, (unsigned long long)num_dup_replies,
+			(unsigned long long)num_late_replies, (unsigned long long)num_bad_replies,
+			max_in_flight_reached, o_Flight);
+	printf("%s\n", line); fflush(stdout);
+	if (o_output) { fprintf(o_output, "%s\n", line); fflush(o_output); }
+	free(ol_send_ns);
+	free(ol_replied);
+	print_hist_summary("RTT from actual send time", "RTTs", &actual_hist);
+	printf("Latency from scheduled send time:\n"); fflush(stdout);
+	if (o_output) { fprintf(o_output, "Latency from scheduled send time:\n"); fflush(o_output); }
+}  /* open_loop */
+#endif /* HAVE_OPEN_LOOP */
+
+
+#if defined(HAVE_RECVMMSG)
+/* Reflector that drains up to o_multi datagrams per recvmmsg() and sends
+ * them back with one sendmmsg().  Both calls share the same iovecs, so
+ * the datagrams are never copied.  Runs until SIGINT/SIGTERM and reports
+ * the time each datagram spent in the reflector (from recvmmsg() return
+ * to sendmmsg() return). */
+void multi_reflect_loop(SOCKET sock, struct sockaddr_in *out_sa)
 {
-#if defined(_WIN32)
-	LARGE_INTEGER ticks;
-	static LARGE_INTEGER freq;
-	static int first = 1;
-
-	if (first) {
-		QueryPerformanceFrequency(&freq);
-		first = 0;
-	}
-	QueryPerformanceCounter(&ticks);
-	tv->tv_sec = 0;
-	tv->tv_usec = (long)(1000000 * ticks.QuadPart / freq.QuadPart);
-	normalize_tv(tv);
-#else 
-	gettimeofday(tv,NULL);
-#endif /* _WIN32 */
-}  /* current_tv */
+	struct mmsghdr *rcv_msgs, *snd_msgs;
+	struct iovec *iovecs;
+	char *buffs;
+	TLONGLONG *batch_hist;
+	TLONGLONG num_calls, num_dgrams, num_partial_sends;
+	uint64_t rcv_ns, sent_ns, interval_ns, interval_start_ns;
+	int n_dgrams, n_sent, sent, i;
+	char label[80];
+
+	rcv_msgs = (struct mmsghdr *)malloc(o_multi * sizeof(*rcv_msgs));
+	snd_msgs = (struct mmsghdr *)malloc(o_multi * sizeof(*snd_msgs));
+	iovecs = (struct iovec *)malloc(o_multi * sizeof(*iovecs));
+	buffs = (char *)malloc((size_t)o_multi * 65536);
+	batch_hist = (TLONGLONG *)malloc((o_multi + 1) * sizeof(*batch_hist));
+	if (rcv_msgs == NULL || snd_msgs == NULL || iovecs == NULL || buffs == NULL || batch_hist == NULL) {
+		fprintf(stderr, "malloc failed\n"); EXIT(1);
+	}
+	memset(batch_hist, 0, (o_multi + 1) * sizeof(*batch_hist));
+
+	for (i = 0; i < o_multi; ++i) {
+		iovecs[i].iov_base = &buffs[(size_t)i * 65536];
+		iovecs[i].iov_len = 65536;
+		memset(&rcv_msgs[i], 0, sizeof(rcv_msgs[i]));
+		rcv_msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		rcv_msgs[i].msg_hdr.msg_iovlen = 1;
+		memset(&snd_msgs[i], 0, sizeof(snd_msgs[i]));
+		snd_msgs[i].msg_hdr.msg_name = out_sa;
+		snd_msgs[i].msg_hdr.msg_namelen = sizeof(*out_sa);
+		snd_msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		snd_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	mhist_init(&service_hist);
+	mhist_init(&interval_hist);
+	interval_ns = (uint64_t)o_Interval * 1000000000;
+	interval_start_ns = mtime_ns();
+	num_calls = 0;  num_dgrams = 0;  num_partial_sends = 0;
+
+	while (! stop) {
+		n_dgrams = recvmmsg(sock, rcv_msgs, o_multi, o_busy_poll ? MSG_DONTWAIT : MSG_WAITFORONE, NULL);
+		rcv_ns = mtime_ns();
+		if (n_dgrams == SOCKET_ERROR) {
+			if (ERRNO == EAGAIN || ERRNO == EWOULDBLOCK || ERRNO == EINTR)
+				continue;
+			fprintf(stderr, "ERROR: ");  perror("recvmmsg"); EXIT(1);
+		}
+		batch_hist[n_dgrams]++;
+		num_calls++;  num_dgrams += n_dgrams;
+
+		/* Reflect exactly what was received. */
+		for (i = 0; i < n_dgrams; ++i)
+			iovecs[i].iov_len = rcv_msgs[i].msg_len;
+		for (sent = 0; sent < n_dgrams; sent += n_sent) {
+			n_sent = sendmmsg(sock, &snd_msgs[sent], n_dgrams - sent, 0);
+			if (n_sent == SOCKET_ERROR) {
+				if (ERRNO == EINTR) { n_sent = 0;  continue; }
+				fprintf(stderr, "ERROR: ");  perror("sendmmsg"); EXIT(1);
+			}
+			if (sent + n_sent < n_dgrams)
+				num_partial_sends++;
+		}
+		sent_ns = mtime_ns();
+		for (i = 0; i < n_dgrams; ++i) {
+			iovecs[i].iov_len = 65536;
+			mhist_record(&service_hist, sent_ns - rcv_ns);
+			if (interval_ns > 0)
+				mhist_record(&interval_hist, sent_ns - rcv_ns);
+		}
+
+		if (interval_ns > 0 && sent_ns - interval_start_ns >= interval_ns) {
+			snprintf(label, sizeof(label), "interval service time (%.2f dgrams/call)",
+					(double)num_dgrams / (double)num_calls);
+			print_hist_summary(label, "dgrams", &interval_hist);
+			mhist_init(&interval_hist);
+			interval_start_ns = sent_ns;
+		}
+	}  /* while ! stop */
+
+	printf("%.0f dgrams reflected in %.0f recvmmsg calls (%.2f dgrams/call), %.0f partial sends\n",
+			(double)num_dgrams, (double)num_calls,
+			(num_calls > 0) ? (double)num_dgrams / (double)num_calls : 0.0,
+			(double)num_partial_sends); fflush(stdout);
+	if (o_output) { fprintf(o_output, "%.0f dgrams reflected in %.0f recvmmsg calls (%.2f dgrams/call), %.0f partial sends\n",
+			(double)num_dgrams, (double)num_calls,
+			(num_calls > 0) ? (double)num_dgrams / (double)num_calls : 0.0,
+			(double)num_partial_sends); fflush(o_output); }
+	for (i = 1; i <= o_multi; ++i) {
+		if (batch_hist[i] > 0) {
+			printf("  %5d dgrams: %.0f calls\n", i, (double)batch_hist[i]);
+			if (o_output) fprintf(o_output, "  %5d dgrams: %.0f calls\n", i, (double)batch_hist[i]);
+		}
+	}
+	print_hist_summary("Reflector service time", "dgrams", &service_hist);
+
+	free(rcv_msgs);  free(snd_msgs);  free(iovecs);  free(buffs);  free(batch_hist);
+}  /* multi_reflect_loop */
+#endif /* HAVE_RECVMMSG */
 
 
 int main(int argc, char **argv)
@@ -189,23 +532,21 @@ int main(int argc, char **argv)
 	SOCKET sock;
 	socklen_t fromlen = sizeof(struct sockaddr_in);
 	int default_rcvbuf_sz, cur_size, sz;
-	int num_rcvd;
+	TLONGLONG num_rcvd;
 	struct sockaddr_in in_sa;
 	struct sockaddr_in out_sa;
 	struct sockaddr_in src;
 	unsigned int wttl;
 	struct ip_mreq imr;
-	struct timeval first_tv;
-	struct timeval start_tv;
-	struct timeval end_tv;
-	struct timeval delta_tv;
-	struct timeval sum_tv;
-	struct timeval max_tv;
-	struct timeval min_tv;
-	char timestr1[65], timestr2[65];
-	float avg;
-	float cur;
-	float std;
+	uint64_t first_ns;
+	uint64_t start_ns;
+	uint64_t end_ns;
+	uint64_t delta_ns;
+	uint64_t interval_ns;
+	uint64_t interval_start_ns;
+	char timer_desc[80];
+	char label[80];
+	char ping[MWIRE_HDR_LEN];
 #if defined(_WIN32)
 	unsigned long int iface_in;
 #else
@@ -243,25 +584,57 @@ int main(int argc, char **argv)
 	CLOSESOCKET(sock);
 
 	/* default values for options */
+	o_Flight = 1000;
+	o_Hist_file = NULL;
+	o_Interval = 0;
 	o_initiator = 0;
+	o_busy_poll = 0;
+	o_multi = 0;
 	o_output = NULL;
+	o_Rate = 0;
 	o_rcvbuf_size = 0x100000;  /* 1MB */
 	o_Sndbuf_size = 65536;
 	o_samples = 65536;
+	o_Timer = NULL;  /* platform default clock */
 	o_verbose = 0;
 
 	/* default values for optional positional params */
 	ttlvar = 2;
 	bind_if = NULL;
 
-	while ((opt = tgetopt(argc, argv, "hio:r:S:s:v")) != EOF) {
+	while ((opt = tgetopt(argc, argv, "bF:H:hI:im:o:R:r:S:s:T:v")) != EOF) {
 		switch (opt) {
+		  case 'b':
+			o_busy_poll = 1;
+			break;
+		  case 'F':
+			o_Flight = atoi(toptarg);
+			if (o_Flight < 1) {
+				usage("Flight must be at least 1");
+				EXIT(1);
+			}
+			break;
+		  case 'H':
+			o_Hist_file = toptarg;
+			break;
 		  case 'h':
 			help(NULL);  exit(0);
 			break;
+		  case 'I':
+			o_Interval = atoi(toptarg);
+			break;
 		  case 'i':
 			o_initiator = 1;
 			break;
+		  case 'm':
+			o_multi = atoi(toptarg);
+#if !defined(HAVE_RECVMMSG)
+			if (o_multi > 0) {
+				usage("-m not supported on this platform");
+				EXIT(1);
+			}
+#endif
+			break;
 		  case 'o':
 			if (strlen(toptarg) > 1000) {
 				fprintf(stderr, "ERROR: file name too long (%s)\n", toptarg);
@@ -273,6 +646,9 @@ int main(int argc, char **argv)
 				EXIT(1);
 			}
 			break;
+		  case 'R':
+			o_Rate = atoi(toptarg);
+			break;
 		  case 'r':
 			o_rcvbuf_size = atoi(toptarg);
 			if (o_rcvbuf_size == 0)
@@ -284,6 +660,9 @@ int main(int argc, char **argv)
 		  case 's':
 			o_samples = atoi(toptarg);
 			break;
+		  case 'T':
+			o_Timer = toptarg;
+			break;
 		  case 'v':
 			o_verbose = 1;
 			break;
@@ -321,6 +700,33 @@ int main(int argc, char **argv)
 		EXIT(1);
 	}
 
+	if (o_verbose && o_samples == 0) {
+		usage("-v requires a finite sample count (-s)");
+		EXIT(1);
+	}
+	if (o_Rate > 0 && o_verbose) {
+		usage("-v cannot be used with -R");
+		EXIT(1);
+	}
+	if (o_busy_poll && o_multi == 0) {
+		usage("-b requires -m");
+		EXIT(1);
+	}
+#if !defined(HAVE_OPEN_LOOP)
+	if (o_Rate > 0) {
+		usage("-R not supported on this platform");
+		EXIT(1);
+	}
+#endif
+
+	if (mtime_init(o_Timer) != 0)
+		EXIT(1);
+	sender_id = mwire_new_sender_id();
+	if (o_initiator) {
+		printf("Timer: %s\n", mtime_describe(timer_desc, sizeof(timer_desc))); fflush(stdout);
+		if (o_output) { fprintf(o_output, "Timer: %s\n", timer_desc); fflush(o_output); }
+	}
+
 	if((sock = socket(PF_INET,SOCK_DGRAM,0)) == INVALID_SOCKET) {
 		fprintf(stderr, "ERROR: ");  perror("socket");
 		EXIT(1);
@@ -427,101 +833,111 @@ int main(int argc, char **argv)
 	SLEEP_SEC(1);  /* allow multicast join to complete */
 
 	if (o_initiator) {
-		start_tvs = (struct timeval *)malloc(o_samples * sizeof(struct timeval));
-		end_tvs = (struct timeval *)malloc(o_samples * sizeof(struct timeval));
-		memset((char *)start_tvs, 0, o_samples * sizeof(struct timeval));
-		memset((char *)end_tvs, 0, o_samples * sizeof(struct timeval));
-
+		/* Individual samples are only kept for verbose output; the statistics
+		 * are streamed into fixed-size histograms. */
+		if (o_verbose) {
+			start_nss = (uint64_t *)malloc(o_samples * sizeof(uint64_t));
+			end_nss = (uint64_t *)malloc(o_samples * sizeof(uint64_t));
+			if (start_nss == NULL || end_nss == NULL) { fprintf(stderr, "malloc failed\n"); EXIT(1); }
+			memset((char *)start_nss, 0, o_samples * sizeof(uint64_t));
+			memset((char *)end_nss, 0, o_samples * sizeof(uint64_t));
+		}
+		mhist_init(&rtt_hist);
+		mhist_init(&interval_hist);
+		mhist_init(&actual_hist);
+		interval_ns = (uint64_t)o_Interval * 1000000000;
+		first_ns = 0;  interval_start_ns = 0;
+
+		stop = 0;
+		signal(SIGINT, handle_signal);
+
+#if defined(HAVE_OPEN_LOOP)
+		if (o_Rate > 0)
+			open_loop(sock, &out_sa);
+		else
+#endif
 		/* The -20 allows 20 cycles to happen without measurements.  This takes care of startup costs. */
-		for (num_rcvd = -20; num_rcvd < o_samples; ++num_rcvd) {
-			current_tv(&start_tv);
-			cur_size = sendto(sock, (char *)&start_tv, sizeof(struct timeval),
+		for (num_rcvd = -WARMUP_PINGS; !stop && (o_samples == 0 || num_rcvd < o_samples); ++num_rcvd) {
+			start_ns = mtime_wall_ns();
+			mwire_encode(ping, MWIRE_TYPE_PING, sender_id, 0, (uint64_t)(num_rcvd + WARMUP_PINGS), start_ns, 0);
+			cur_size = sendto(sock, ping, MWIRE_HDR_LEN,
 						0, (struct sockaddr *)&out_sa, sizeof(out_sa));
 			if (cur_size == SOCKET_ERROR) { fprintf(stderr, "ERROR: ");  perror("send"); EXIT(1); }
 
 			cur_size = recvfrom(sock, buff, 65536, 0, (struct sockaddr *)&src, &fromlen);
-			current_tv(&end_tv);
+			end_ns = mtime_wall_ns();
 			if (cur_size == SOCKET_ERROR) { fprintf(stderr, "ERROR: ");  perror("recv"); EXIT(1); }
 
 			/* start and end timestamps taken, this part of the loop is non-time-critical */
 
 			if (num_rcvd >= 0) {  /* check returned time */
-				if (num_rcvd == 0) first_tv = start_tv;
-				start_tvs[num_rcvd] = start_tv;
-				end_tvs[num_rcvd] = end_tv;
-				/* sanity check (make sure payload contains start_tv) */
-				if (cur_size != sizeof(struct timeval)) { fprintf(stderr, "ERROR: recvfrom rtn val %d != sizeof struct timeval %d\n", cur_size, (int)sizeof(struct timeval)); EXIT(1); }
-				if (memcmp(buff, (char *)&start_tv, sizeof(struct timeval)) != 0) { fprintf(stderr, "ERROR: recvfrom buff != start_tv\n"); EXIT(1); }
+				if (num_rcvd == 0) { first_ns = start_ns;  interval_start_ns = start_ns; }
+				if (o_verbose) {
+					start_nss[num_rcvd] = start_ns;
+					end_nss[num_rcvd] = end_ns;
+				}
+				mhist_record(&rtt_hist, end_ns - start_ns);
+				/* sanity check (make sure the reply is the ping we sent) */
+				if (cur_size != MWIRE_HDR_LEN) { fprintf(stderr, "ERROR: recvfrom rtn val %d != header size %d\n", cur_size, MWIRE_HDR_LEN); EXIT(1); }
+				if (memcmp(buff, ping, MWIRE_HDR_LEN) != 0) { fprintf(stderr, "ERROR: recvfrom buff != ping sent\n"); EXIT(1); }
+
+				if (interval_ns > 0) {
+					mhist_record(&interval_hist, end_ns - start_ns);
+					if (end_ns - interval_start_ns >= interval_ns) {
+						snprintf(label, sizeof(label), "interval %.3f sec", (double)(end_ns - first_ns) / 1000000000.0);
+						print_hist_summary(label, "RTTs", &interval_hist);
+						mhist_init(&interval_hist);
+						interval_start_ns = end_ns;
+					}
+				}
 			}
 		}  /* for num_rcvd */
 
-		/* Done with active ping-pong phase; calculate results */
-
-		/* Calculate sum, min, max */
-		sum_tv.tv_sec = 0; sum_tv.tv_usec = 0;
+		/* Done with active ping-pong phase; print results */
 
 		if (o_verbose) {
 			printf("timestamp RTT (in microseconds):\n"); fflush(stdout);
 			if (o_output) { fprintf(o_output, "RTT samples:\n"); fflush(o_output); }
-		}
-		for (num_rcvd = 0; num_rcvd < o_samples; ++num_rcvd) {
-			start_tv = start_tvs[num_rcvd];
-			end_tv = end_tvs[num_rcvd];
-			/* calc rtt */
-			delta_tv.tv_sec = end_tv.tv_sec - start_tv.tv_sec;
-			delta_tv.tv_usec = end_tv.tv_usec - start_tv.tv_usec;
-			normalize_tv(&delta_tv);
-			/* normalize timestamps to the start time of the test */
-			start_tv.tv_sec = start_tv.tv_sec - first_tv.tv_sec;
-			start_tv.tv_usec = start_tv.tv_usec - first_tv.tv_usec;
-			normalize_tv(&start_tv);
-
-			if (o_verbose) {
-				sprintf(timestr1, "%d.%06d", (int)start_tv.tv_sec, (int)start_tv.tv_usec);
-				if (delta_tv.tv_sec != 0) sprintf(timestr2, "%d%06d", (int)delta_tv.tv_sec, (int)delta_tv.tv_usec);
-				else sprintf(timestr2, "%d", (int)delta_tv.tv_usec);
-				printf("%s %s\n", timestr1, timestr2); fflush(stdout);
-				if (o_output) { fprintf(o_output, "%s %s\n", timestr1, timestr2); fflush(o_output); }
-			}
-
-			sum_tv.tv_sec += delta_tv.tv_sec;  sum_tv.tv_usec += delta_tv.tv_usec;
-			normalize_tv(&sum_tv);
-
-			if (num_rcvd == 0 || delta_tv.tv_sec < min_tv.tv_sec ||
-					(delta_tv.tv_sec == min_tv.tv_sec && delta_tv.tv_usec < min_tv.tv_usec)) {
-				min_tv = delta_tv;
-			}
-			if (num_rcvd == 0 || delta_tv.tv_sec > max_tv.tv_sec ||
-					(delta_tv.tv_sec == max_tv.tv_sec && delta_tv.tv_usec > max_tv.tv_usec)) {
-				max_tv = delta_tv;
+			for (num_rcvd = 0; num_rcvd < (TLONGLONG)rtt_hist.total; ++num_rcvd) {
+				delta_ns = end_nss[num_rcvd] - start_nss[num_rcvd];
+				/* timestamps are relative to the start time of the test */
+				start_ns = start_nss[num_rcvd] - first_ns;
+				printf("%d.%06d %.3f\n", (int)(start_ns / 1000000000), (int)((start_ns % 1000000000) / 1000),
+						(double)delta_ns / 1000.0); fflush(stdout);
+				if (o_output) { fprintf(o_output, "%d.%06d %.3f\n", (int)(start_ns / 1000000000), (int)((start_ns % 1000000000) / 1000),
+						(double)delta_ns / 1000.0); fflush(o_output); }
 			}
 		}
 
-		/* Calc average and standard deviation in microseconds */
-		avg = (float)sum_tv.tv_sec;  avg *= 1000000.0;  avg += (float)sum_tv.tv_usec;
-		avg = avg / (float)o_samples;
-		std = 0.0;
-		for (num_rcvd = 0; num_rcvd < o_samples; ++num_rcvd) {
-			start_tv = start_tvs[num_rcvd];
-			end_tv = end_tvs[num_rcvd];
-			/* calc rtt */
-			delta_tv.tv_sec = end_tv.tv_sec - start_tv.tv_sec;
-			delta_tv.tv_usec = end_tv.tv_usec - start_tv.tv_usec;
-			normalize_tv(&delta_tv);
-			cur = (float)delta_tv.tv_sec;  cur *= 1000000.0;  cur += (float)delta_tv.tv_usec;
-			std += (float)pow((cur - avg), 2);
+		printf("avg RTT %f us, std dev %f, min RTT %.3f us, max RTT %.3f us\n",
+				rtt_hist.mean_ns / 1000.0, mhist_stddev_ns(&rtt_hist) / 1000.0,
+				(double)rtt_hist.min_ns / 1000.0, (double)rtt_hist.max_ns / 1000.0); fflush(stdout);
+		if (o_output) { fprintf(o_output, "avg RTT %f us, std dev %f, min RTT %.3f us max RTT %.3f us\n",
+				rtt_hist.mean_ns / 1000.0, mhist_stddev_ns(&rtt_hist) / 1000.0,
+				(double)rtt_hist.min_ns / 1000.0, (double)rtt_hist.max_ns / 1000.0); fflush(o_output); }
+		printf("RTT percentiles: %s\n", mhist_describe(&rtt_hist, buff, 65536)); fflush(stdout);
+		if (o_output) { fprintf(o_output, "RTT percentiles: %s\n", buff); fflush(o_output); }
+		if (o_Hist_file != NULL) {
+			if (mhist_export(&rtt_hist, o_Hist_file) != 0) {
+				fprintf(stderr, "ERROR: ");  perror("fopen - Hist_file");
+				EXIT(1);
+			}
 		}
-		std = (float)pow((std / (float)o_samples), 0.5);
-
-		/* print final results */
-		if (min_tv.tv_sec != 0) sprintf(timestr1, "%d%06d", (int)min_tv.tv_sec, (int)min_tv.tv_usec);
-		else sprintf(timestr1, "%d", (int)min_tv.tv_usec);
-		if (max_tv.tv_sec != 0) sprintf(timestr2, "%d%06d", (int)max_tv.tv_sec, (int)max_tv.tv_usec);
-		else sprintf(timestr2, "%d", (int)max_tv.tv_usec);
-		printf("avg RTT %f us, std dev %f, min RTT %s us, max RTT %s us\n", avg, std, timestr1, timestr2); fflush(stdout);
-		if (o_output) { fprintf(o_output, "avg RTT %f us, std dev %f, min RTT %s us max RTT %s us\n", avg, std, timestr1, timestr2); fflush(o_output); }
 	}  /* if initator */
 
+#if defined(HAVE_RECVMMSG)
+	else if (o_multi > 0) {  /* not initiator, reflect batches back on other port */
+		struct sigaction sa;
+		/* No SA_RESTART, so a blocked recvmmsg() returns on a signal. */
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = handle_signal;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		stop = 0;
+		multi_reflect_loop(sock, &out_sa);
+	}
+#endif
+
 	else {  /* not initiator, reflect incoming msg back on other port */
 		for (;;) {
 			cur_size = recvfrom(sock, buff, 65536, 0, (struct sockaddr *)&src, &fromlen);
@@ -19,6 +19,10 @@
   THE LIKELIHOOD OF SUCH DAMAGES.
  */
 
+#if defined(__linux__)
+#define _GNU_SOURCE  /* Needed for sendmmsg */
+#endif
+
 #include <string.h>
 #include <time.h>
 
@@ -74,13 +78,25 @@ typedef unsigned long socklen_t;
 #   include <sys\types.h>
 #   include <sys\timeb.h>
 #   define perror(x) fprintf(stderr,"%s: %d\n",x,GetLastError())
+#else
+#   include <sys/time.h>
+#endif
+
+#if defined(__linux__)
+#   include <sys/uio.h>
+#   define HAVE_SENDMMSG
 #endif
 
+#include "mtime.h"
+#include "mwire.h"
+
 
 /* program name (from argv[0] */
 char *prog_name = "xxx";
 
 /* program options (see main() for defaults) */
+int o_ascii;  char *o_ascii_equiv_opt;
+int o_batch;  char o_batch_equiv_opt[32];
 int o_burst_count;
 int o_decimal;
 int o_loops;
@@ -89,20 +105,41 @@ int o_num_bursts;
 int o_pause;
 char *o_Payload = NULL;
 int o_quiet;  char *o_quiet_equiv_opt;
+TLONGLONG o_rate;  TLONGLONG o_Rate_bits;  int o_spin_usec;  char o_rate_equiv_opt[80];
 int o_stat_pause;
 int o_Sndbuf_size;
 int o_tcp;
+char *o_Timer;
 int o_unicast_udp;
 
 #define MIN_DEFAULT_SENDBUF_SIZE 65536
 
+/* sendmmsg() refuses vectors longer than UIO_MAXIOV */
+#define MAX_BATCH 1024
+
 /* program positional parameters */
 unsigned long groupaddr;
 unsigned short groupport;
 unsigned char ttlvar;
 char *bind_if;
 
-char usage_str[] = "[-1|2|3|4|5] [-b burst_count] [-d] [-h] [-l loops] [-m msg_len] [-n num_bursts] [-P payload] [-p pause] [-q] [-S Sndbuf_size] [-s stat_pause] [-t | -u] group port [ttl] [interface]";
+/* send statistics (reported after each loop) */
+TLONGLONG num_syscalls;  /* send calls used for burst messages */
+TLONGLONG num_partial_batches;  /* sendmmsg() calls that sent only part of the batch */
+TLONGLONG max_catchup_run;  /* most msgs sent back-to-back by the pacer */
+
+uint32_t sender_id;  /* for the message header */
+
+#if defined(HAVE_SENDMMSG)
+/* sendmmsg() vector, one pre-formatted buffer per slot (set up in main) */
+struct mmsghdr *batch_msgs = NULL;
+struct iovec *batch_iovs = NULL;
+char *batch_buffs = NULL;
+int batch_slot_size = 0;
+#endif
+
+
+char usage_str[] = "[-1|2|3|4|5] [-A] [-B batch] [-b burst_count] [-d] [-H spin_usec] [-h] [-l loops] [-m msg_len] [-n num_bursts] [-P payload] [-p pause] [-q] [-R Rate_bits | -r rate] [-S Sndbuf_size] [-s stat_pause] [-T Timer] [-t | -u] group port [ttl] [interface]";
 void usage(char *msg)
 {
 	if (msg != NULL)
@@ -125,18 +162,27 @@ void help(char *msg)
 			"  -3 : pre-load opts for moderate load (bursts of 100 8K msgs for 5 seconds)\n"
 			"  -4 : pre-load opts for heavy load (1 burst of 5000 short msgs)\n"
 			"  -5 : pre-load opts for VERY heavy load (1 burst of 50,000 800-byte msgs)\n"
+			"  -A : send legacy ASCII messages (\"Message <seq>\") instead of the binary header\n"
+			"  -B batch : send up to 'batch' messages per sendmmsg() call (Linux only) [0: sendto()]\n"
 			"  -b burst_count : number of messages per burst [1]\n"
-			"  -d : decimal numbers in messages [hex])\n"
+			"  -d : decimal numbers in -A messages [hex])\n"
+			"  -H spin_usec : when paced, sleep until 'spin_usec' before each send, then spin [0: always spin]\n"
 			"  -h : help\n"
 			"  -l loops : number of times to loop test [1]\n"
-			"  -m msg_len : length of each message (0=use length of sequence number) [0]\n"
+			"  -m msg_len : length of each message, at least the 32-byte header [0]\n"
+			"               (with -A, 0=use length of sequence number text)\n"
 			"  -n num_bursts : number of bursts to send (0=infinite) [0]\n"
 			"  -P payload : hex digits for message content (implicit -m)\n"
 			"  -p pause : pause (milliseconds) between bursts [1000]\n"
 			"  -q : loop more quietly (can use '-qq' for complete silence)\n"
+			"  -R Rate_bits : pace messages evenly at 'Rate_bits' bits/sec on the wire (k, m, g suffixes ok)\n"
+			"                 (requires fixed-length messages; -p is ignored) [0: no pacing]\n"
+			"  -r rate : pace messages evenly at 'rate' msgs/sec (k, m, g suffixes ok)\n"
+			"            (-p is ignored; total msgs = num_bursts * burst_count) [0: no pacing]\n"
 			"  -S Sndbuf_size : size (bytes) of UDP send buffer (SO_SNDBUF) [65536]\n"
 			"                   (use 0 for system default buff size)\n"
 			"  -s stat_pause : pause (milliseconds) before sending stat msg (0=no stat) [0]\n"
+			"  -T Timer : clock for pacing and rates: mono, raw, tsc, tscp (qpc on Windows) [mono]\n"
 			"  -t : tcp ('group' becomes destination IP) [multicast]\n"
 			"  -u : unicast udp ('group' becomes destination IP) [multicast]\n"
 			"\n"
@@ -148,6 +194,222 @@ void help(char *msg)
 }  /* help */
 
 
+/* Parse a rate with optional decimal k/m/g suffix (e.g. "1.5m"). */
+TLONGLONG parse_rate(const char *str)
+{
+	char *end;
+	double rate = strtod(str, &end);
+
+	if (*end == 'k' || *end == 'K') { rate *= 1e3; ++end; }
+	else if (*end == 'm' || *end == 'M') { rate *= 1e6; ++end; }
+	else if (*end == 'g' || *end == 'G') { rate *= 1e9; ++end; }
+	if (*end != '\0' || rate < 0.0) {
+		fprintf(stderr, "Error, invalid rate '%s'\n", str);
+		exit(1);
+	}
+	return (TLONGLONG)rate;
+}  /* parse_rate */
+
+
+/* Sleep for (at least) the given number of nanoseconds. */
+void sleep_ns(TLONGLONG ns)
+{
+#if defined(_WIN32)
+	if (ns >= 1000000)
+		Sleep((DWORD)(ns / 1000000));
+#else
+	struct timespec ts;
+	ts.tv_sec = (time_t)(ns / 1000000000);
+	ts.tv_nsec = (long)(ns % 1000000000);
+	nanosleep(&ts, NULL);
+#endif /* _WIN32 */
+}  /* sleep_ns */
+
+
+/* Fill in message number 'msg_num' and return its length.  Also prints
+ * the per-burst progress for the first message of each burst. */
+int format_msg(char *msg_buf, int msg_buf_size, TLONGLONG msg_num)
+{
+	int send_len = o_msg_len;
+
+	if (o_Payload) {
+		/* fixed payload already in msg_buf */
+	}
+	else if (! o_ascii) {
+		mwire_encode(msg_buf, MWIRE_TYPE_DATA, sender_id, 0, (uint64_t)msg_num,
+				mtime_wall_ns(), send_len - MWIRE_HDR_LEN);
+	}
+	else {
+		if (o_decimal)
+			snprintf(msg_buf,msg_buf_size,"Message %lld",(long long)msg_num);
+		else
+			snprintf(msg_buf,msg_buf_size,"Message %llx",(unsigned long long)msg_num);
+		if (o_msg_len == 0)
+			send_len = (int)strlen(msg_buf);
+	}
+
+	if (msg_num % o_burst_count == 0) {  /* first msg in burst */
+		if (o_quiet == 0) {  /* not quiet */
+			if (o_burst_count == 1)
+				printf("Sending %d bytes\n", send_len);
+			else
+				printf("Sending burst of %d msgs\n",
+						o_burst_count);
+		}
+		else if (o_quiet == 1) {  /* pretty quiet */
+			printf(".");
+			fflush(stdout);
+		}
+		/* else o_quiet > 1; very quiet */
+	}
+
+	return send_len;
+}  /* format_msg */
+
+
+#if defined(HAVE_SENDMMSG)
+/* Send a vector of pre-formatted datagrams.  If the kernel only takes part
+ * of the vector, resubmit the remainder until all are sent. */
+void send_batch(SOCKET sock, struct mmsghdr *msgs, int num_msgs)
+{
+	int num_done = 0;
+	int send_rtn, i;
+
+	while (num_done < num_msgs) {
+		send_rtn = sendmmsg(sock, &msgs[num_done], num_msgs - num_done, 0);
+		++num_syscalls;
+		if (send_rtn == SOCKET_ERROR) {
+			fprintf(stderr, "ERROR: ");  perror("sendmmsg");
+			exit(1);
+		}
+		if (send_rtn < num_msgs - num_done)
+			++num_partial_batches;
+
+		for (i = num_done; i < num_done + send_rtn; ++i) {
+			if (msgs[i].msg_len != msgs[i].msg_hdr.msg_iov->iov_len) {
+				fprintf(stderr, "ERROR: sendmmsg sent %d, expected %d\n",
+						(int)msgs[i].msg_len, (int)msgs[i].msg_hdr.msg_iov->iov_len);
+				exit(1);
+			}
+		}
+		num_done += send_rtn;
+	}
+}  /* send_batch */
+#endif /* HAVE_SENDMMSG */
+
+
+/* Send 'num_msgs' messages starting at 'msg_num', as sendmmsg() batches if
+ * -B was given.  Returns the next message number. */
+TLONGLONG send_msgs(SOCKET sock, struct sockaddr_in *sin, char *buff, TLONGLONG msg_num, int num_msgs)
+{
+	int send_len;
+	int send_rtn;
+	int i;
+
+#if defined(HAVE_SENDMMSG)
+	if (o_batch > 0) {
+		int batch_len;
+		while (num_msgs > 0) {
+			batch_len = (num_msgs < o_batch) ? num_msgs : o_batch;
+			for (i = 0; i < batch_len; ++i) {
+				batch_iovs[i].iov_len = format_msg(&batch_buffs[i * batch_slot_size],
+						batch_slot_size, msg_num + i);
+			}
+			send_batch(sock, batch_msgs, batch_len);
+
+			msg_num += batch_len;
+			num_msgs -= batch_len;
+		}
+		return msg_num;
+	}
+#endif /* HAVE_SENDMMSG */
+
+	for (i = 0; i < num_msgs; ++i) {
+		send_len = format_msg(buff, 65535, msg_num);
+
+		send_rtn = (int)sendto(sock,buff,send_len,0,(struct sockaddr *)sin,sizeof(*sin));
+		++num_syscalls;
+		if (send_rtn == SOCKET_ERROR) {
+			fprintf(stderr, "ERROR: ");  perror("send");
+			exit(1);
+		}
+		else if (send_rtn != send_len) {
+			fprintf(stderr, "ERROR: sendto returned %d, expected %d\n",
+					send_rtn, send_len);
+			exit(1);
+		}
+
+		++msg_num;
+	}  /* for i */
+
+	return msg_num;
+}  /* send_msgs */
+
+
+/* Send 'num_msgs' messages (0=infinite) evenly spaced at the -r or -R rate.
+ * Each message has an absolute deadline measured from the start, so a late
+ * wakeup is caught up with immediately instead of accumulating as drift.
+ * Based on algorithm: http://www.geeky-boy.com/catchup/html/
+ * Returns the number of messages sent. */
+TLONGLONG paced_send(SOCKET sock, struct sockaddr_in *sin, char *buff, TLONGLONG num_msgs)
+{
+	TLONGLONG rate;  /* units per second */
+	TLONGLONG units_per_msg;  /* 1 for msgs/sec, wire bits for bits/sec */
+	TLONGLONG start_ns, ns_so_far, next_ns, wait_ns;
+	TLONGLONG should_have_sent, num_sent, run;
+	TLONGLONG msg_num = 0;
+
+	if (o_Rate_bits > 0) {
+		rate = o_Rate_bits;
+		units_per_msg = (TLONGLONG)8 * (
+			(TLONGLONG)o_msg_len  /* UDP payload */
+			+ 8  /* UDP header */
+			+ 20  /* IP header */
+			+ 14  /* Ethernet header */
+			+ 4  /* Ethernet FCS */
+			+ 12);  /* Interframe gap (96 bits) */
+	} else {
+		rate = o_rate;
+		units_per_msg = 1;
+	}
+
+	max_catchup_run = 0;
+	num_sent = 0;
+	start_ns = mtime_ns();
+	for (;;) {
+		ns_so_far = mtime_ns() - start_ns;
+		/* Split into whole and fractional seconds so that long runs at high
+		 * rates cannot overflow. The +1 is because we want to send, then pause. */
+		should_have_sent = ((ns_so_far / 1000000000) * rate
+				+ (TLONGLONG)((double)(ns_so_far % 1000000000) * (double)rate / 1e9))
+				/ units_per_msg + 1;
+		if (num_msgs > 0 && should_have_sent > num_msgs)
+			should_have_sent = num_msgs;
+
+		/* If we are behind where we should be, get caught up. */
+		run = should_have_sent - num_sent;
+		if (run > 0) {
+			if (run > max_catchup_run)
+				max_catchup_run = run;
+			msg_num = send_msgs(sock, sin, buff, msg_num, (int)run);
+			num_sent += run;
+		}
+		if (num_msgs > 0 && num_sent >= num_msgs)
+			break;
+
+		if (o_spin_usec > 0) {
+			/* Hybrid: sleep away most of the gap, spin for the rest. */
+			next_ns = start_ns + (TLONGLONG)((double)num_sent * (double)units_per_msg * 1e9 / (double)rate);
+			wait_ns = next_ns - mtime_ns() - (TLONGLONG)o_spin_usec * 1000;
+			if (wait_ns > 0)
+				sleep_ns(wait_ns);
+		}
+	}  /* for ;; */
+
+	return msg_num;
+}  /* paced_send */
+
+
 int main(int argc, char **argv)
 {
 	int opt;
@@ -161,11 +423,12 @@ int main(int argc, char **argv)
 	struct sockaddr_in sin;
 	struct timeval tv = {1,0};
 	unsigned int wttl;
-	int burst_num;  /* number of bursts so far */
-	int msg_num;  /* number of messages so far */
+	TLONGLONG burst_num;  /* number of bursts so far */
+	TLONGLONG msg_num;  /* number of messages so far */
 	int send_len;  /* size of datagram to send */
 	int sz, default_sndbuf_sz, check_size, i;
 	int send_rtn;
+	TLONGLONG burst_start_ns, burst_ns;
 #if defined(_WIN32)
 	unsigned long int iface_in;
 #else
@@ -204,7 +467,9 @@ int main(int argc, char **argv)
 	CLOSESOCKET(sock);
 
 	/* default option values (declared as module globals) */
+	o_batch = 0;  o_batch_equiv_opt[0] = '\0';  /* sendto() per message */
 	o_burst_count = 1;  /* 1 message per "burst" */
+	o_ascii = 0;  /* binary message header */
 	o_decimal = 0;  /* hex numbers in message text */
 	o_loops = 1;  /* number of time to loop test */
 	o_msg_len = 0;  /* variable */
@@ -212,9 +477,12 @@ int main(int argc, char **argv)
 	o_pause = 1000;  /* seconds between bursts */
 	o_Payload = NULL;
 	o_quiet = 0;  o_quiet_equiv_opt = " ";
+	o_rate = 0;  o_Rate_bits = 0;  o_spin_usec = 0;  /* no pacing */
+	o_rate_equiv_opt[0] = '\0';
 	o_stat_pause = 0;  /* no stat message */
 	o_Sndbuf_size = MIN_DEFAULT_SENDBUF_SIZE;  o_Sndbuf_set = 0;
 	o_tcp = 0;  /* 0 for udp (multicast or unicast) */
+	o_Timer = NULL;  /* platform default clock */
 	o_unicast_udp = 0;  /* 0 for multicast or tcp */
 
 	/* default values for optional positional parms. */
@@ -222,7 +490,7 @@ int main(int argc, char **argv)
 	bind_if = NULL;
 
 	test_num = -1;
-	while ((opt = tgetopt(argc, argv, "12345b:dhl:m:n:p:P:qs:S:tu")) != EOF) {
+	while ((opt = tgetopt(argc, argv, "12345AB:b:dH:hl:m:n:p:P:qR:r:s:S:T:tu")) != EOF) {
 		switch (opt) {
 		  case '1':
 			test_num = 1;
@@ -279,12 +547,35 @@ int main(int argc, char **argv)
 			o_stat_pause = 2000;
 			o_Sndbuf_size = default_sndbuf_sz;  o_Sndbuf_set = 0;
 			break;
+		  case 'B':
+			o_batch = atoi(toptarg);
+			if (o_batch < 0 || o_batch > MAX_BATCH) {
+				fprintf(stderr, "Error, batch must be 0..%d\n", MAX_BATCH);
+				exit(1);
+			}
+#if !defined(HAVE_SENDMMSG)
+			if (o_batch > 0) {
+				fprintf(stderr, "Error, -B not supported on this platform\n");
+				exit(1);
+			}
+#endif
+			if (o_batch > 0)
+				snprintf(o_batch_equiv_opt, sizeof(o_batch_equiv_opt), "-B%d ", o_batch);
+			else
+				o_batch_equiv_opt[0] = '\0';
+			break;
+		  case 'A':
+			o_ascii = 1;
+			break;
 		  case 'b':
 			o_burst_count = atoi(toptarg);
 			break;
 		  case 'd':
 			o_decimal = 1;
 			break;
+		  case 'H':
+			o_spin_usec = atoi(toptarg);
+			break;
 		  case 'h':
 			help(NULL);  exit(0);
 			break;
@@ -351,12 +642,21 @@ int main(int argc, char **argv)
 			else
 				o_quiet = 2;  /* never greater than 2 */
 			break;
+		  case 'R':
+			o_Rate_bits = parse_rate(toptarg);
+			break;
+		  case 'r':
+			o_rate = parse_rate(toptarg);
+			break;
 		  case 's':
 			o_stat_pause = atoi(toptarg);
 			break;
 		  case 'S':
 			o_Sndbuf_size = atoi(toptarg);  o_Sndbuf_set = 1;
 			break;
+		  case 'T':
+			o_Timer = toptarg;
+			break;
 		  case 't':
 			if (o_unicast_udp) {
 				fprintf(stderr, "Error, -t and -u are mutually exclusive\n");
@@ -378,8 +678,39 @@ int main(int argc, char **argv)
 		}  /* switch */
 	}  /* while opt */
 
-	/* prevent careless usage from killing the network */
-	if (o_num_bursts == 0 && (o_burst_count > 50 || o_pause < 100)) {
+	if (o_tcp && o_batch > 0) {
+		fprintf(stderr, "Error, -B and -t are mutually exclusive\n");
+		exit(1);
+	}
+
+	if (o_rate > 0 && o_Rate_bits > 0) {
+		fprintf(stderr, "Error, -r and -R are mutually exclusive\n");
+		exit(1);
+	}
+	/* binary messages always carry at least the header */
+	if (! o_ascii && ! o_Payload && o_msg_len < MWIRE_HDR_LEN)
+		o_msg_len = MWIRE_HDR_LEN;
+	if (o_ascii)
+		o_ascii_equiv_opt = (o_decimal) ? " -A -d " : " -A ";
+	else
+		o_ascii_equiv_opt = " ";
+
+	if (o_Rate_bits > 0 && o_msg_len == 0) {
+		fprintf(stderr, "Error, -R with -A requires fixed-length messages (-m or -P)\n");
+		exit(1);
+	}
+	if (o_rate > 0)
+		snprintf(o_rate_equiv_opt, sizeof(o_rate_equiv_opt), "-r%.0f ", (double)o_rate);
+	else if (o_Rate_bits > 0)
+		snprintf(o_rate_equiv_opt, sizeof(o_rate_equiv_opt), "-R%.0f ", (double)o_Rate_bits);
+	if ((o_rate > 0 || o_Rate_bits > 0) && o_spin_usec > 0)
+		snprintf(&o_rate_equiv_opt[strlen(o_rate_equiv_opt)],
+				sizeof(o_rate_equiv_opt) - strlen(o_rate_equiv_opt), "-H%d ", o_spin_usec);
+
+	/* prevent careless usage from killing the network (a paced run is
+	 * bounded by its rate, so it may run forever) */
+	if (o_num_bursts == 0 && o_rate == 0 && o_Rate_bits == 0
+			&& (o_burst_count > 50 || o_pause < 100)) {
 		usage("Danger - heavy traffic chosen with infinite num bursts.\nUse -n to limit execution time");
 		exit(1);
 	}
@@ -392,8 +723,8 @@ int main(int argc, char **argv)
 		groupaddr = inet_addr(argv[toptind]);
 		groupport = (unsigned short)atoi(argv[toptind+1]);
 		if (o_quiet < 2)
-			snprintf(equiv_cmd, sizeof(equiv_cmd), "msend -b%d%s-m%d -n%d -p%d%s-s%d -S%d%s%s %s",
-				o_burst_count, (o_decimal)?" -d ":" ", o_msg_len, o_num_bursts,
+			snprintf(equiv_cmd, sizeof(equiv_cmd), "msend %s%s-b%d%s-m%d -n%d -p%d%s-s%d -S%d%s%s %s",
+				o_batch_equiv_opt, o_rate_equiv_opt, o_burst_count, o_ascii_equiv_opt, o_msg_len, o_num_bursts,
 				o_pause, o_quiet_equiv_opt, o_stat_pause, o_Sndbuf_size,
 				(o_tcp) ? " -t " : ((o_unicast_udp) ? " -u " : " "),
 				argv[toptind],argv[toptind+1]);
@@ -411,8 +742,8 @@ int main(int argc, char **argv)
 		}
 		ttlvar = (unsigned char)atoi(argv[toptind+2]);
 		if (o_quiet < 2)
-			snprintf(equiv_cmd, sizeof(equiv_cmd), "msend -b%d%s-m%d -n%d -p%d%s-s%d -S%d%s%s %s %s",
-				o_burst_count, (o_decimal)?" -d ":" ", o_msg_len, o_num_bursts,
+			snprintf(equiv_cmd, sizeof(equiv_cmd), "msend %s%s-b%d%s-m%d -n%d -p%d%s-s%d -S%d%s%s %s %s",
+				o_batch_equiv_opt, o_rate_equiv_opt, o_burst_count, o_ascii_equiv_opt, o_msg_len, o_num_bursts,
 				o_pause, o_quiet_equiv_opt, o_stat_pause, o_Sndbuf_size,
 				(o_tcp) ? " -t " : ((o_unicast_udp) ? " -u " : " "),
 				argv[toptind],argv[toptind+1],argv[toptind+2]);
@@ -424,8 +755,8 @@ int main(int argc, char **argv)
 		ttlvar = (unsigned char)atoi(argv[toptind+2]);
 		bind_if = argv[toptind+3];
 		if (o_quiet < 2)
-			snprintf(equiv_cmd, sizeof(equiv_cmd), "msend -b%d%s-m%d -n%d -p%d%s-s%d -S%d%s%s %s %s %s",
-				o_burst_count, (o_decimal)?" -d ":" ", o_msg_len, o_num_bursts,
+			snprintf(equiv_cmd, sizeof(equiv_cmd), "msend %s%s-b%d%s-m%d -n%d -p%d%s-s%d -S%d%s%s %s %s %s",
+				o_batch_equiv_opt, o_rate_equiv_opt, o_burst_count, o_ascii_equiv_opt, o_msg_len, o_num_bursts,
 				o_pause, o_quiet_equiv_opt, o_stat_pause, o_Sndbuf_size,
 				(o_tcp) ? " -t " : ((o_unicast_udp) ? " -u " : " "),
 				argv[toptind],argv[toptind+1],argv[toptind+2],bind_if);
@@ -436,6 +767,16 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (mtime_init(o_Timer) != 0)
+		exit(1);
+	sender_id = mwire_new_sender_id();
+	if (o_quiet < 2) {
+		printf("Timer: %s\n", mtime_describe(cmdbuf, sizeof(cmdbuf)));
+		if (! o_ascii && ! o_Payload)
+			printf("Sender ID: %08x\n", sender_id);
+		fflush(stdout);
+	}
+
 	/* Only warn about small default send buf if no sendbuf option supplied */
 	if (default_sndbuf_sz < MIN_DEFAULT_SENDBUF_SIZE && o_Sndbuf_set == 0)
 		fprintf(stderr, "NOTE: system default SO_SNDBUF only %d (%d preferred)\n", default_sndbuf_sz, MIN_DEFAULT_SENDBUF_SIZE);
@@ -511,6 +852,36 @@ int main(int argc, char **argv)
 		}
 	}
 
+#if defined(HAVE_SENDMMSG)
+	if (o_batch > 0) {
+		/* One buffer per batch slot so each datagram keeps its own sequence
+		 * number.  A fixed payload (-P) is shared by all slots. */
+		batch_slot_size = (o_msg_len > 64) ? o_msg_len : 64;
+		batch_msgs = (struct mmsghdr *)malloc(o_batch * sizeof(*batch_msgs));
+		batch_iovs = (struct iovec *)malloc(o_batch * sizeof(*batch_iovs));
+		if (o_Payload)
+			batch_buffs = buff;
+		else
+			batch_buffs = (char *)malloc((size_t)o_batch * batch_slot_size);
+		if (batch_msgs == NULL || batch_iovs == NULL || batch_buffs == NULL) {
+			fprintf(stderr, "malloc failed\n"); exit(1);
+		}
+		if (! o_Payload)
+			memset(batch_buffs, 0, (size_t)o_batch * batch_slot_size);
+
+		for (i = 0; i < o_batch; ++i) {
+			batch_iovs[i].iov_base = (o_Payload) ? buff : &batch_buffs[i * batch_slot_size];
+			batch_iovs[i].iov_len = o_msg_len;
+
+			memset(&batch_msgs[i], 0, sizeof(batch_msgs[i]));
+			batch_msgs[i].msg_hdr.msg_name = &sin;
+			batch_msgs[i].msg_hdr.msg_namelen = sizeof(sin);
+			batch_msgs[i].msg_hdr.msg_iov = &batch_iovs[i];
+			batch_msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+	}
+#endif /* HAVE_SENDMMSG */
+
 
 /* Loop the test "o_loops" times (-l option) */
 MAIN_LOOP:
@@ -550,53 +921,28 @@ MAIN_LOOP:
 
 	burst_num = 0;
 	msg_num = 0;
-	while (o_num_bursts == 0 || burst_num < o_num_bursts) {
-		if (o_pause > 0 && msg_num > 0)
-			SLEEP_MSEC(o_pause);
-
-		/* send burst */
-		for (i = 0; i < o_burst_count; ++i) {
-			send_len = o_msg_len;
-			if (! o_Payload) {
-				if (o_decimal)
-					snprintf(buff,65535,"Message %d",msg_num);
-				else
-					snprintf(buff,65535,"Message %x",msg_num);
-				if (o_msg_len == 0)
-					send_len = (int)strlen(buff);
-			}
-
-			if (i == 0) {  /* first msg in batch */
-				if (o_quiet == 0) {  /* not quiet */
-					if (o_burst_count == 1)
-						printf("Sending %d bytes\n", send_len);
-					else
-						printf("Sending burst of %d msgs\n",
-								o_burst_count);
-				}
-				else if (o_quiet == 1) {  /* pretty quiet */
-					printf(".");
-					fflush(stdout);
-				}
-				/* else o_quiet > 1; very quiet */
-			}
-
-			send_rtn = (int)sendto(sock,buff,send_len,0,(struct sockaddr *)&sin,sizeof(sin));
-			if (send_rtn == SOCKET_ERROR) {
-				fprintf(stderr, "ERROR: ");  perror("send");
-				exit(1);
-			}
-			else if (send_rtn != send_len) {
-				fprintf(stderr, "ERROR: sendto returned %d, expected %d\n",
-						send_rtn, send_len);
-				exit(1);
-			}
+	num_syscalls = 0;
+	num_partial_batches = 0;
+	burst_ns = 0;
+	if (o_rate > 0 || o_Rate_bits > 0) {
+		/* evenly paced; pause between bursts does not apply */
+		burst_start_ns = mtime_ns();
+		msg_num = paced_send(sock, &sin, buff, (TLONGLONG)o_num_bursts * o_burst_count);
+		burst_ns = mtime_ns() - burst_start_ns;
+	}
+	else {
+		while (o_num_bursts == 0 || burst_num < o_num_bursts) {
+			if (o_pause > 0 && msg_num > 0)
+				SLEEP_MSEC(o_pause);
 
-			++msg_num;
-		}  /* for i */
+			/* send burst */
+			burst_start_ns = mtime_ns();
+			msg_num = send_msgs(sock, &sin, buff, msg_num, o_burst_count);
+			burst_ns += mtime_ns() - burst_start_ns;
 
-		++ burst_num;
-	}  /* while */
+			++ burst_num;
+		}  /* while */
+	}
 
 	if (o_stat_pause > 0) {
 		/* send 'stat' message */
@@ -605,8 +951,13 @@ MAIN_LOOP:
 		SLEEP_MSEC(o_stat_pause);
 		if (o_quiet < 2)
 			printf("Sending stat\n");
-		snprintf(cmdbuf, sizeof(cmdbuf), "stat %d", msg_num);
-		send_len = (int)strlen(cmdbuf);
+		if (o_ascii) {
+			snprintf(cmdbuf, sizeof(cmdbuf), "stat %lld", (long long)msg_num);
+			send_len = (int)strlen(cmdbuf);
+		} else {
+			mwire_encode(cmdbuf, MWIRE_TYPE_STAT, sender_id, 0, (uint64_t)msg_num, mtime_wall_ns(), 0);
+			send_len = MWIRE_HDR_LEN;
+		}
 		send_rtn = (int)sendto(sock,cmdbuf,send_len,0,(struct sockaddr *)&sin,sizeof(sin));
 		if (send_rtn == SOCKET_ERROR) {
 			fprintf(stderr, "ERROR: ");  perror("send");
@@ -619,11 +970,26 @@ MAIN_LOOP:
 		}
 
 		if (o_quiet < 2)
-			printf("%d messages sent (not including 'stat')\n", msg_num);
+			printf("%.0f messages sent (not including 'stat')\n", (double)msg_num);
 	}
 	else {
 		if (o_quiet < 2)
-			printf("%d messages sent\n", msg_num);
+			printf("%.0f messages sent\n", (double)msg_num);
+	}
+
+	if (o_quiet < 2 && msg_num > 0 && burst_ns > 0) {
+		printf("%.0f msgs in %.0f send calls (%.3f calls/msg, %.0f partial batches), %.0f msgs/sec within bursts\n",
+				(double)msg_num, (double)num_syscalls,
+				(double)num_syscalls / (double)msg_num,
+				(double)num_partial_batches,
+				(double)msg_num * 1000000000.0 / (double)burst_ns);
+		if (o_rate > 0)
+			printf("Paced at %.0f msgs/sec, %.0f max catch-up msgs\n",
+					(double)o_rate, (double)max_catchup_run);
+		else if (o_Rate_bits > 0)
+			printf("Paced at %.0f bits/sec, %.0f max catch-up msgs\n",
+					(double)o_Rate_bits, (double)max_catchup_run);
+		fflush(stdout);
 	}
 
 	/* Loop the test "o_loops" times (-l option) */
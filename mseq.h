@@ -0,0 +1,249 @@
+/* mseq.h */
+/*   Sliding-window sequence number tracker shared by the mtools programs.
+ * See https://github.com/UltraMessaging/mtools
+ *
+ * A bitmap remembers which of the last MSEQ_WINDOW sequence numbers (up
+ * to the highest seen) have arrived.  That separates a gap (a jump
+ * ahead), a late arrival that fills one (reordering, with its depth
+ * behind the highest), a duplicate, and loss: a sequence number that
+ * leaves the window without arriving.  Memory is fixed, so the tracker
+ * can run for any length of time; sequence numbers are 64 bits.
+ *
+ * Like mtime.h, this header holds definitions; include it once.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef MSEQ_H
+#define MSEQ_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define MSEQ_WINDOW_BITS 16
+#define MSEQ_WINDOW (1 << MSEQ_WINDOW_BITS)  /* 65536 sequence numbers, 8 KB */
+#define MSEQ_WORDS (MSEQ_WINDOW / 64)
+#define MSEQ_DEPTH_BUCKETS (MSEQ_WINDOW_BITS + 1)  /* log2 of reorder depth */
+
+/* mseq_record() results. */
+#define MSEQ_IN_ORDER 0
+#define MSEQ_GAP 1  /* ahead of the next expected; 'last_gap' were skipped */
+#define MSEQ_LATE 2  /* filled a gap */
+#define MSEQ_DUP 3
+#define MSEQ_TOO_OLD 4  /* behind the window (counted as lost) or before the first */
+
+typedef struct mseq_s {
+	int started;
+	uint64_t first;  /* first sequence number received */
+	uint64_t high;  /* highest sequence number received */
+	uint64_t bits[MSEQ_WORDS];  /* bit (seq % MSEQ_WINDOW) set if received */
+	uint64_t num_msgs;  /* distinct sequence numbers received */
+	uint64_t num_gaps;
+	uint64_t num_gap_msgs;  /* sequence numbers skipped by gaps */
+	uint64_t last_gap;
+	uint64_t num_late;
+	uint64_t num_dups;
+	uint64_t num_too_old;
+	uint64_t num_lost;  /* left the window without arriving */
+	uint64_t depth_hist[MSEQ_DEPTH_BUCKETS];  /* late arrivals by log2(high - seq) */
+} mseq_t;
+
+
+int mseq_popcount(uint64_t word)
+{
+#if defined(__GNUC__)
+	return __builtin_popcountll(word);
+#elif defined(_MSC_VER) && defined(_WIN64)
+	return (int)__popcnt64(word);
+#else
+	int n = 0;
+	while (word != 0) {
+		word &= word - 1;
+		n++;
+	}
+	return n;
+#endif
+}  /* mseq_popcount */
+
+int mseq_log2(uint64_t val)
+{
+	int n = 0;
+	while (val >>= 1)
+		n++;
+	return n;
+}  /* mseq_log2 */
+
+
+void mseq_init(mseq_t *seq)
+{
+	memset((char *)seq, 0, sizeof(*seq));
+}  /* mseq_init */
+
+
+/* Move the window ahead so that 'new_high' is its top.  Sequence numbers
+ * that leave it unreceived are lost. */
+void mseq_advance(mseq_t *seq, uint64_t new_high)
+{
+	uint64_t s = seq->high + 1;
+	int i;
+
+	if (new_high - seq->high >= MSEQ_WINDOW) {
+		/* Everything in the window leaves, as does anything skipped past it. */
+		for (i = 0; i < MSEQ_WORDS; i++) {
+			seq->num_lost += 64 - mseq_popcount(seq->bits[i]);
+			seq->bits[i] = 0;
+		}
+		seq->num_lost += new_high - seq->high - MSEQ_WINDOW;
+	}
+	else {
+		/* Each entering sequence number reuses the bit of the one leaving. */
+		while (s <= new_high) {
+			int bit = (int)(s & 63);
+			uint64_t n = 64 - bit;
+			uint64_t mask;
+			uint64_t *word = &seq->bits[(s & (MSEQ_WINDOW - 1)) >> 6];
+			if (n > new_high - s + 1)
+				n = new_high - s + 1;
+			mask = (n == 64) ? ~(uint64_t)0 : (((uint64_t)1 << n) - 1) << bit;
+			seq->num_lost += n - mseq_popcount(*word & mask);
+			*word &= ~mask;
+			s += n;
+		}
+	}
+	seq->high = new_high;
+}  /* mseq_advance */
+
+
+/* Account for one received sequence number.  Returns MSEQ_IN_ORDER,
+ * MSEQ_GAP, MSEQ_LATE, MSEQ_DUP or MSEQ_TOO_OLD. */
+int mseq_record(mseq_t *seq, uint64_t sqn)
+{
+	uint64_t *word;
+	uint64_t bit;
+	int result = MSEQ_IN_ORDER;
+
+	if (!seq->started) {
+		/* Treat the window behind the first as received, so it is not lost. */
+		memset((char *)seq->bits, 0xff, sizeof(seq->bits));
+		seq->started = 1;
+		seq->first = sqn;
+		seq->high = sqn;
+		seq->num_msgs = 1;
+		return MSEQ_IN_ORDER;
+	}
+
+	if (sqn > seq->high) {
+		if (sqn != seq->high + 1) {
+			seq->last_gap = sqn - seq->high - 1;
+			seq->num_gaps++;
+			seq->num_gap_msgs += seq->last_gap;
+			result = MSEQ_GAP;
+		}
+		mseq_advance(seq, sqn);
+		seq->bits[(sqn & (MSEQ_WINDOW - 1)) >> 6] |= (uint64_t)1 << (sqn & 63);
+		seq->num_msgs++;
+		return result;
+	}
+
+	if (seq->high - sqn >= MSEQ_WINDOW || sqn < seq->first) {
+		seq->num_too_old++;
+		return MSEQ_TOO_OLD;
+	}
+	word = &seq->bits[(sqn & (MSEQ_WINDOW - 1)) >> 6];
+	bit = (uint64_t)1 << (sqn & 63);
+	if (*word & bit) {
+		seq->num_dups++;
+		return MSEQ_DUP;
+	}
+	*word |= bit;
+	seq->num_msgs++;
+	seq->num_late++;
+	seq->depth_hist[mseq_log2(seq->high - sqn)]++;
+	return MSEQ_LATE;
+}  /* mseq_record */
+
+
+/* Sequence numbers in the window that have not arrived (yet). */
+uint64_t mseq_missing(const mseq_t *seq)
+{
+	uint64_t n = 0;
+	int i;
+
+	if (!seq->started)
+		return 0;
+	for (i = 0; i < MSEQ_WORDS; i++)
+		n += 64 - mseq_popcount(seq->bits[i]);
+	return n;
+}  /* mseq_missing */
+
+
+/* Add the counts of 'src' into 'dst' (not the window). */
+void mseq_merge(mseq_t *dst, const mseq_t *src)
+{
+	int i;
+
+	dst->num_msgs += src->num_msgs;
+	dst->num_gaps += src->num_gaps;
+	dst->num_gap_msgs += src->num_gap_msgs;
+	dst->num_late += src->num_late;
+	dst->num_dups += src->num_dups;
+	dst->num_too_old += src->num_too_old;
+	dst->num_lost += src->num_lost + mseq_missing(src);
+	for (i = 0; i < MSEQ_DEPTH_BUCKETS; i++)
+		dst->depth_hist[i] += src->depth_hist[i];
+}  /* mseq_merge */
+
+
+/* One-line summary.  Unrecovered loss includes what is still missing
+ * from the window. */
+char *mseq_describe(const mseq_t *seq, char *buf, int buf_size)
+{
+	snprintf(buf, buf_size,
+			"%llu gaps (%llu msgs), %llu late, %llu dups, %llu too old, %llu unrecovered loss",
+			(unsigned long long)seq->num_gaps, (unsigned long long)seq->num_gap_msgs,
+			(unsigned long long)seq->num_late, (unsigned long long)seq->num_dups,
+			(unsigned long long)seq->num_too_old,
+			(unsigned long long)(seq->num_lost + mseq_missing(seq)));
+	return buf;
+}  /* mseq_describe */
+
+
+/* Reorder depths of late arrivals as "1:N 2-3:N 4-7:N ..." (non-zero
+ * buckets only). */
+char *mseq_describe_depths(const mseq_t *seq, char *buf, int buf_size)
+{
+	int len = 0;
+	int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < MSEQ_DEPTH_BUCKETS && len < buf_size; i++) {
+		uint64_t lo = (uint64_t)1 << i;
+		if (seq->depth_hist[i] == 0)
+			continue;
+		if (i == 0)
+			len += snprintf(&buf[len], buf_size - len, "%s1:%llu", (len > 0) ? " " : "",
+					(unsigned long long)seq->depth_hist[i]);
+		else
+			len += snprintf(&buf[len], buf_size - len, "%s%llu-%llu:%llu", (len > 0) ? " " : "",
+					(unsigned long long)lo, (unsigned long long)(2 * lo - 1),
+					(unsigned long long)seq->depth_hist[i]);
+	}
+	return buf;
+}  /* mseq_describe_depths */
+
+#endif /* MSEQ_H */
@@ -0,0 +1,248 @@
+/* mtime.h */
+/*   Nanosecond timing shared by the mtools programs.
+ * See https://github.com/UltraMessaging/mtools
+ *
+ * Each mtools program is built from a single source file, so this header
+ * holds the definitions as well as the declarations; include it once.
+ *
+ * Clocks (select with mtime_init()):
+ *   mono - clock_gettime(CLOCK_MONOTONIC) (default)
+ *   raw  - clock_gettime(CLOCK_MONOTONIC_RAW) (Linux; not slewed by NTP)
+ *   tsc  - rdtsc, calibrated against the kernel clock at startup (x86)
+ *   tscp - rdtscp, like tsc but waits for prior instructions to finish
+ *   qpc  - QueryPerformanceCounter (Windows default)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef MTIME_H
+#define MTIME_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#   include <windows.h>
+#else
+#   include <sys/time.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#   include <x86intrin.h>
+#   include <cpuid.h>
+#   define MTIME_HAVE_TSC
+#endif
+
+#define MTIME_MONO 0
+#define MTIME_RAW 1
+#define MTIME_TSC 2
+#define MTIME_TSCP 3
+#define MTIME_QPC 4
+
+#define MTIME_CALIBRATE_NS 50000000  /* 50 ms */
+#define MTIME_COST_LOOPS 10000
+
+int mtime_clock = MTIME_MONO;
+double mtime_read_cost_ns;  /* measured by mtime_init() */
+int64_t mtime_wall_offset_ns;  /* mtime_ns() + offset = ns since epoch */
+
+#if defined(MTIME_HAVE_TSC)
+uint64_t mtime_tsc_base;  /* tick count at calibration */
+uint64_t mtime_tsc_base_ns;  /* kernel clock at calibration */
+uint64_t mtime_tsc_mult;  /* ns per tick, scaled by 2^32 */
+double mtime_tsc_mhz;
+#endif
+
+#if defined(_WIN32)
+LARGE_INTEGER mtime_qpc_freq;
+#endif
+
+
+/* Read the kernel's monotonic clock (or its nearest equivalent). */
+uint64_t mtime_kernel_ns(int clock)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER ticks;
+	QueryPerformanceCounter(&ticks);
+	/* Split to avoid overflow of ticks * 1e9. */
+	return (uint64_t)(ticks.QuadPart / mtime_qpc_freq.QuadPart) * 1000000000
+		+ (uint64_t)(ticks.QuadPart % mtime_qpc_freq.QuadPart) * 1000000000
+			/ (uint64_t)mtime_qpc_freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+#   if defined(CLOCK_MONOTONIC_RAW)
+	clock_gettime((clock == MTIME_RAW) ? CLOCK_MONOTONIC_RAW : CLOCK_MONOTONIC, &ts);
+#   else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#   endif
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+#endif
+}  /* mtime_kernel_ns */
+
+
+/* Current time in nanoseconds from the selected clock.  Only differences
+ * between two readings are meaningful. */
+uint64_t mtime_ns(void)
+{
+#if defined(MTIME_HAVE_TSC)
+	if (mtime_clock == MTIME_TSC || mtime_clock == MTIME_TSCP) {
+		unsigned int aux;
+		uint64_t ticks = (mtime_clock == MTIME_TSC) ? __rdtsc() : __rdtscp(&aux);
+		uint64_t delta = ticks - mtime_tsc_base;
+#   if defined(__x86_64__)
+		return mtime_tsc_base_ns + (uint64_t)(((unsigned __int128)delta * mtime_tsc_mult) >> 32);
+#   else
+		/* No 128-bit type on 32-bit x86: (delta * mult) >> 32 from 32-bit halves. */
+		uint64_t d_hi = delta >> 32, d_lo = delta & 0xffffffff;
+		uint64_t m_hi = mtime_tsc_mult >> 32, m_lo = mtime_tsc_mult & 0xffffffff;
+		return mtime_tsc_base_ns + ((d_hi * m_hi) << 32) + d_hi * m_lo + d_lo * m_hi
+			+ ((d_lo * m_lo) >> 32);
+#   endif
+	}
+#endif
+	return mtime_kernel_ns(mtime_clock);
+}  /* mtime_ns */
+
+
+/* Approximate wall-clock time (ns since the epoch) from the selected clock.
+ * Cheaper than gettimeofday() with tsc, but does not follow clock steps. */
+uint64_t mtime_wall_ns(void)
+{
+	return mtime_ns() + mtime_wall_offset_ns;
+}  /* mtime_wall_ns */
+
+
+const char *mtime_clock_name(void)
+{
+	switch (mtime_clock) {
+	  case MTIME_MONO: return "mono";
+	  case MTIME_RAW: return "raw";
+	  case MTIME_TSC: return "tsc";
+	  case MTIME_TSCP: return "tscp";
+	  case MTIME_QPC: return "qpc";
+	}
+	return "?";
+}  /* mtime_clock_name */
+
+
+/* Select the clock by name (NULL for the platform default), calibrate it
+ * if needed, and measure the cost of reading it.  Returns 0 on success;
+ * prints an error and returns -1 if the clock is unknown or unsupported. */
+int mtime_init(const char *clock_name)
+{
+	uint64_t start_ns, wall_ns;
+	int i;
+
+#if defined(_WIN32)
+	QueryPerformanceFrequency(&mtime_qpc_freq);
+	mtime_clock = MTIME_QPC;
+	if (clock_name != NULL && strcmp(clock_name, "qpc") != 0) {
+		fprintf(stderr, "ERROR: clock '%s' not supported on this platform (use qpc)\n", clock_name);
+		return -1;
+	}
+#else
+	if (clock_name == NULL || strcmp(clock_name, "mono") == 0)
+		mtime_clock = MTIME_MONO;
+	else if (strcmp(clock_name, "raw") == 0)
+		mtime_clock = MTIME_RAW;
+	else if (strcmp(clock_name, "tsc") == 0)
+		mtime_clock = MTIME_TSC;
+	else if (strcmp(clock_name, "tscp") == 0)
+		mtime_clock = MTIME_TSCP;
+	else {
+		fprintf(stderr, "ERROR: unknown clock '%s' (use mono, raw, tsc or tscp)\n", clock_name);
+		return -1;
+	}
+#   if !defined(CLOCK_MONOTONIC_RAW)
+	if (mtime_clock == MTIME_RAW) {
+		fprintf(stderr, "ERROR: clock 'raw' not supported on this platform\n");
+		return -1;
+	}
+#   endif
+
+	if (mtime_clock == MTIME_TSC || mtime_clock == MTIME_TSCP) {
+#   if defined(MTIME_HAVE_TSC)
+		unsigned int eax, ebx, ecx, edx;
+		uint64_t end_ns, end_ticks;
+
+		/* Without an invariant TSC the tick rate changes with power state. */
+		if (! __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || ! (edx & (1 << 8)))
+			fprintf(stderr, "WARNING: CPU does not report an invariant TSC; tsc timings may be wrong\n");
+
+		/* Calibrate against the unslewed kernel clock. */
+		mtime_tsc_base_ns = mtime_kernel_ns(MTIME_RAW);
+		mtime_tsc_base = __rdtsc();
+		do {
+			end_ns = mtime_kernel_ns(MTIME_RAW);
+			end_ticks = __rdtsc();
+		} while (end_ns - mtime_tsc_base_ns < MTIME_CALIBRATE_NS);
+		mtime_tsc_mult = (uint64_t)((double)(end_ns - mtime_tsc_base_ns) * 4294967296.0
+				/ (double)(end_ticks - mtime_tsc_base));
+		mtime_tsc_mhz = (double)(end_ticks - mtime_tsc_base) * 1000.0
+				/ (double)(end_ns - mtime_tsc_base_ns);
+#   else
+		fprintf(stderr, "ERROR: clock '%s' not supported on this platform\n", clock_name);
+		return -1;
+#   endif
+	}
+#endif /* _WIN32 */
+
+	/* Measure the cost of one clock read. */
+	start_ns = mtime_ns();
+	for (i = 0; i < MTIME_COST_LOOPS; ++i)
+		(void)mtime_ns();
+	mtime_read_cost_ns = (double)(mtime_ns() - start_ns) / (double)(MTIME_COST_LOOPS + 1);
+
+#if defined(_WIN32)
+	{
+		FILETIME ft;  /* 100 ns units since 1601 */
+		GetSystemTimeAsFileTime(&ft);
+		wall_ns = ((((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime)
+				- 116444736000000000ULL) * 100;
+	}
+#else
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		wall_ns = (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+	}
+#endif
+	mtime_wall_offset_ns = (int64_t)(wall_ns - mtime_ns());
+
+	return 0;
+}  /* mtime_init */
+
+
+/* One-line description of the clock for startup reports. */
+char *mtime_describe(char *buf, int buf_size)
+{
+#if defined(MTIME_HAVE_TSC)
+	if (mtime_clock == MTIME_TSC || mtime_clock == MTIME_TSCP) {
+		snprintf(buf, buf_size, "clock %s (%.1f MHz), read cost %.1f ns",
+				mtime_clock_name(), mtime_tsc_mhz, mtime_read_cost_ns);
+		return buf;
+	}
+#endif
+	snprintf(buf, buf_size, "clock %s, read cost %.1f ns",
+			mtime_clock_name(), mtime_read_cost_ns);
+	return buf;
+}  /* mtime_describe */
+
+#endif /* MTIME_H */
@@ -0,0 +1,167 @@
+/* mwire.h */
+/*   Binary message header shared by the mtools programs.
+ * See https://github.com/UltraMessaging/mtools
+ *
+ * Every message sent by msend, msnd and mpong starts with this 32-byte
+ * header, so any receiver can measure loss, reordering and one-way latency
+ * without string parsing.  All fields are in network byte order:
+ *
+ *   offset  size  field
+ *        0     4  magic (MWIRE_MAGIC)
+ *        4     1  version (MWIRE_VERSION)
+ *        5     1  type (MWIRE_TYPE_...)
+ *        6     2  payload_len (bytes following the header)
+ *        8     4  sender_id (chosen at startup by the sender)
+ *       12     4  stream_id
+ *       16     8  seq (per sender and stream)
+ *       24     8  send_ns (sender's wall clock, ns since the epoch)
+ *
+ * One-way latency is only meaningful when the sender's and receiver's
+ * clocks are synchronized (e.g. with PTP).
+ *
+ * Like mtime.h, this header holds definitions; include it once, after
+ * mtime.h.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef MWIRE_H
+#define MWIRE_H
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#   include <process.h>
+#   define MWIRE_GETPID _getpid
+#else
+#   include <unistd.h>
+#   include <arpa/inet.h>
+#   define MWIRE_GETPID getpid
+#endif
+
+#define MWIRE_MAGIC 0x4d544c53  /* "MTLS" */
+#define MWIRE_VERSION 1
+#define MWIRE_HDR_LEN 32
+
+#define MWIRE_TYPE_DATA 1
+#define MWIRE_TYPE_STAT 2  /* end of test; seq is the number of data msgs sent */
+#define MWIRE_TYPE_WARMUP 3
+#define MWIRE_TYPE_END 4  /* end of measurement (msnd) */
+#define MWIRE_TYPE_PING 5  /* mpong; reflected unchanged */
+
+/* Header fields in host byte order. */
+typedef struct mwire_hdr_s {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t type;
+	uint16_t payload_len;
+	uint32_t sender_id;
+	uint32_t stream_id;
+	uint64_t seq;
+	uint64_t send_ns;
+} mwire_hdr_t;
+
+
+/* 64-bit byte order conversion, built byte by byte so that it is correct
+ * on hosts of either endianness (there is no standard htonll). */
+uint64_t mwire_hton64(uint64_t val)
+{
+	unsigned char b[8];
+	uint64_t out;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		b[i] = (unsigned char)(val >> (56 - 8 * i));
+	memcpy(&out, b, 8);
+	return out;
+}  /* mwire_hton64 */
+
+uint64_t mwire_ntoh64(uint64_t val)
+{
+	unsigned char b[8];
+	uint64_t out = 0;
+	int i;
+
+	memcpy(b, &val, 8);
+	for (i = 0; i < 8; i++)
+		out = (out << 8) | b[i];
+	return out;
+}  /* mwire_ntoh64 */
+
+
+/* Write a header at 'buf' (which need not be aligned). */
+void mwire_encode(char *buf, int type, uint32_t sender_id, uint32_t stream_id,
+		uint64_t seq, uint64_t send_ns, int payload_len)
+{
+	uint32_t u32;
+	uint16_t u16;
+	uint64_t u64;
+
+	u32 = htonl(MWIRE_MAGIC);  memcpy(&buf[0], &u32, 4);
+	buf[4] = MWIRE_VERSION;
+	buf[5] = (char)type;
+	u16 = htons((uint16_t)payload_len);  memcpy(&buf[6], &u16, 2);
+	u32 = htonl(sender_id);  memcpy(&buf[8], &u32, 4);
+	u32 = htonl(stream_id);  memcpy(&buf[12], &u32, 4);
+	u64 = mwire_hton64(seq);  memcpy(&buf[16], &u64, 8);
+	u64 = mwire_hton64(send_ns);  memcpy(&buf[24], &u64, 8);
+}  /* mwire_encode */
+
+
+/* Parse the header of a received message.  Returns 0 if 'buf' holds a
+ * header of a version we understand, -1 if not (e.g. legacy text). */
+int mwire_decode(const char *buf, int len, mwire_hdr_t *hdr)
+{
+	uint32_t u32;
+	uint16_t u16;
+	uint64_t u64;
+
+	if (len < MWIRE_HDR_LEN)
+		return -1;
+	memcpy(&u32, &buf[0], 4);  hdr->magic = ntohl(u32);
+	hdr->version = (uint8_t)buf[4];
+	if (hdr->magic != MWIRE_MAGIC || hdr->version != MWIRE_VERSION)
+		return -1;
+	hdr->type = (uint8_t)buf[5];
+	memcpy(&u16, &buf[6], 2);  hdr->payload_len = ntohs(u16);
+	memcpy(&u32, &buf[8], 4);  hdr->sender_id = ntohl(u32);
+	memcpy(&u32, &buf[12], 4);  hdr->stream_id = ntohl(u32);
+	memcpy(&u64, &buf[16], 8);  hdr->seq = mwire_ntoh64(u64);
+	memcpy(&u64, &buf[24], 8);  hdr->send_ns = mwire_ntoh64(u64);
+	return 0;
+}  /* mwire_decode */
+
+
+const char *mwire_type_name(int type)
+{
+	switch (type) {
+	  case MWIRE_TYPE_DATA: return "data";
+	  case MWIRE_TYPE_STAT: return "stat";
+	  case MWIRE_TYPE_WARMUP: return "warmup";
+	  case MWIRE_TYPE_END: return "end";
+	  case MWIRE_TYPE_PING: return "ping";
+	}
+	return "unknown";
+}  /* mwire_type_name */
+
+
+/* A sender ID that is unlikely to collide with other processes. */
+uint32_t mwire_new_sender_id(void)
+{
+	uint64_t wall_ns = mtime_wall_ns();
+	return ((uint32_t)MWIRE_GETPID() << 16) ^ (uint32_t)wall_ns ^ (uint32_t)(wall_ns >> 32);
+}  /* mwire_new_sender_id */
+
+#endif /* MWIRE_H */